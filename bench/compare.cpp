@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <vector>
+#include "compare.h"
+
+struct Note
+{
+	vmd_time_t on_time, off_time;
+	vmd_pitch_t pitch;
+	int on_vel, off_vel;
+	int channel;
+	int program, volume;
+};
+
+static bool
+operator <(const Note &a, const Note &b)
+{
+	if (a.on_time != b.on_time)
+		return a.on_time < b.on_time;
+	if (a.channel != b.channel)
+		return a.channel < b.channel;
+	return a.pitch < b.pitch;
+}
+
+static void
+collect(vmd_file_t *file, std::vector<Note> *notes)
+{
+	for (int i = 0; i < file->tracks; i++) {
+		vmd_track_t *track = file->track[i];
+		int program = vmd_track_get_ctrl(track, VMD_CCTRL_PROGRAM);
+		int volume = vmd_track_get_ctrl(track, VMD_CCTRL_VOLUME);
+		vmd_bst_node_t *node;
+		VMD_BST_FOREACH(node, &track->notes) {
+			vmd_note_t *n = vmd_track_note(node);
+			Note note = {n->on_time, n->off_time, n->pitch, n->on_vel, n->off_vel,
+			             n->channel->number, program, volume};
+			notes->push_back(note);
+		}
+	}
+	std::sort(notes->begin(), notes->end());
+}
+
+static bool
+compare_tempo(vmd_file_t *got, vmd_file_t *want, FILE *log)
+{
+	vmd_time_t time = 0;
+	for (;;) {
+		vmd_time_t got_next, want_next;
+		int a = vmd_map_get(&got->ctrl[VMD_FCTRL_TEMPO], time, &got_next);
+		int b = vmd_map_get(&want->ctrl[VMD_FCTRL_TEMPO], time, &want_next);
+		if (a != b || got_next != want_next) {
+			fprintf(log, "tempo at %ld: %d until %ld, want %d until %ld\n",
+			        long(time), a, long(got_next), b, long(want_next));
+			return false;
+		}
+		if (got_next == VMD_MAX_TIME)
+			return true;
+		time = got_next;
+	}
+}
+
+bool
+compare_files(vmd_file_t *got, vmd_file_t *want, FILE *log)
+{
+	if (got->division != want->division) {
+		fprintf(log, "division %d, want %d\n", got->division, want->division);
+		return false;
+	}
+	if (!compare_tempo(got, want, log))
+		return false;
+
+	std::vector<Note> a, b;
+	collect(got, &a);
+	collect(want, &b);
+	for (size_t i = 0; i < std::min(a.size(), b.size()); i++) {
+		const Note &x = a[i], &y = b[i];
+		if (x.on_time != y.on_time || x.off_time != y.off_time || x.pitch != y.pitch
+		    || x.on_vel != y.on_vel || x.off_vel != y.off_vel || x.channel != y.channel
+		    || x.program != y.program || x.volume != y.volume) {
+			fprintf(log, "note %zu: %ld-%ld pitch %d vel %d/%d ch %d prog %d vol %d, "
+			        "want %ld-%ld pitch %d vel %d/%d ch %d prog %d vol %d\n", i,
+			        long(x.on_time), long(x.off_time), x.pitch, x.on_vel, x.off_vel, x.channel, x.program, x.volume,
+			        long(y.on_time), long(y.off_time), y.pitch, y.on_vel, y.off_vel, y.channel, y.program, y.volume);
+			return false;
+		}
+	}
+	if (a.size() != b.size()) {
+		fprintf(log, "%zu notes, want %zu\n", a.size(), b.size());
+		return false;
+	}
+	return true;
+}
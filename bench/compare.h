@@ -0,0 +1,18 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef COMPARE_H
+#define COMPARE_H
+
+#include <cstdio>
+#include <vomid.h>
+
+/* Compares two imported files note by note: times, pitch, velocities,
+ * channel, and the program and volume of the note's track, ignoring how
+ * the notes are split into tracks. Tempo maps are compared change by
+ * change. The first difference is described on log.
+ */
+bool compare_files(vmd_file_t *got, vmd_file_t *want, FILE *log);
+
+#endif /* COMPARE_H */
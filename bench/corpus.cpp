@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "corpus.h"
+
+const CorpusSpec corpus_specs[] = {
+	/* name          tracks   notes voices ctrl tempo micro */
+	{"tiny",              1,   1000,     1,   0,    0,    0},
+	{"small",             4,  10000,     2,   0,    1,    0},
+	{"dense",            16,  50000,     8,   0,    1,    0},
+	{"controllers",       8,  10000,     2,  24,    1,    0},
+	{"tempo",             4,  10000,     2,   0, 2000,    0},
+	{"microtonal",        8,  10000,     1,   0,    1,    8},
+	{"large",            16, 250000,     4, 120,  100,    2},
+};
+const int corpus_specs_count = sizeof(corpus_specs) / sizeof(corpus_specs[0]);
+
+static const int division = 480;
+/* ticks between the starts of a voice's notes */
+static const int step = division / 2;
+
+struct Event
+{
+	unsigned time;
+	/* at equal times: note offs, controllers, bends, note ons */
+	int order;
+	unsigned char data[16];
+	int size;
+};
+
+static bool
+operator <(const Event &a, const Event &b)
+{
+	return a.time != b.time ? a.time < b.time : a.order < b.order;
+}
+
+struct Rnd
+{
+	unsigned state;
+
+	Rnd(unsigned seed) : state(seed) { }
+	unsigned operator ()(unsigned n)
+	{
+		state = state * 1103515245 + 12345;
+		return (state >> 8) % n;
+	}
+};
+
+static void
+put32(std::vector<unsigned char> *out, unsigned v)
+{
+	for (int i = 3; i >= 0; i--)
+		out->push_back((v >> (i * 8)) & 0xff);
+}
+
+static void
+put_varlen(std::vector<unsigned char> *out, unsigned v)
+{
+	unsigned char buf[5];
+	int n = 0;
+	do {
+		buf[n++] = v & 0x7f;
+		v >>= 7;
+	} while (v != 0);
+	while (n-- > 0)
+		out->push_back(buf[n] | (n > 0 ? 0x80 : 0));
+}
+
+static void
+add(std::vector<Event> *events, unsigned time, int order, int a, int b, int c, int size)
+{
+	Event e = {time, order, {(unsigned char)a, (unsigned char)b, (unsigned char)c}, size};
+	events->push_back(e);
+}
+
+static void
+add_bytes(std::vector<Event> *events, unsigned time, int order, const unsigned char *data, int size)
+{
+	Event e = {time, order, {0}, size};
+	memcpy(e.data, data, size);
+	events->push_back(e);
+}
+
+/* a meta event holding text, as real files name their tracks */
+static void
+add_text(std::vector<Event> *events, int type, const char *text)
+{
+	unsigned char data[16] = {0xff, (unsigned char)type, (unsigned char)strlen(text)};
+	memcpy(data + 3, text, data[2]);
+	add_bytes(events, 0, 0, data, 3 + data[2]);
+}
+
+static void
+put_track(std::vector<unsigned char> *out, std::vector<Event> &events)
+{
+	std::stable_sort(events.begin(), events.end());
+	std::vector<unsigned char> body;
+	unsigned t = 0;
+	for (size_t i = 0; i < events.size(); i++) {
+		put_varlen(&body, events[i].time - t);
+		t = events[i].time;
+		body.insert(body.end(), events[i].data, events[i].data + events[i].size);
+	}
+	static const unsigned char eot[] = {0x00, 0xff, 0x2f, 0x00};
+	body.insert(body.end(), eot, eot + sizeof(eot));
+
+	static const char mtrk[] = "MTrk";
+	out->insert(out->end(), mtrk, mtrk + 4);
+	put32(out, body.size());
+	out->insert(out->end(), body.begin(), body.end());
+}
+
+static int
+channel_of(int track)
+{
+	int ch = track % 15;
+	return ch >= 9 ? ch + 1 : ch;
+}
+
+static std::vector<Event>
+note_track(const CorpusSpec &spec, int t, int notes, Rnd &rnd)
+{
+	std::vector<Event> ev;
+	int ch = channel_of(t);
+	bool micro = t < spec.micro_tracks;
+	int voices = micro ? 1 : std::max(1, std::min(spec.voices, 8));
+	unsigned end = 0;
+
+	char name[13];
+	snprintf(name, sizeof(name), "Track %d", t + 1);
+	add_text(&ev, 0x03, name);
+	add_text(&ev, 0x01, "corpus");
+	add(&ev, 0, 1, 0xc0 | ch, rnd(128), 0, 2);
+	add(&ev, 0, 1, 0xb0 | ch, 7, 100, 3);
+	for (int i = 0; i < notes; i++) {
+		int voice = i % voices;
+		unsigned on = unsigned(i / voices) * step + rnd(step / 4);
+		unsigned off = on + step / 4 + rnd(step / 2);
+		/* voices get disjoint pitch bands, so notes never collide */
+		int pitch = 24 + voice * 10 + rnd(10);
+		if (micro) {
+			int bend = rnd(0x4000);
+			add(&ev, on, 2, 0xe0 | ch, bend & 0x7f, bend >> 7, 3);
+		}
+		add(&ev, on, 3, 0x90 | ch, pitch, 1 + rnd(127), 3);
+		add(&ev, off, 0, 0x80 | ch, pitch, 64, 3);
+		end = std::max(end, off);
+	}
+
+	static const int ctrls[] = {1, 7, 10, 11};
+	for (unsigned time = 0; spec.ctrl_step > 0 && time < end; time += spec.ctrl_step)
+		add(&ev, time, 1, 0xb0 | ch, ctrls[(time / spec.ctrl_step) % 4], rnd(128), 3);
+	return ev;
+}
+
+static std::vector<Event>
+tempo_track(const CorpusSpec &spec, unsigned length, Rnd &rnd)
+{
+	std::vector<Event> ev;
+	/* GM reset */
+	static const unsigned char reset[] = {0xf0, 0x05, 0x7e, 0x7f, 0x09, 0x01, 0xf7};
+	add_bytes(&ev, 0, 0, reset, sizeof(reset));
+	add_text(&ev, 0x03, "Tempo");
+	for (int i = 0; i < std::max(spec.tempo_changes, 1); i++) {
+		unsigned time = unsigned(double(length) * i / std::max(spec.tempo_changes, 1));
+		unsigned tempo = 400000 + rnd(300000);
+		Event e = {time, 0, {0xff, 0x51, 0x03,
+			(unsigned char)(tempo >> 16), (unsigned char)(tempo >> 8), (unsigned char)tempo}, 6};
+		ev.push_back(e);
+	}
+	return ev;
+}
+
+std::vector<unsigned char>
+corpus_generate(const CorpusSpec &spec, double scale, unsigned seed)
+{
+	Rnd rnd(seed);
+	int notes = std::max(1, int(spec.notes * scale));
+	int voices = std::max(1, std::min(spec.voices, 8));
+	unsigned length = unsigned(notes / voices + 1) * step;
+
+	std::vector<unsigned char> out;
+	static const char mthd[] = "MThd";
+	out.insert(out.end(), mthd, mthd + 4);
+	put32(&out, 6);
+	out.push_back(0);
+	out.push_back(1);
+	out.push_back((spec.tracks + 1) >> 8);
+	out.push_back((spec.tracks + 1) & 0xff);
+	out.push_back(division >> 8);
+	out.push_back(division & 0xff);
+
+	std::vector<Event> ev = tempo_track(spec, length, rnd);
+	put_track(&out, ev);
+	for (int t = 0; t < spec.tracks; t++) {
+		ev = note_track(spec, t, notes, rnd);
+		put_track(&out, ev);
+	}
+	return out;
+}
+
+const CorpusSpec *
+corpus_find(const char *name)
+{
+	for (int i = 0; i < corpus_specs_count; i++) {
+		if (strcmp(corpus_specs[i].name, name) == 0)
+			return &corpus_specs[i];
+	}
+	return NULL;
+}
+
+bool
+corpus_write(const CorpusSpec &spec, double scale, unsigned seed, const char *path)
+{
+	std::vector<unsigned char> data = corpus_generate(spec, scale, seed);
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), f) == data.size();
+	return fclose(f) == 0 && ok;
+}
@@ -0,0 +1,38 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <vector>
+
+/* Deterministic synthetic Standard MIDI Files for the benchmarks. Like
+ * real files, they carry a GM reset, track names and text besides the
+ * notes.
+ */
+
+struct CorpusSpec
+{
+	const char *name;
+	int tracks;
+	/* per track, before scaling */
+	int notes;
+	/* notes sounding at once in a track */
+	int voices;
+	/* ticks between controller events, 0 for none */
+	int ctrl_step;
+	int tempo_changes;
+	/* tracks retuned note by note with pitch bends */
+	int micro_tracks;
+};
+
+extern const CorpusSpec corpus_specs[];
+extern const int corpus_specs_count;
+
+const CorpusSpec *corpus_find(const char *name);
+/* the same spec, scale and seed always give the same bytes */
+std::vector<unsigned char> corpus_generate(const CorpusSpec &, double scale, unsigned seed = 1);
+bool corpus_write(const CorpusSpec &, double scale, unsigned seed, const char *path);
+
+#endif /* CORPUS_H */
@@ -0,0 +1,202 @@
+/* SMF import throughput: vmd_file_import() vs the mapped reader,
+ * serial and parallel, and the load time of the same file saved in the
+ * native format. The parallel import is checked to export
+ * byte-identically to the serial one, and the mapped and native results
+ * are compared note by note with vmd_file_import()'s.
+ *
+ * usage: import_bench [-n runs] [-j threads] file.mid...
+ */
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vomid.h>
+#include "compare.h"
+#include "native.h"
+#include "smf.h"
+
+struct Result
+{
+	double sec;
+	size_t events;
+	bool ok;
+};
+
+static Result
+bench_library(const char *path, int runs)
+{
+	Result ret = {0, 0, true};
+	for (int i = 0; i < runs; i++) {
+		vmd_file_t f;
+		vmd_bool_t native;
+		QElapsedTimer t;
+		t.start();
+		ret.ok = vmd_file_import(&f, path, &native) == VMD_OK;
+		ret.sec += t.nsecsElapsed() / 1e9;
+		if (!ret.ok)
+			break;
+		vmd_file_fini(&f);
+	}
+	return ret;
+}
+
+static Result
+bench_mapped(const char *path, int runs, int threads, const QString &export_to)
+{
+	Result ret = {0, 0, true};
+	for (int i = 0; i < runs; i++) {
+		vmd_file_t f;
+		size_t events = 0;
+		QElapsedTimer t;
+		t.start();
+		{
+			SmfMap smf(path);
+			vmd_file_init(&f);
+			ret.ok = smf_import(&f, smf, &events, threads) == VMD_OK;
+		}
+		ret.sec += t.nsecsElapsed() / 1e9;
+		if (ret.ok && i == 0)
+			vmd_file_export(&f, export_to.toLocal8Bit().data());
+		vmd_file_fini(&f);
+		ret.events = events;
+		if (!ret.ok)
+			break;
+	}
+	return ret;
+}
+
+static Result
+bench_native(const char *path, int runs, const QString &native_path)
+{
+	Result ret = {0, 0, false};
+	{
+		vmd_file_t f;
+		SmfMap smf(path);
+		vmd_file_init(&f);
+		if (smf_import(&f, smf) == VMD_OK)
+			ret.ok = native_export(&f, native_path.toLocal8Bit().data()) == VMD_OK;
+		vmd_file_fini(&f);
+	}
+	for (int i = 0; ret.ok && i < runs; i++) {
+		vmd_file_t f;
+		QElapsedTimer t;
+		t.start();
+		{
+			NativeMap map(native_path);
+			vmd_file_init(&f);
+			ret.ok = native_import(&f, map) == VMD_OK;
+		}
+		ret.sec += t.nsecsElapsed() / 1e9;
+		vmd_file_fini(&f);
+	}
+	return ret;
+}
+
+/* compares the file, as read by the mapped reader or from its native
+ * copy, with the library import; files the mapped reader leaves to the
+ * library pass
+ */
+static bool
+matches_library(const char *path, int threads, const QString &native_path)
+{
+	vmd_file_t want;
+	vmd_bool_t native;
+	if (vmd_file_import(&want, path, &native) != VMD_OK)
+		return true;
+
+	bool ret = true;
+	vmd_file_t got;
+	vmd_file_init(&got);
+	vmd_status_t status;
+	{
+		SmfMap smf(path);
+		status = smf_import(&got, smf, NULL, threads);
+	}
+	if (status == VMD_OK && !compare_files(&got, &want, stdout)) {
+		printf("  mapped import differs from vmd_file_import()\n");
+		ret = false;
+	}
+	vmd_file_fini(&got);
+
+	if (status == VMD_OK && QFile::exists(native_path)) {
+		vmd_file_init(&got);
+		{
+			NativeMap map(native_path);
+			status = native_import(&got, map);
+		}
+		if (status == VMD_OK && !compare_files(&got, &want, stdout)) {
+			printf("  native copy differs from vmd_file_import()\n");
+			ret = false;
+		}
+		vmd_file_fini(&got);
+	}
+	vmd_file_fini(&want);
+	return ret;
+}
+
+static bool
+same_contents(const QString &a, const QString &b)
+{
+	QFile fa(a), fb(b);
+	if (!fa.open(QIODevice::ReadOnly) || !fb.open(QIODevice::ReadOnly))
+		return false;
+	return fa.readAll() == fb.readAll();
+}
+
+static void
+print(const char *name, const Result &r, double mb, int runs)
+{
+	if (!r.ok) {
+		printf("  %-8s n/a\n", name);
+		return;
+	}
+	double sec = r.sec / runs;
+	printf("  %-8s %9.2f ms %9.1f MB/s", name, sec * 1000, mb / sec);
+	if (r.events > 0)
+		printf(" %9.2f Mevents/s", r.events / sec / 1e6);
+	printf("\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int runs = 5;
+	int threads = 0;
+	int ret = 0;
+	QString serial_out = QDir::temp().filePath("import_bench_serial.mid");
+	QString parallel_out = QDir::temp().filePath("import_bench_parallel.mid");
+	QString native_out = QDir::temp().filePath("import_bench" NATIVE_SUFFIX);
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			runs = atoi(argv[++i]);
+			continue;
+		}
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			continue;
+		}
+		double mb = QFileInfo(argv[i]).size() / 1e6;
+		printf("%s (%.2f MB)\n", argv[i], mb);
+		print("library", bench_library(argv[i], runs), mb, runs);
+		Result serial = bench_mapped(argv[i], runs, 1, serial_out);
+		print("serial", serial, mb, runs);
+		Result parallel = bench_mapped(argv[i], runs, threads, parallel_out);
+		print("parallel", parallel, mb, runs);
+		if (serial.ok && parallel.ok && !same_contents(serial_out, parallel_out)) {
+			printf("  parallel import differs from serial import\n");
+			ret = 1;
+		}
+		print("native", bench_native(argv[i], runs, native_out), mb, runs);
+		if (!matches_library(argv[i], threads, native_out))
+			ret = 1;
+		QFile::remove(native_out);
+	}
+	QFile::remove(serial_out);
+	QFile::remove(parallel_out);
+	QFile::remove(native_out);
+	return ret;
+}
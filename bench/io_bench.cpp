@@ -0,0 +1,338 @@
+/* Import, export and save times of Standard MIDI Files: the library's
+ * import and export, an import-export-import round trip (checked to
+ * keep the notes and to export stably), File::save_as() and the native
+ * format: its full import, and opening it in a File up to the notes of
+ * the first 16 measures, which pages big files in. Results can be
+ * printed as CSV or JSON to track regressions.
+ *
+ * Without files, the synthetic corpus (see corpus.h) is generated into a
+ * temporary directory first.
+ *
+ * usage: io_bench [-n runs] [-s scale] [-f text|csv|json] [file.mid...]
+ */
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <vomid.h>
+#include "corpus.h"
+#include "file.h"
+#include "native.h"
+
+struct Row
+{
+	QString file;
+	const char *op;
+	qint64 bytes;
+	size_t notes;
+	std::vector<double> ms;
+	bool ok;
+};
+
+static size_t
+count_notes(vmd_file_t *f)
+{
+	size_t ret = 0;
+	for (int i = 0; i < f->tracks; i++)
+		ret += vmd_bst_size(&f->track[i]->notes);
+	return ret;
+}
+
+static double
+ms_since(const QElapsedTimer &t)
+{
+	return t.nsecsElapsed() / 1e6;
+}
+
+static QByteArray
+contents(const QString &path)
+{
+	QFile f(path);
+	return f.open(QIODevice::ReadOnly) ? f.readAll() : QByteArray();
+}
+
+static bool
+import(vmd_file_t *f, const QString &path)
+{
+	vmd_bool_t native;
+	return vmd_file_import(f, path.toLocal8Bit().data(), &native) == VMD_OK;
+}
+
+static Row
+row(const QString &path, const char *op)
+{
+	Row ret;
+	ret.file = QFileInfo(path).fileName();
+	ret.op = op;
+	ret.bytes = QFileInfo(path).size();
+	ret.notes = 0;
+	ret.ok = true;
+	return ret;
+}
+
+static Row
+bench_import(const QString &path, int runs)
+{
+	Row ret = row(path, "import");
+	for (int i = 0; ret.ok && i < runs; i++) {
+		vmd_file_t f;
+		QElapsedTimer t;
+		t.start();
+		ret.ok = import(&f, path);
+		ret.ms.push_back(ms_since(t));
+		if (ret.ok) {
+			ret.notes = count_notes(&f);
+			vmd_file_fini(&f);
+		}
+	}
+	return ret;
+}
+
+static Row
+bench_export(const QString &path, int runs, const QString &out)
+{
+	Row ret = row(path, "export");
+	vmd_file_t f;
+	if (!(ret.ok = import(&f, path)))
+		return ret;
+	ret.notes = count_notes(&f);
+	for (int i = 0; ret.ok && i < runs; i++) {
+		QElapsedTimer t;
+		t.start();
+		ret.ok = vmd_file_export(&f, out.toLocal8Bit().data()) == VMD_OK;
+		ret.ms.push_back(ms_since(t));
+	}
+	vmd_file_fini(&f);
+	return ret;
+}
+
+static Row
+bench_roundtrip(const QString &path, int runs, const QString &out, const QString &out2)
+{
+	Row ret = row(path, "roundtrip");
+	for (int i = 0; ret.ok && i < runs; i++) {
+		vmd_file_t a, b;
+		QElapsedTimer t;
+		t.start();
+		if (!(ret.ok = import(&a, path)))
+			break;
+		ret.ok = vmd_file_export(&a, out.toLocal8Bit().data()) == VMD_OK && import(&b, out);
+		ret.ms.push_back(ms_since(t));
+		if (ret.ok) {
+			ret.notes = count_notes(&a);
+			ret.ok = count_notes(&b) == ret.notes
+			      && vmd_file_export(&b, out2.toLocal8Bit().data()) == VMD_OK
+			      && contents(out) == contents(out2);
+			vmd_file_fini(&b);
+		}
+		vmd_file_fini(&a);
+	}
+	return ret;
+}
+
+static Row
+bench_save_as(const QString &path, int runs, const QString &out)
+{
+	Row ret = row(path, "save_as");
+	try {
+		File f(path);
+		ret.notes = count_notes(&f);
+		for (int i = 0; ret.ok && i < runs; i++) {
+			QElapsedTimer t;
+			t.start();
+			f.save_as(out);
+			f.wait_saved();
+			ret.ms.push_back(ms_since(t));
+			ret.ok = f.saved();
+		}
+	} catch (const std::exception &) {
+		ret.ok = false;
+	}
+	return ret;
+}
+
+static Row
+bench_native(const QString &path, int runs, const QString &out, Row *load)
+{
+	Row ret = row(path, "native_export");
+	*load = row(path, "native_import");
+	vmd_file_t f;
+	if (!(ret.ok = load->ok = import(&f, path)))
+		return ret;
+	ret.notes = load->notes = count_notes(&f);
+	for (int i = 0; ret.ok && i < runs; i++) {
+		QElapsedTimer t;
+		t.start();
+		ret.ok = native_export(&f, out.toLocal8Bit().data()) == VMD_OK;
+		ret.ms.push_back(ms_since(t));
+	}
+	vmd_file_fini(&f);
+
+	load->ok = ret.ok;
+	for (int i = 0; load->ok && i < runs; i++) {
+		vmd_file_t g;
+		QElapsedTimer t;
+		t.start();
+		{
+			NativeMap map(out);
+			vmd_file_init(&g);
+			load->ok = native_import(&g, map) == VMD_OK;
+		}
+		load->ms.push_back(ms_since(t));
+		load->ok = load->ok && count_notes(&g) == load->notes;
+		vmd_file_fini(&g);
+	}
+	return ret;
+}
+
+/* File opening a native file as the editor does, up to the notes of the
+ * first screen: pages in big files, fully imports small ones
+ */
+static Row
+bench_native_open(const QString &native_path, int runs, const Row &load)
+{
+	Row ret = row(native_path, "native_open");
+	ret.file = load.file;
+	for (int i = 0; ret.ok && i < runs; i++) {
+		try {
+			QElapsedTimer t;
+			t.start();
+			File f(native_path);
+			f.require(0, vmd_time_t(f.division) * 4 * 16);
+			ret.ms.push_back(ms_since(t));
+			ret.notes = count_notes(&f);
+		} catch (const std::exception &) {
+			ret.ok = false;
+		}
+	}
+	return ret;
+}
+
+struct Stats
+{
+	double min, median, mean, max;
+};
+
+static Stats
+stats(std::vector<double> ms)
+{
+	Stats ret = {0, 0, 0, 0};
+	if (ms.empty())
+		return ret;
+	std::sort(ms.begin(), ms.end());
+	ret.min = ms.front();
+	ret.max = ms.back();
+	ret.median = ms[ms.size() / 2];
+	for (size_t i = 0; i < ms.size(); i++)
+		ret.mean += ms[i] / ms.size();
+	return ret;
+}
+
+static void
+print(const std::vector<Row> &rows, const char *format)
+{
+	bool csv = strcmp(format, "csv") == 0;
+	bool json = strcmp(format, "json") == 0;
+
+	if (csv)
+		printf("file,op,bytes,notes,runs,min_ms,median_ms,mean_ms,max_ms,mb_s,ok\n");
+	else if (json)
+		printf("[\n");
+	else
+		printf("%-20s %-14s %10s %9s %10s %10s %9s\n",
+			"file", "op", "bytes", "notes", "median ms", "min ms", "MB/s");
+
+	for (size_t i = 0; i < rows.size(); i++) {
+		const Row &r = rows[i];
+		Stats s = stats(r.ms);
+		QByteArray file = r.file.toUtf8();
+		double mbs = s.median > 0 ? r.bytes / 1e3 / s.median : 0;
+		if (csv) {
+			printf("%s,%s,%lld,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.1f,%d\n",
+				file.data(), r.op, (long long)r.bytes, r.notes, r.ms.size(),
+				s.min, s.median, s.mean, s.max, mbs, r.ok);
+		} else if (json) {
+			printf("  {\"file\": \"%s\", \"op\": \"%s\", \"bytes\": %lld, \"notes\": %zu, \"runs\": %zu, "
+				"\"min_ms\": %.3f, \"median_ms\": %.3f, \"mean_ms\": %.3f, \"max_ms\": %.3f, "
+				"\"mb_s\": %.1f, \"ok\": %s}%s\n",
+				file.data(), r.op, (long long)r.bytes, r.notes, r.ms.size(),
+				s.min, s.median, s.mean, s.max, mbs, r.ok ? "true" : "false",
+				i + 1 < rows.size() ? "," : "");
+		} else if (!r.ok) {
+			printf("%-20s %-14s %10lld %9zu %10s\n", file.data(), r.op, (long long)r.bytes, r.notes, "FAILED");
+		} else {
+			printf("%-20s %-14s %10lld %9zu %10.2f %10.2f %9.1f\n",
+				file.data(), r.op, (long long)r.bytes, r.notes, s.median, s.min, mbs);
+		}
+	}
+	if (json)
+		printf("]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+	int runs = 5;
+	double scale = 1;
+	const char *format = "text";
+	QStringList files;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			scale = atof(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			format = argv[++i];
+		else
+			files << QString::fromLocal8Bit(argv[i]);
+	}
+
+	QTemporaryDir tmp;
+	if (!tmp.isValid()) {
+		fprintf(stderr, "cannot create a temporary directory\n");
+		return 1;
+	}
+	if (files.isEmpty()) {
+		for (int i = 0; i < corpus_specs_count; i++) {
+			QString path = tmp.filePath(QString(corpus_specs[i].name) + ".mid");
+			if (!corpus_write(corpus_specs[i], scale, 1, path.toLocal8Bit().data())) {
+				fprintf(stderr, "%s: cannot write\n", path.toLocal8Bit().data());
+				return 1;
+			}
+			files << path;
+		}
+	}
+
+	QString out = tmp.filePath("out.mid");
+	QString out2 = tmp.filePath("out2.mid");
+	QString native_out = tmp.filePath("out" NATIVE_SUFFIX);
+	std::vector<Row> rows;
+	for (int i = 0; i < files.size(); i++) {
+		Row native_import;
+		rows.push_back(bench_import(files[i], runs));
+		rows.push_back(bench_export(files[i], runs, out));
+		rows.push_back(bench_roundtrip(files[i], runs, out, out2));
+		rows.push_back(bench_save_as(files[i], runs, out));
+		rows.push_back(bench_native(files[i], runs, native_out, &native_import));
+		rows.push_back(native_import);
+		if (native_import.ok)
+			rows.push_back(bench_native_open(native_out, runs, native_import));
+	}
+	print(rows, format);
+
+	for (size_t i = 0; i < rows.size(); i++) {
+		if (!rows[i].ok)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+/* Writes the synthetic benchmark corpus as <dir>/<spec>.mid.
+ *
+ * usage: midi_corpus [-s scale] [-r seed] dir [spec...]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "corpus.h"
+
+int
+main(int argc, char **argv)
+{
+	double scale = 1;
+	unsigned seed = 1;
+	const char *dir = NULL;
+	int ret = 0;
+
+	int i = 1;
+	for (; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+			scale = atof(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			seed = strtoul(argv[++i], NULL, 0);
+		else
+			break;
+	}
+	if (i == argc || scale <= 0) {
+		fprintf(stderr, "usage: midi_corpus [-s scale] [-r seed] dir [spec...]\nspecs:");
+		for (int j = 0; j < corpus_specs_count; j++)
+			fprintf(stderr, " %s", corpus_specs[j].name);
+		fprintf(stderr, "\n");
+		return 2;
+	}
+	dir = argv[i++];
+
+	for (int j = 0; j < corpus_specs_count; j++) {
+		const CorpusSpec &spec = corpus_specs[j];
+		bool wanted = i == argc;
+		for (int k = i; k < argc; k++)
+			wanted = wanted || strcmp(argv[k], spec.name) == 0;
+		if (!wanted)
+			continue;
+
+		std::string path = std::string(dir) + "/" + spec.name + ".mid";
+		if (corpus_write(spec, scale, seed, path.c_str())) {
+			printf("%s\n", path.c_str());
+		} else {
+			fprintf(stderr, "%s: cannot write\n", path.c_str());
+			ret = 1;
+		}
+	}
+	for (int k = i; k < argc; k++) {
+		if (corpus_find(argv[k]) == NULL) {
+			fprintf(stderr, "%s: no such spec\n", argv[k]);
+			ret = 1;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,127 @@
+/* Range and hit queries: vmd_track_range() walk vs NoteIndex, through
+ * its callback and as a scan over the arrays of runs().
+ *
+ * usage: note_index_bench [notes] [queries]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <vomid.h>
+#include "note_index.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static unsigned rnd_state = 1;
+
+static unsigned
+rnd(unsigned n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+static double
+ms_since(Clock::time_point t)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
+static void *
+count_clb(vmd_note_t *, void *n)
+{
+	++*static_cast<size_t *>(n);
+	return NULL;
+}
+
+static size_t
+count(vmd_note_t *n)
+{
+	size_t ret = 0;
+	for (; n != NULL; n = n->next)
+		ret++;
+	return ret;
+}
+
+static void
+fill(vmd_track_t *track, int notes, int division, int long_every)
+{
+	for (int i = 0; i < notes; i++) {
+		vmd_time_t on = vmd_time_t(i) * division / 8;
+		vmd_time_t len = division / 4 + rnd(division);
+		if (long_every > 0 && i % long_every == 0)
+			len = division * 64;
+		vmd_track_insert(track, on, on + len, 24 + rnd(72));
+	}
+}
+
+static void
+run(const char *name, int notes, int queries, int long_every, vmd_time_t q_width, int q_pitches)
+{
+	vmd_file_t file;
+	vmd_file_init(&file);
+	vmd_track_t *track = vmd_track_create(&file, VMD_CHANMASK_ALL);
+	fill(track, notes, file.division, long_every);
+	vmd_time_t length = vmd_track_length(track);
+
+	Clock::time_point t = Clock::now();
+	NoteIndex index(track);
+	double build_ms = ms_since(t);
+
+	size_t found_walk = 0, found_index = 0;
+	unsigned seed = rnd_state;
+
+	t = Clock::now();
+	for (int i = 0; i < queries; i++) {
+		vmd_time_t tb = rnd(length);
+		vmd_pitch_t pb = rnd(128 - q_pitches);
+		found_walk += count(vmd_track_range(track, tb, tb + q_width, pb, pb + q_pitches));
+	}
+	double walk_ms = ms_since(t);
+
+	rnd_state = seed;
+	t = Clock::now();
+	for (int i = 0; i < queries; i++) {
+		vmd_time_t tb = rnd(length);
+		vmd_pitch_t pb = rnd(128 - q_pitches);
+		index.for_range(tb, tb + q_width, pb, pb + q_pitches, count_clb, &found_index);
+	}
+	double index_ms = ms_since(t);
+
+	size_t found_scan = 0;
+	std::vector<NoteIndex::Run> runs;
+	rnd_state = seed;
+	t = Clock::now();
+	for (int i = 0; i < queries; i++) {
+		vmd_time_t tb = rnd(length);
+		vmd_pitch_t pb = rnd(128 - q_pitches);
+		runs.clear();
+		index.runs(tb, tb + q_width, pb, pb + q_pitches, runs);
+		for (size_t j = 0; j < runs.size(); j++)
+			found_scan += runs[j].size;
+	}
+	double scan_ms = ms_since(t);
+
+	printf("%-14s %9d %9.2f %12.1f %12.1f %12.1f %8.2fx%s\n",
+		name, notes, build_ms,
+		walk_ms * 1e6 / queries, index_ms * 1e6 / queries, scan_ms * 1e6 / queries,
+		walk_ms / scan_ms,
+		found_walk == found_index && found_walk == found_scan ? "" : "  MISMATCH");
+	vmd_file_fini(&file);
+}
+
+int
+main(int argc, char **argv)
+{
+	int notes = argc > 1 ? atoi(argv[1]) : 100000;
+	int queries = argc > 2 ? atoi(argv[2]) : 10000;
+
+	printf("%-14s %9s %9s %12s %12s %12s %9s\n",
+		"workload", "notes", "build ms", "walk ns/q", "index ns/q", "scan ns/q", "speedup");
+	run("hit", notes, queries, 0, 1, 1);
+	run("hit/long", notes, queries, 16, 1, 1);
+	run("rect", notes, queries, 0, 1920, 12);
+	run("rect/long", notes, queries, 16, 1920, 12);
+	run("rect/wide", notes, queries, 16, 1920, 96);
+	return 0;
+}
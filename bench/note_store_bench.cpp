@@ -0,0 +1,340 @@
+/* The note store operations behind every GUI interaction, in ns/op and
+ * allocations/op, over tracks of 10^3 notes up to the given count in a
+ * dense and a sparse pitch layout. Commits and updates are run against
+ * a short and a long undo history.
+ *
+ * Allocations are counted by interposing malloc(), which needs glibc;
+ * elsewhere they are reported as -1.
+ *
+ * usage: note_store_bench [-n max_notes] [-q ops] [-f text|csv|json]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vomid.h>
+
+static size_t allocs = 0;
+
+#if defined(__GLIBC__)
+#define COUNT_ALLOCS
+
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void __libc_free(void *);
+}
+
+extern "C" void *
+malloc(size_t n)
+{
+	allocs++;
+	return __libc_malloc(n);
+}
+
+extern "C" void *
+calloc(size_t n, size_t size)
+{
+	allocs++;
+	return __libc_calloc(n, size);
+}
+
+extern "C" void *
+realloc(void *p, size_t n)
+{
+	allocs++;
+	return __libc_realloc(p, n);
+}
+
+extern "C" void
+free(void *p)
+{
+	__libc_free(p);
+}
+
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static unsigned rnd_state = 1;
+
+static unsigned
+rnd(unsigned n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+enum Layout
+{
+	DENSE,
+	SPARSE
+};
+
+static const char *layout_names[] = {"dense", "sparse"};
+
+struct Result
+{
+	const char *op;
+	Layout layout;
+	int notes;
+	long ops;
+	double ns;
+	double allocs;
+};
+
+static std::vector<Result> results;
+
+/* brackets the timed part of a benchmark */
+struct Probe
+{
+	Clock::time_point t;
+	size_t allocs;
+
+	Probe() : t(Clock::now()), allocs(::allocs) { }
+
+	void done(const char *op, Layout layout, int notes, long ops)
+	{
+		double ns = std::chrono::duration<double, std::nano>(Clock::now() - t).count();
+		size_t n = ::allocs - allocs;
+		Result r = {op, layout, notes, ops, ops > 0 ? ns / ops : 0, ops > 0 ? double(n) / ops : 0};
+#ifndef COUNT_ALLOCS
+		r.allocs = -1;
+#endif
+		results.push_back(r);
+	}
+};
+
+struct Shape
+{
+	/* ticks between note starts */
+	vmd_time_t step;
+	vmd_pitch_t low, pitches;
+};
+
+static Shape
+shape(Layout layout, int division)
+{
+	Shape ret;
+	if (layout == DENSE) {
+		/* chords all over the keyboard */
+		ret.step = division / 16;
+		ret.low = 0;
+		ret.pitches = 128;
+	} else {
+		/* a melody in two octaves */
+		ret.step = division;
+		ret.low = 48;
+		ret.pitches = 24;
+	}
+	return ret;
+}
+
+static void
+fill(vmd_track_t *track, int notes, const Shape &s)
+{
+	for (int i = 0; i < notes; i++) {
+		vmd_time_t on = vmd_time_t(i) * s.step;
+		vmd_track_insert(track, on, on + s.step + rnd(s.step * 4), s.low + rnd(s.pitches));
+	}
+}
+
+static void *
+count_clb(vmd_note_t *, void *n)
+{
+	++*static_cast<size_t *>(n);
+	return NULL;
+}
+
+static void
+bench_queries(vmd_track_t *track, Layout layout, int notes, int ops, vmd_time_t width)
+{
+	vmd_time_t length = vmd_track_length(track);
+	size_t found = 0;
+
+	Probe range;
+	for (int i = 0; i < ops; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_pitch_t p = rnd(116);
+		for (vmd_note_t *n = vmd_track_range(track, t, t + width, p, p + 12); n != NULL; n = n->next)
+			found++;
+	}
+	range.done("range", layout, notes, ops);
+
+	Probe for_range;
+	for (int i = 0; i < ops; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_track_for_range(track, t, t + width, count_clb, &found);
+	}
+	for_range.done("for_range", layout, notes, ops);
+}
+
+static void
+bench_edits(vmd_track_t *track, Layout layout, int notes, int ops, const Shape &s)
+{
+	vmd_time_t length = vmd_track_length(track);
+	std::vector<vmd_note_t *> inserted;
+	inserted.reserve(ops);
+
+	Probe insert;
+	for (int i = 0; i < ops; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_note_t *n = vmd_track_insert(track, t, t + s.step, s.low + rnd(s.pitches));
+		if (n != NULL)
+			inserted.push_back(n);
+	}
+	insert.done("insert", layout, notes, ops);
+
+	Probe erase;
+	for (size_t i = 0; i < inserted.size(); i++)
+		vmd_erase_note(inserted[i]);
+	erase.done("erase", layout, notes, inserted.size());
+
+	std::vector<vmd_note_t *> sources;
+	for (int i = 0; i < ops; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_note_t *n = vmd_track_range(track, t, t + s.step * 16, s.low, s.low + s.pitches);
+		if (n != NULL)
+			sources.push_back(n);
+	}
+	inserted.clear();
+	Probe copy;
+	for (size_t i = 0; i < sources.size(); i++) {
+		vmd_note_t *n = vmd_copy_note(sources[i], track, s.step / 2, 0);
+		if (n != NULL)
+			inserted.push_back(n);
+	}
+	copy.done("copy_note", layout, notes, sources.size());
+	for (size_t i = 0; i < inserted.size(); i++)
+		vmd_erase_note(inserted[i]);
+}
+
+static void
+bench_history(vmd_file_t *file, vmd_track_t *track, Layout layout, int notes, int ops, int history, const Shape &s)
+{
+	vmd_time_t length = vmd_track_length(track);
+	std::vector<vmd_file_rev_t *> revs;
+	revs.push_back(vmd_file_commit(file));
+	for (int i = 1; i < history; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_track_insert(track, t, t + s.step, s.low + rnd(s.pitches));
+		revs.push_back(vmd_file_commit(file));
+	}
+
+	const char *commit_op = history > 1 ? "commit/long" : "commit";
+	const char *update_op = history > 1 ? "update/long" : "update";
+	Probe commit;
+	for (int i = 0; i < ops; i++) {
+		vmd_time_t t = rnd(length);
+		vmd_track_insert(track, t, t + s.step, s.low + rnd(s.pitches));
+		revs.push_back(vmd_file_commit(file));
+	}
+	commit.done(commit_op, layout, notes, ops);
+
+	/* undo and redo across the whole history */
+	vmd_file_rev_t *first = revs.front(), *last = revs.back();
+	Probe update;
+	for (int i = 0; i < ops; i++)
+		vmd_file_update(file, i % 2 == 0 ? first : last);
+	update.done(update_op, layout, notes, ops);
+	vmd_file_update(file, last);
+}
+
+static void
+run(Layout layout, int notes, int ops)
+{
+	vmd_file_t file;
+	vmd_file_init(&file);
+	vmd_track_t *track = file.track[file.tracks++] = vmd_track_create(&file, VMD_CHANMASK_ALL);
+	Shape s = shape(layout, file.division);
+	fill(track, notes, s);
+
+	bench_queries(track, layout, notes, ops, file.division * 4);
+	bench_edits(track, layout, notes, ops, s);
+	bench_history(&file, track, layout, notes, ops / 10, 1, s);
+	bench_history(&file, track, layout, notes, ops / 10, 1000, s);
+
+	/* selection deletes: the notes starting in disjoint windows */
+	vmd_time_t length = vmd_track_length(track);
+	int windows = std::max(ops / 10, 1);
+	vmd_time_t spacing = length / windows;
+	std::vector<vmd_note_t *> lists;
+	long erased = 0;
+	for (int i = 0; spacing > 0 && i < windows; i++) {
+		vmd_time_t t = i * spacing;
+		vmd_time_t end = t + std::min(spacing, s.step * 4);
+		vmd_note_t *head = NULL, **tail = &head;
+		for (vmd_note_t *n = vmd_track_range(track, t, end, 0, 128); n != NULL; n = n->next) {
+			if (t <= n->on_time && n->on_time < end) {
+				*tail = n;
+				tail = &n->next;
+				erased++;
+			}
+		}
+		*tail = NULL;
+		lists.push_back(head);
+	}
+	Probe erase;
+	for (size_t i = 0; i < lists.size(); i++)
+		vmd_erase_notes(lists[i]);
+	erase.done("erase_notes", layout, notes, erased);
+
+	vmd_file_fini(&file);
+}
+
+static void
+print(const char *format)
+{
+	bool csv = strcmp(format, "csv") == 0;
+	bool json = strcmp(format, "json") == 0;
+
+	if (csv)
+		printf("op,layout,notes,ops,ns_op,allocs_op\n");
+	else if (json)
+		printf("[\n");
+	else
+		printf("%-12s %-7s %9s %8s %12s %10s\n", "op", "layout", "notes", "ops", "ns/op", "allocs/op");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		const char *layout = layout_names[r.layout];
+		if (csv) {
+			printf("%s,%s,%d,%ld,%.1f,%.2f\n", r.op, layout, r.notes, r.ops, r.ns, r.allocs);
+		} else if (json) {
+			printf("  {\"op\": \"%s\", \"layout\": \"%s\", \"notes\": %d, \"ops\": %ld, "
+				"\"ns_op\": %.1f, \"allocs_op\": %.2f}%s\n",
+				r.op, layout, r.notes, r.ops, r.ns, r.allocs, i + 1 < results.size() ? "," : "");
+		} else {
+			printf("%-12s %-7s %9d %8ld %12.1f %10.2f\n", r.op, layout, r.notes, r.ops, r.ns, r.allocs);
+		}
+	}
+	if (json)
+		printf("]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int max_notes = 1000000;
+	int ops = 10000;
+	const char *format = "text";
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			max_notes = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			ops = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			format = argv[++i];
+	}
+
+	for (int notes = 1000; notes <= max_notes; notes *= 10) {
+		run(DENSE, notes, ops);
+		run(SPARSE, notes, ops);
+	}
+	print(format);
+	return 0;
+}
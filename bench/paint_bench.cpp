@@ -0,0 +1,244 @@
+/* WPiano paint times on Qt's offscreen platform.
+ *
+ * A synthetic file is shown in a scroll area the size of a window, and
+ * scripted sequences are replayed one frame at a time: scrolling, zooming
+ * (WPiano has a fixed scale, so the viewport is resized instead), cursor
+ * moves by keys, and playback follow (the player runs on a stepped
+ * virtual clock, advanced a sixteenth at 120 bpm per frame, and the view
+ * follows it as during playback). Each frame is a synchronous
+ * repaint of the visible part of the piano roll; percentiles of the frame
+ * times are reported per note density and notesystem size.
+ *
+ * usage: paint_bench [-q quarters] [-n frames] [-f text|csv|json]
+ */
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QKeyEvent>
+#include <QScrollArea>
+#include <QScrollBar>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vomid.h>
+#include "clock.h"
+#include "file.h"
+#include "player.h"
+#include "w_piano.h"
+
+static const int window_width = 1280;
+static const int window_height = 720;
+
+static unsigned rnd_state = 1;
+
+static unsigned
+rnd(unsigned n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+struct Result
+{
+	const char *sequence;
+	int density;
+	int scale;
+	std::vector<double> ms;
+};
+
+static std::vector<Result> results;
+
+struct Bench
+{
+	VirtualClock *clock;
+	QScrollArea *area;
+	WPiano *piano;
+	int density, scale;
+
+	void frame(std::vector<double> *ms)
+	{
+		QElapsedTimer t;
+		t.start();
+		piano->repaint(piano->viewport());
+		ms->push_back(t.nsecsElapsed() / 1e6);
+	}
+
+	void key(int key, std::vector<double> *ms)
+	{
+		QKeyEvent ev(QEvent::KeyPress, key, Qt::NoModifier);
+		QApplication::sendEvent(piano, &ev);
+		frame(ms);
+	}
+
+	void done(const char *sequence, const std::vector<double> &ms)
+	{
+		Result r = {sequence, density, scale, ms};
+		results.push_back(r);
+	}
+
+	void scroll(int frames)
+	{
+		std::vector<double> ms;
+		QScrollBar *hs = area->horizontalScrollBar();
+		hs->setValue(0);
+		for (int i = 0; i < frames; i++) {
+			hs->setValue(hs->value() + 40);
+			frame(&ms);
+		}
+		done("scroll", ms);
+	}
+
+	void zoom(int frames)
+	{
+		std::vector<double> ms;
+		for (int i = 0; i < frames; i++) {
+			/* from a quarter to twice the window and back */
+			double k = 0.25 + 1.75 * (i % 32 < 16 ? i % 16 : 16 - i % 16) / 16;
+			area->resize(int(window_width * k), int(window_height * k));
+			frame(&ms);
+		}
+		area->resize(window_width, window_height);
+		done("zoom", ms);
+	}
+
+	void cursor(int frames)
+	{
+		static const int keys[] = {Qt::Key_Right, Qt::Key_Right, Qt::Key_Up, Qt::Key_Right, Qt::Key_Down};
+		std::vector<double> ms;
+		piano->setCursorTime(0);
+		for (int i = 0; i < frames; i++)
+			key(keys[i % 5], &ms);
+		done("cursor", ms);
+	}
+
+	void follow(int frames)
+	{
+		std::vector<double> ms;
+		area->horizontalScrollBar()->setValue(0);
+		piano->setCursorTime(0);
+		piano->player()->play(piano->file(), 0);
+		for (int i = 0; i < frames; i++) {
+			clock->advance(0.125);
+			piano->follow_player();
+			frame(&ms);
+		}
+		piano->player()->stop();
+		done("follow", ms);
+	}
+};
+
+static void
+fill(File *file, vmd_track_t *track, int quarters, int density)
+{
+	vmd_pitch_t pitches = std::min(int(track->notesystem.end_pitch), 128);
+	vmd_time_t step = file->division / density;
+	for (vmd_time_t t = 0; t < vmd_time_t(quarters) * file->division; t += step) {
+		vmd_time_t len = step + rnd(file->division * 2);
+		vmd_track_insert(track, t, t + len, rnd(pitches));
+	}
+	file->reset_history();
+}
+
+static void
+run(Player *player, int quarters, int frames, int density, int scale)
+{
+	File file;
+	vmd_track_t *track = file.add_track(VMD_CHANMASK_NODRUMS, scale == 12 ? QString() : QString::number(scale));
+	if (track == NULL)
+		return;
+	fill(&file, track, quarters, density);
+
+	QScrollArea area;
+	area.resize(window_width, window_height);
+	Bench b;
+	b.clock = static_cast<VirtualClock *>(player->clock());
+	b.area = &area;
+	b.piano = new WPiano(&file, track, 0, player);
+	b.density = density;
+	b.scale = scale;
+	area.setWidget(b.piano);
+	area.show();
+	b.piano->adjust_y();
+	QApplication::processEvents();
+
+	b.scroll(frames);
+	b.zoom(frames);
+	b.cursor(frames);
+	b.follow(frames);
+}
+
+static double
+percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min(sorted.size() - 1, size_t(sorted.size() * p))];
+}
+
+static void
+print(const char *format)
+{
+	bool csv = strcmp(format, "csv") == 0;
+	bool json = strcmp(format, "json") == 0;
+
+	if (csv)
+		printf("sequence,density,scale,frames,p50_ms,p90_ms,p99_ms,max_ms\n");
+	else if (json)
+		printf("[\n");
+	else
+		printf("%-8s %8s %6s %7s %8s %8s %8s %8s\n",
+			"sequence", "notes/q", "scale", "frames", "p50 ms", "p90 ms", "p99 ms", "max ms");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		Result &r = results[i];
+		std::sort(r.ms.begin(), r.ms.end());
+		double p50 = percentile(r.ms, 0.5), p90 = percentile(r.ms, 0.9), p99 = percentile(r.ms, 0.99);
+		double max = r.ms.empty() ? 0 : r.ms.back();
+		if (csv) {
+			printf("%s,%d,%d,%zu,%.3f,%.3f,%.3f,%.3f\n",
+				r.sequence, r.density, r.scale, r.ms.size(), p50, p90, p99, max);
+		} else if (json) {
+			printf("  {\"sequence\": \"%s\", \"density\": %d, \"scale\": %d, \"frames\": %zu, "
+				"\"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f}%s\n",
+				r.sequence, r.density, r.scale, r.ms.size(), p50, p90, p99, max,
+				i + 1 < results.size() ? "," : "");
+		} else {
+			printf("%-8s %8d %6d %7zu %8.3f %8.3f %8.3f %8.3f\n",
+				r.sequence, r.density, r.scale, r.ms.size(), p50, p90, p99, max);
+		}
+	}
+	if (json)
+		printf("]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+	VirtualClock clock(true);
+	Player player(&clock);
+	int quarters = 2000;
+	int frames = 200;
+	const char *format = "text";
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			quarters = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			format = argv[++i];
+	}
+
+	static const int densities[] = {1, 8, 64};
+	static const int scales[] = {12, 31, 72};
+	for (int d = 0; d < 3; d++) {
+		for (int s = 0; s < 3; s++)
+			run(&player, quarters, frames, densities[d], scales[s]);
+	}
+	print(format);
+	return 0;
+}
@@ -0,0 +1,150 @@
+/* MIDI traffic of microtonal playback: libvomid's own output against the
+ * PlaybackPlan replay, bent and tuned by MTS, and the time to render the
+ * plans.
+ *
+ * A track in an equal temperament of each size is filled with chords of
+ * the given number of voices; 12 is the plain MIDI baseline.
+ *
+ * usage: plan_bench [-q quarters] [-f text|csv|json]
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vomid.h>
+#include "playback_plan.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static unsigned rnd_state = 1;
+
+static unsigned
+rnd(unsigned n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+struct Result
+{
+	int scale, voices;
+	PlaybackPlan::Counts raw, planned, mts;
+	double build_ms, mts_ms;
+};
+
+static std::vector<Result> results;
+
+static void
+count_event(unsigned char *ev, size_t size, void *counts)
+{
+	PlaybackPlan::count(static_cast<PlaybackPlan::Counts *>(counts), ev, size);
+}
+
+static vmd_status_t
+count_delay(vmd_time_t, int, void *)
+{
+	return VMD_OK;
+}
+
+static void
+run(int quarters, int scale, int voices)
+{
+	vmd_file_t file;
+	vmd_file_init(&file);
+	vmd_track_t *track = file.track[file.tracks++] = vmd_track_create(&file, VMD_CHANMASK_NODRUMS);
+	if (scale != 12)
+		vmd_track_set_notesystem(track, vmd_notesystem_tet(scale));
+
+	/* five octaves from the middle of the notesystem */
+	vmd_pitch_t low = track->notesystem.end_pitch / 2 - scale * 2;
+	vmd_time_t step = file.division / 2;
+	for (vmd_time_t t = 0; t < vmd_time_t(quarters) * file.division; t += step) {
+		for (int v = 0; v < voices; v++)
+			vmd_track_insert(track, t, t + step + rnd(file.division * 2), low + rnd(scale * 5));
+	}
+
+	Result r;
+	r.scale = scale;
+	r.voices = voices;
+	memset(&r.raw, 0, sizeof(r.raw));
+	memset(&r.planned, 0, sizeof(r.planned));
+	memset(&r.mts, 0, sizeof(r.mts));
+	vmd_file_play(&file, 0, count_event, count_delay, &r.raw, NULL);
+
+	Clock::time_point t = Clock::now();
+	PlaybackPlan plan(&file);
+	r.build_ms = std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+	plan.play(0, count_event, count_delay, &r.planned);
+
+	t = Clock::now();
+	PlaybackPlan mts(&file, PlaybackPlan::MTS);
+	r.mts_ms = std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+	mts.play(0, count_event, count_delay, &r.mts);
+	results.push_back(r);
+
+	vmd_file_fini(&file);
+}
+
+static void
+print(const char *format)
+{
+	bool csv = strcmp(format, "csv") == 0;
+	bool json = strcmp(format, "json") == 0;
+
+	if (csv)
+		printf("scale,voices,notes,raw_bends,plan_bends,raw_bytes,plan_bytes,build_ms,"
+			"mts_bends,mts_sysex,mts_bytes,mts_ms\n");
+	else if (json)
+		printf("[\n");
+	else
+		printf("%5s %6s %8s %10s %10s %10s %10s %9s %9s %9s %10s %8s\n",
+			"scale", "voices", "notes", "raw bends", "plan bends", "raw bytes", "plan bytes", "build ms",
+			"mts bends", "mts sysex", "mts bytes", "mts ms");
+
+	for (size_t i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		if (csv) {
+			printf("%d,%d,%zu,%zu,%zu,%zu,%zu,%.2f,%zu,%zu,%zu,%.2f\n", r.scale, r.voices, r.raw.notes,
+				r.raw.bends, r.planned.bends, r.raw.bytes, r.planned.bytes, r.build_ms,
+				r.mts.bends, r.mts.sysex, r.mts.bytes, r.mts_ms);
+		} else if (json) {
+			printf("  {\"scale\": %d, \"voices\": %d, \"notes\": %zu, \"raw_bends\": %zu, \"plan_bends\": %zu, "
+				"\"raw_bytes\": %zu, \"plan_bytes\": %zu, \"build_ms\": %.2f, "
+				"\"mts_bends\": %zu, \"mts_sysex\": %zu, \"mts_bytes\": %zu, \"mts_ms\": %.2f}%s\n",
+				r.scale, r.voices, r.raw.notes, r.raw.bends, r.planned.bends,
+				r.raw.bytes, r.planned.bytes, r.build_ms,
+				r.mts.bends, r.mts.sysex, r.mts.bytes, r.mts_ms, i + 1 < results.size() ? "," : "");
+		} else {
+			printf("%5d %6d %8zu %10zu %10zu %10zu %10zu %9.2f %9zu %9zu %10zu %8.2f%s\n", r.scale, r.voices,
+				r.raw.notes, r.raw.bends, r.planned.bends, r.raw.bytes, r.planned.bytes, r.build_ms,
+				r.mts.bends, r.mts.sysex, r.mts.bytes, r.mts_ms,
+				r.raw.notes == r.planned.notes && r.raw.notes == r.mts.notes ? "" : "  MISMATCH");
+		}
+	}
+	if (json)
+		printf("]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int quarters = 2000;
+	const char *format = "text";
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+			quarters = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+			format = argv[++i];
+	}
+
+	static const int scales[] = {12, 19, 31, 72};
+	static const int voices[] = {1, 4, 8};
+	for (int s = 0; s < 4; s++) {
+		for (int v = 0; v < 3; v++)
+			run(quarters, scales[s], voices[v]);
+	}
+	print(format);
+	return 0;
+}
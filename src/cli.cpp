@@ -0,0 +1,366 @@
+/* vomid-cli: batch processing of whole libraries without the GUI.
+ *
+ * usage: vomid-cli [-j threads] [-m memory_mb] [-o dir] [-t bend|mts] command files...
+ *
+ * commands:
+ *   convert mid|vomid   re-export in the given format
+ *   validate            import and check vmd_file_is_compatible()
+ *   analyse             print note statistics
+ *   transpose N         move all notes by N pitch steps and export
+ *   bounce              render playback to a flat type 0 MIDI file, with
+ *                       microtonal notes bent or, with -t mts, on keys
+ *                       retuned by the MIDI Tuning Standard
+ */
+#include <QAtomicInt>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vomid.h>
+#include "native.h"
+#include "playback_plan.h"
+#include "smf.h"
+
+enum Command {
+	CONVERT,
+	VALIDATE,
+	ANALYSE,
+	TRANSPOSE,
+	BOUNCE
+};
+
+struct Options
+{
+	Command command;
+	bool native;
+	int transpose;
+	PlaybackPlan::Mode tuning;
+	QString out_dir;
+};
+
+struct Job
+{
+	QString path;
+	qint64 size;
+	/* results */
+	bool ok;
+	QString message;
+	double sec;
+	size_t notes;
+};
+
+static bool
+bigger(const Job *a, const Job *b)
+{
+	return a->size > b->size;
+}
+
+/* imports the way File does: native, then mapped SMF, then libvomid */
+static vmd_status_t
+import(vmd_file_t *file, const QString &path)
+{
+	{
+		NativeMap map(path);
+		if (map.native()) {
+			vmd_file_init(file);
+			vmd_status_t ret = native_import(file, map);
+			if (ret != VMD_OK)
+				vmd_file_fini(file);
+			return ret;
+		}
+	}
+	{
+		SmfMap smf(path);
+		vmd_file_init(file);
+		/* the pool is already busy with other files */
+		if (smf_import(file, smf, NULL, 1) == VMD_OK)
+			return VMD_OK;
+		vmd_file_fini(file);
+	}
+	vmd_bool_t native;
+	return vmd_file_import(file, path.toLocal8Bit().data(), &native);
+}
+
+static size_t
+count_notes(vmd_file_t *file)
+{
+	size_t ret = 0;
+	for (int i = 0; i < file->tracks; i++)
+		ret += vmd_bst_size(&file->track[i]->notes);
+	return ret;
+}
+
+static QString
+out_path(const Options &opt, const QString &path, const char *suffix)
+{
+	QFileInfo fi(path);
+	QString dir = opt.out_dir.isEmpty() ? fi.path() : opt.out_dir;
+	return QDir(dir).filePath(fi.completeBaseName() + suffix);
+}
+
+static bool
+export_file(vmd_file_t *file, const QString &path, bool native)
+{
+	QByteArray p = path.toLocal8Bit();
+	return (native ? native_export(file, p.data()) : vmd_file_export(file, p.data())) == VMD_OK;
+}
+
+static void
+analyse(vmd_file_t *file, Job *job)
+{
+	vmd_pitch_t lo = VMD_MAX_PITCH, hi = -1;
+	vmd_time_t end = 0;
+	for (int i = 0; i < file->tracks; i++) {
+		VMD_BST_FOREACH(vmd_bst_node_t *n, &file->track[i]->notes) {
+			vmd_note_t *note = vmd_track_note(n);
+			lo = std::min(lo, note->pitch);
+			hi = std::max(hi, note->pitch);
+			end = std::max(end, note->off_time);
+		}
+	}
+	job->message = QString("%1 tracks, %2 notes, %3 quarters")
+		.arg(file->tracks)
+		.arg(qint64(job->notes))
+		.arg(file->division > 0 ? double(end) / file->division : 0.0, 0, 'f', 1);
+	if (hi >= 0)
+		job->message += QString(", pitch %1..%2").arg(qint64(lo)).arg(qint64(hi));
+	job->message += vmd_file_is_compatible(file) ? ", compatible" : ", not compatible";
+}
+
+static void
+transpose(vmd_file_t *file, int dp)
+{
+	for (int i = 0; i < file->tracks; i++) {
+		vmd_track_t *track = file->track[i];
+		std::vector<vmd_note_t *> notes;
+		notes.reserve(vmd_bst_size(&track->notes));
+		VMD_BST_FOREACH(vmd_bst_node_t *n, &track->notes)
+			notes.push_back(vmd_track_note(n));
+		for (size_t j = 0; j < notes.size(); j++) {
+			vmd_copy_note(notes[j], track, 0, dp);
+			vmd_erase_note(notes[j]);
+		}
+	}
+}
+
+static bool
+bounce(vmd_file_t *file, PlaybackPlan::Mode tuning, const QString &path)
+{
+	/* as the GUI plays it, with microtonal channels replanned */
+	return PlaybackPlan(file, tuning).export_smf(path.toLocal8Bit().data()) == VMD_OK;
+}
+
+static void
+process(const Options &opt, Job *job)
+{
+	vmd_file_t file;
+	if (import(&file, job->path) != VMD_OK) {
+		job->ok = false;
+		job->message = "cannot import";
+		return;
+	}
+	job->notes = count_notes(&file);
+	job->ok = true;
+
+	switch (opt.command) {
+	case CONVERT: {
+		QString out = out_path(opt, job->path, opt.native ? NATIVE_SUFFIX : ".mid");
+		if (QFileInfo(out).absoluteFilePath() == QFileInfo(job->path).absoluteFilePath())
+			job->message = "already in that format";
+		else if (!(job->ok = export_file(&file, out, opt.native)))
+			job->message = "cannot write " + out;
+		else
+			job->message = out;
+		break;
+	}
+	case VALIDATE:
+		job->ok = vmd_file_is_compatible(&file);
+		job->message = job->ok ? "ok" : "not compatible";
+		break;
+	case ANALYSE:
+		analyse(&file, job);
+		break;
+	case TRANSPOSE: {
+		QString out = out_path(opt, job->path, QString(".t%1.mid").arg(opt.transpose).toLocal8Bit().data());
+		transpose(&file, opt.transpose);
+		if (!(job->ok = export_file(&file, out, false)))
+			job->message = "cannot write " + out;
+		else
+			job->message = out;
+		break;
+	}
+	case BOUNCE: {
+		QString out = out_path(opt, job->path, ".bounce.mid");
+		if (!(job->ok = bounce(&file, opt.tuning, out)))
+			job->message = "cannot write " + out;
+		else
+			job->message = out;
+		break;
+	}
+	}
+	vmd_file_fini(&file);
+}
+
+/* Workers take the next file off a shared list, biggest first, so a
+ * worker that drew small files keeps taking more while another is busy
+ * with a big one. Memory is bounded by reserving an estimate of each
+ * file's footprint from a budget before importing it.
+ */
+class Worker : public QRunnable
+{
+public:
+	Worker(const Options &opt, const std::vector<Job *> &jobs, QAtomicInt *next,
+	       QSemaphore *budget, int budget_mb, QMutex *out)
+		:opt_(opt), jobs_(jobs), next_(next), budget_(budget), budget_mb_(budget_mb), out_(out)
+	{
+	}
+
+	void run();
+
+private:
+	const Options &opt_;
+	const std::vector<Job *> &jobs_;
+	QAtomicInt *next_;
+	QSemaphore *budget_;
+	int budget_mb_;
+	QMutex *out_;
+};
+
+/* imported notes take several times the space of their events */
+const int footprint_factor = 16;
+
+void
+Worker::run()
+{
+	int i;
+	while ((i = next_->fetchAndAddRelaxed(1)) < int(jobs_.size())) {
+		Job *job = jobs_[i];
+		int mb = int(std::min(qint64(budget_mb_), job->size * footprint_factor / (1 << 20) + 1));
+		budget_->acquire(mb);
+		QElapsedTimer t;
+		t.start();
+		process(opt_, job);
+		job->sec = t.nsecsElapsed() / 1e9;
+		budget_->release(mb);
+
+		out_->lock();
+		printf("%-6s %9.1f ms  %s: %s\n", job->ok ? "ok" : "FAIL", job->sec * 1000,
+		       job->path.toLocal8Bit().data(), job->message.toLocal8Bit().data());
+		fflush(stdout);
+		out_->unlock();
+	}
+}
+
+static int
+usage()
+{
+	fprintf(stderr,
+		"usage: vomid-cli [-j threads] [-m memory_mb] [-o dir] [-t bend|mts] command files...\n"
+		"commands: convert mid|vomid, validate, analyse, transpose N, bounce\n");
+	return 2;
+}
+
+int
+main(int argc, char **argv)
+{
+	int threads = QThread::idealThreadCount();
+	int memory_mb = 1024;
+	Options opt;
+	opt.native = false;
+	opt.transpose = 0;
+	opt.tuning = PlaybackPlan::BEND;
+
+	int i = 1;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (i + 1 >= argc)
+			return usage();
+		if (strcmp(argv[i], "-j") == 0)
+			threads = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-m") == 0)
+			memory_mb = std::max(1, atoi(argv[++i]));
+		else if (strcmp(argv[i], "-o") == 0)
+			opt.out_dir = QString::fromLocal8Bit(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0) {
+			const char *tuning = argv[++i];
+			if (strcmp(tuning, "mts") == 0)
+				opt.tuning = PlaybackPlan::MTS;
+			else if (strcmp(tuning, "bend") != 0)
+				return usage();
+		} else
+			return usage();
+	}
+	if (i >= argc)
+		return usage();
+
+	const char *cmd = argv[i++];
+	if (strcmp(cmd, "convert") == 0 && i < argc) {
+		opt.command = CONVERT;
+		if (strcmp(argv[i], "vomid") == 0)
+			opt.native = true;
+		else if (strcmp(argv[i], "mid") != 0)
+			return usage();
+		i++;
+	} else if (strcmp(cmd, "validate") == 0)
+		opt.command = VALIDATE;
+	else if (strcmp(cmd, "analyse") == 0)
+		opt.command = ANALYSE;
+	else if (strcmp(cmd, "transpose") == 0 && i < argc) {
+		opt.command = TRANSPOSE;
+		opt.transpose = atoi(argv[i++]);
+	} else if (strcmp(cmd, "bounce") == 0)
+		opt.command = BOUNCE;
+	else
+		return usage();
+	if (i >= argc)
+		return usage();
+
+	std::vector<Job> jobs(argc - i);
+	std::vector<Job *> order;
+	qint64 total_size = 0;
+	for (size_t j = 0; j < jobs.size(); j++) {
+		Job &job = jobs[j];
+		job.path = QString::fromLocal8Bit(argv[i + j]);
+		job.size = QFileInfo(job.path).size();
+		job.ok = false;
+		job.sec = 0;
+		job.notes = 0;
+		total_size += job.size;
+		order.push_back(&job);
+	}
+	std::stable_sort(order.begin(), order.end(), bigger);
+
+	QElapsedTimer wall;
+	wall.start();
+	QAtomicInt next(0);
+	QSemaphore budget(memory_mb);
+	QMutex out;
+	QThreadPool pool;
+	threads = std::min(threads, int(jobs.size()));
+	pool.setMaxThreadCount(threads);
+	for (int t = 0; t < threads; t++)
+		pool.start(new Worker(opt, order, &next, &budget, memory_mb, &out));
+	pool.waitForDone();
+	double wall_sec = wall.nsecsElapsed() / 1e9;
+
+	size_t ok = 0, notes = 0;
+	double cpu_sec = 0;
+	for (size_t j = 0; j < jobs.size(); j++) {
+		ok += jobs[j].ok;
+		notes += jobs[j].notes;
+		cpu_sec += jobs[j].sec;
+	}
+	printf("%zu files, %zu ok, %zu failed, %.2f MB, %zu notes\n",
+	       jobs.size(), ok, jobs.size() - ok, total_size / 1e6, notes);
+	printf("%.1f ms wall, %.1f ms in files, %d threads, %.1f MB/s, %.2f Mnotes/s\n",
+	       wall_sec * 1000, cpu_sec * 1000, threads, total_size / 1e6 / wall_sec, notes / 1e6 / wall_sec);
+	return ok == jobs.size() ? 0 : 1;
+}
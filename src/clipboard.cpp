@@ -0,0 +1,281 @@
+#include <QApplication>
+#include <QClipboard>
+#include <QDataStream>
+#include <QMimeData>
+#include <QRunnable>
+#include <QThreadPool>
+#include <algorithm>
+#include <vector>
+#include "clipboard.h"
+#include "file.h"
+#include "note_index.h"
+#include "selection.h"
+
+const char *Clipboard::mime_type = "application/x-vomid-notes";
+
+/* What a copy took, and once gathered, the notes. The gatherer only
+ * reads the snapshot and the keys; the notes are read on the GUI thread
+ * only when done is set.
+ */
+struct Clip
+{
+	QSharedPointer<const NoteIndex> index;
+	Clipboard::Range range;
+	/* of a selection, in its order; if empty, the whole range */
+	std::vector<Selection::Key> keys;
+	vmd_time_t base_time;
+	vmd_pitch_t base_pitch;
+	bool time_relative, pitch_relative;
+
+	std::vector<NoteData> notes;
+	QByteArray data;
+	bool done;
+};
+
+static bool
+on_time_less(const NoteData &a, const NoteData &b)
+{
+	return a.on_time < b.on_time;
+}
+
+static bool
+key_less(const Selection::Key &a, const Selection::Key &b)
+{
+	if (a.pitch != b.pitch)
+		return a.pitch < b.pitch;
+	if (a.on_time != b.on_time)
+		return a.on_time < b.on_time;
+	return a.off_time < b.off_time;
+}
+
+/* the notes of the clip, sorted by on_time and relative to its base;
+ * a selection is looked for only in its span
+ */
+static void
+gather(const Clip &clip, std::vector<NoteData> *notes)
+{
+	Clipboard::Range r = clip.range;
+	std::vector<Selection::Key> keys(clip.keys);
+	if (!keys.empty()) {
+		std::sort(keys.begin(), keys.end(), key_less);
+		r.time_beg = VMD_MAX_TIME;
+		r.time_end = 0;
+		r.pitch_beg = keys.front().pitch;
+		r.pitch_end = keys.back().pitch + 1;
+		for (size_t i = 0; i < keys.size(); i++) {
+			r.time_beg = std::min(r.time_beg, keys[i].on_time);
+			r.time_end = std::max(r.time_end, std::max(keys[i].off_time, keys[i].on_time + 1));
+		}
+	}
+
+	std::vector<NoteIndex::Run> runs;
+	clip.index->runs(r.time_beg, r.time_end, r.pitch_beg, r.pitch_end, runs);
+	for (size_t i = 0; i < runs.size(); i++) {
+		const NoteIndex::Run &run = runs[i];
+		for (size_t j = 0; j < run.size; j++) {
+			Selection::Key k = {run.on_time[j], run.off_time[j], run.pitch};
+			if (!keys.empty() && !std::binary_search(keys.begin(), keys.end(), k, key_less))
+				continue;
+			NoteData n = {
+				run.on_time[j] - clip.base_time,
+				run.off_time[j] - clip.base_time,
+				run.pitch - clip.base_pitch,
+				run.velocity[j],
+				run.off_velocity[j],
+				run.channel[j]
+			};
+			notes->push_back(n);
+		}
+	}
+	std::stable_sort(notes->begin(), notes->end(), on_time_less);
+}
+
+/* the system clipboard's format */
+enum {
+	TIME_RELATIVE = 1,
+	PITCH_RELATIVE = 2
+};
+
+static void
+encode(const Clip &clip, QByteArray *data)
+{
+	QDataStream out(data, QIODevice::WriteOnly);
+	out << quint8((clip.time_relative ? TIME_RELATIVE : 0) | (clip.pitch_relative ? PITCH_RELATIVE : 0));
+	out << quint32(clip.notes.size());
+	for (size_t i = 0; i < clip.notes.size(); i++) {
+		const NoteData &n = clip.notes[i];
+		out << qint64(n.on_time) << qint64(n.off_time) << qint32(n.pitch)
+		    << qint32(n.on_vel) << qint32(n.off_vel) << qint32(n.channel);
+	}
+}
+
+static bool
+decode(const QByteArray &data, Clip *clip)
+{
+	QDataStream in(data);
+	quint8 flags;
+	quint32 size;
+	in >> flags >> size;
+	if (in.status() != QDataStream::Ok)
+		return false;
+	clip->time_relative = flags & TIME_RELATIVE;
+	clip->pitch_relative = flags & PITCH_RELATIVE;
+	for (quint32 i = 0; i < size; i++) {
+		qint64 on_time, off_time;
+		qint32 pitch, on_vel, off_vel, channel;
+		in >> on_time >> off_time >> pitch >> on_vel >> off_vel >> channel;
+		if (in.status() != QDataStream::Ok)
+			return false;
+		NoteData n = {vmd_time_t(on_time), vmd_time_t(off_time), vmd_pitch_t(pitch), on_vel, off_vel, channel};
+		clip->notes.push_back(n);
+	}
+	return true;
+}
+
+class ClipGatherer : public QRunnable
+{
+public:
+	ClipGatherer(QObject *_target, uint _generation, QSharedPointer<Clip> _clip)
+		:target(_target), generation(_generation), clip(_clip) { }
+
+	void run()
+	{
+		gather(*clip, &clip->notes);
+		encode(*clip, &clip->data);
+		QMetaObject::invokeMethod(target, "gathered", Qt::QueuedConnection, Q_ARG(uint, generation));
+	}
+
+private:
+	QObject *target;
+	uint generation;
+	QSharedPointer<Clip> clip;
+};
+
+Clipboard *
+Clipboard::instance()
+{
+	static Clipboard *clipboard = NULL;
+	if (clipboard == NULL)
+		clipboard = new Clipboard();
+	return clipboard;
+}
+
+Clipboard::Clipboard()
+	:generation_(0)
+{
+	connect(QApplication::clipboard(), SIGNAL(dataChanged()), this, SLOT(system_changed()));
+	system_changed();
+}
+
+bool
+Clipboard::empty() const
+{
+	return clip_.isNull() || (clip_->done && clip_->notes.empty());
+}
+
+bool
+Clipboard::timeRelative() const
+{
+	return !clip_.isNull() && clip_->time_relative;
+}
+
+bool
+Clipboard::pitchRelative() const
+{
+	return !clip_.isNull() && clip_->pitch_relative;
+}
+
+size_t
+Clipboard::memory() const
+{
+	if (clip_.isNull() || !clip_->done)
+		return 0;
+	return clip_->notes.capacity() * sizeof(NoteData);
+}
+
+void
+Clipboard::start(QSharedPointer<Clip> clip)
+{
+	clip->done = false;
+	clip_ = clip;
+	generation_++;
+	QThreadPool::globalInstance()->start(new ClipGatherer(this, generation_, clip));
+}
+
+void
+Clipboard::copy(File *file, vmd_track_t *track, const Range &range, bool time_relative, bool pitch_relative)
+{
+	file->require(range.time_beg, range.time_end);
+	QSharedPointer<Clip> clip(new Clip);
+	clip->index = file->shared_index(track);
+	clip->range = range;
+	clip->base_time = range.time_beg;
+	clip->base_pitch = range.pitch_beg;
+	clip->time_relative = time_relative;
+	clip->pitch_relative = pitch_relative;
+	start(clip);
+}
+
+void
+Clipboard::copy(const Selection &sel, vmd_time_t base_time, vmd_pitch_t base_pitch)
+{
+	Selection::Snapshot snapshot = sel.snapshot();
+	if (snapshot.keys.empty()) {
+		clip_.clear();
+		generation_++;
+		return;
+	}
+	QSharedPointer<Clip> clip(new Clip);
+	clip->index = snapshot.index;
+	clip->keys.swap(snapshot.keys);
+	clip->base_time = base_time;
+	clip->base_pitch = base_pitch;
+	clip->time_relative = true;
+	clip->pitch_relative = true;
+	start(clip);
+}
+
+int
+Clipboard::paste(File *file, vmd_track_t *track, vmd_time_t time, vmd_pitch_t pitch)
+{
+	if (clip_.isNull())
+		return 0;
+	if (clip_->done)
+		return file->insert_notes(track, clip_->notes, time, pitch);
+
+	/* still being gathered; the snapshot can be read alongside */
+	std::vector<NoteData> notes;
+	gather(*clip_, &notes);
+	return file->insert_notes(track, notes, time, pitch);
+}
+
+void
+Clipboard::gathered(uint generation)
+{
+	if (generation != generation_)
+		return;
+	clip_->done = true;
+	clip_->index.clear();
+	clip_->keys = std::vector<Selection::Key>();
+
+	QMimeData *mime = new QMimeData();
+	mime->setData(mime_type, clip_->data);
+	clip_->data = QByteArray();
+	QApplication::clipboard()->setMimeData(mime);
+}
+
+void
+Clipboard::system_changed()
+{
+	/* notes copied by another window or session */
+	QClipboard *system = QApplication::clipboard();
+	const QMimeData *mime = system->mimeData();
+	if (system->ownsClipboard() || mime == NULL || !mime->hasFormat(mime_type))
+		return;
+	QSharedPointer<Clip> clip(new Clip);
+	if (!decode(mime->data(mime_type), clip.data()))
+		return;
+	clip->done = true;
+	clip_ = clip;
+	generation_++;
+}
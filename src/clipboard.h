@@ -0,0 +1,65 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef CLIPBOARD_H
+#define CLIPBOARD_H
+
+#include <QObject>
+#include <QSharedPointer>
+#include <vector>
+#include <vomid.h>
+
+class File;
+class Selection;
+struct Clip;
+struct NoteData;
+
+/* Copy-on-write note clipboard.
+ *
+ * Copying takes the source track's index as a shared snapshot, which
+ * the file has built for painting anyway, and hands it to the thread
+ * pool; there the notes of the range, or of the selection's span, are
+ * gathered, sorted and encoded for the system clipboard. So copying
+ * costs the same for one note and for a whole orchestra, and the source
+ * file is left alone. The snapshot is let go once the notes are
+ * gathered. Pasting inserts them in one batch. Notes another window or
+ * session put on the system clipboard replace ours.
+ */
+class Clipboard : public QObject
+{
+	Q_OBJECT
+
+public:
+	struct Range
+	{
+		vmd_time_t time_beg, time_end;
+		vmd_pitch_t pitch_beg, pitch_end;
+	};
+
+	static Clipboard *instance();
+	static const char *mime_type;
+
+	bool empty() const;
+	/* bytes taken by gathered notes */
+	size_t memory() const;
+	bool timeRelative() const;
+	bool pitchRelative() const;
+
+	void copy(File *, vmd_track_t *, const Range &, bool time_relative, bool pitch_relative);
+	void copy(const Selection &, vmd_time_t base_time, vmd_pitch_t base_pitch);
+	int paste(File *, vmd_track_t *, vmd_time_t, vmd_pitch_t);
+
+private slots:
+	void gathered(uint);
+	void system_changed();
+
+private:
+	Clipboard();
+	void start(QSharedPointer<Clip>);
+
+	QSharedPointer<Clip> clip_;
+	uint generation_;
+};
+
+#endif /* CLIPBOARD_H */
@@ -0,0 +1,88 @@
+#include <QDeadlineTimer>
+#include <QWaitCondition>
+#include <vomid.h>
+#include "clock.h"
+
+class SystemClock : public Clock
+{
+public:
+	double now() const { return vmd_systime(); }
+
+	void wait_until(QWaitCondition *cond, QMutex *mutex, double time)
+	{
+		/* to the nanosecond: a wait rounded down to 0 ms would spin */
+		qint64 nsec = qint64((time - vmd_systime()) * 1e9);
+		if (nsec <= 0)
+			return;
+		QDeadlineTimer deadline(Qt::PreciseTimer);
+		deadline.setPreciseRemainingTime(0, nsec, Qt::PreciseTimer);
+		cond->wait(mutex, deadline);
+	}
+};
+
+Clock *
+Clock::system()
+{
+	static SystemClock clock;
+	return &clock;
+}
+
+VirtualClock::VirtualClock(bool _stepped, double _start)
+	:stepped_(_stepped),
+	now_(_start),
+	cond_(NULL),
+	cond_mutex_(NULL)
+{
+}
+
+double
+VirtualClock::now() const
+{
+	QMutexLocker lock(&mutex_);
+	return now_;
+}
+
+void
+VirtualClock::wait_until(QWaitCondition *cond, QMutex *mutex, double time)
+{
+	{
+		QMutexLocker lock(&mutex_);
+		if (now_ >= time)
+			return;
+		if (!stepped_) {
+			now_ = time;
+			return;
+		}
+		cond_ = cond;
+		cond_mutex_ = mutex;
+	}
+	/* advance() takes mutex before waking us, so it can't slip in between */
+	cond->wait(mutex);
+	QMutexLocker lock(&mutex_);
+	cond_ = NULL;
+	cond_mutex_ = NULL;
+}
+
+void
+VirtualClock::advance(double seconds)
+{
+	set(now() + seconds);
+}
+
+void
+VirtualClock::set(double time)
+{
+	QWaitCondition *cond;
+	QMutex *cond_mutex;
+	{
+		QMutexLocker lock(&mutex_);
+		now_ = time;
+		cond = cond_;
+		cond_mutex = cond_mutex_;
+	}
+	if (cond != NULL) {
+		cond_mutex->lock();
+		cond->wakeAll();
+		cond_mutex->unlock();
+	}
+}
@@ -0,0 +1,57 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <QMutex>
+
+class QWaitCondition;
+
+/* Time source of the player, in seconds like vmd_systime().
+ *
+ * wait_until() is called with mutex locked and returns when the deadline
+ * has passed or cond was woken, whichever is first; it may also return
+ * early, so callers loop.
+ */
+class Clock
+{
+public:
+	virtual ~Clock() { }
+
+	virtual double now() const = 0;
+	virtual void wait_until(QWaitCondition *cond, QMutex *mutex, double time) = 0;
+
+	/* the wall clock; shared, never deleted */
+	static Clock *system();
+};
+
+/* Simulated time, for running playback faster than real time.
+ *
+ * A free-running clock jumps to every deadline it is waited for, so
+ * playback runs as fast as the events can be produced. A stepped clock
+ * only moves with advance(), so a test can interleave playback with
+ * checks of the player and the views. One thread at a time may wait.
+ */
+class VirtualClock : public Clock
+{
+public:
+	explicit VirtualClock(bool stepped = false, double start = 0);
+
+	double now() const;
+	void wait_until(QWaitCondition *, QMutex *, double);
+
+	void advance(double seconds);
+	void set(double time);
+
+private:
+	mutable QMutex mutex_;
+	bool stepped_;
+	double now_;
+	/* of the waiting thread */
+	QWaitCondition *cond_;
+	QMutex *cond_mutex_;
+};
+
+#endif /* CLOCK_H */
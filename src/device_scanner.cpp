@@ -0,0 +1,83 @@
+#include <vomid.h>
+#include "device_scanner.h"
+#include "player.h"
+#include "trace.h"
+
+/* how often devices are listed again */
+const int rescan_msec = 5000;
+
+struct Devices
+{
+	QStringList ids, names;
+};
+
+static void
+enum_clb(const char *id, const char *name, void *_devices)
+{
+	Devices *devices = static_cast<Devices *>(_devices);
+	devices->ids << QString(id);
+	devices->names << QString::fromLocal8Bit(name);
+}
+
+DeviceScanner::DeviceScanner(Player *_player, QObject *parent)
+	:QThread(parent),
+	player_(_player),
+	stopping_(false),
+	rescan_(false)
+{
+	setObjectName("DeviceScanner");
+}
+
+DeviceScanner::~DeviceScanner()
+{
+	stop();
+}
+
+void
+DeviceScanner::rescan()
+{
+	QMutexLocker lock(&mutex_);
+	rescan_ = true;
+	cond_.wakeAll();
+}
+
+void
+DeviceScanner::stop()
+{
+	mutex_.lock();
+	stopping_ = true;
+	cond_.wakeAll();
+	mutex_.unlock();
+	wait();
+}
+
+void
+DeviceScanner::run()
+{
+	Devices listed;
+
+	QMutexLocker lock(&mutex_);
+	while (!stopping_) {
+		rescan_ = false;
+		lock.unlock();
+
+		Devices devices;
+		{
+			TRACE_SPAN("DeviceScanner::enum");
+			vmd_enum_devices(VMD_OUTPUT_DEVICE, enum_clb, &devices);
+		}
+		if (devices.ids != listed.ids || devices.names != listed.names) {
+			listed = devices;
+			emit changed(listed.ids, listed.names);
+		}
+
+		if (!listed.ids.isEmpty() && !listed.ids.contains(player_->output_device())) {
+			QMetaObject::invokeMethod(player_, "fall_back_on", Qt::QueuedConnection,
+			                          Q_ARG(QStringList, listed.ids));
+		}
+
+		lock.relock();
+		if (!stopping_ && !rescan_)
+			cond_.wait(&mutex_, rescan_msec);
+	}
+}
@@ -0,0 +1,49 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef DEVICE_SCANNER_H
+#define DEVICE_SCANNER_H
+
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+class Player;
+
+/* Keeps the list of output devices current, off the GUI thread.
+ *
+ * Drivers can take long to enumerate, so that is done on the worker
+ * thread. Devices are listed on start() and every few seconds after, to
+ * pick up ones plugged in or removed, and changed() is emitted whenever
+ * the list differs. While the player has no device, or its device went
+ * away, it is handed the list with a queued call to fall back on, so
+ * devices are opened on the GUI thread like those chosen from the menu.
+ */
+class DeviceScanner : public QThread
+{
+	Q_OBJECT
+
+public:
+	DeviceScanner(Player *, QObject *parent = NULL);
+	~DeviceScanner();
+
+public slots:
+	void rescan();
+	void stop();
+
+signals:
+	void changed(QStringList ids, QStringList names);
+
+protected:
+	void run();
+
+private:
+	Player *player_;
+	QMutex mutex_;
+	QWaitCondition cond_;
+	bool stopping_, rescan_;
+};
+
+#endif /* DEVICE_SCANNER_H */
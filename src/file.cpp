@@ -1,48 +1,299 @@
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QList>
+#include <QMetaObject>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QWaitCondition>
 #include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
 #include "file.h"
+#include "file_saver.h"
+#include "file_snapshot.h"
+#include "journal.h"
+#include "native.h"
+#include "note_index.h"
+#include "pager.h"
+#include "playback_plan.h"
+#include "smf.h"
+#include "trace.h"
+
+/* journal records */
+enum {
+	J_COMMIT,
+	J_UPDATE,
+	J_FILENAME,
+	J_SAVED,
+	J_PAGES
+};
+
+/* native files from this size (some 500k notes) on are opened out of
+ * core, so that opening them doesn't insert every note
+ */
+static const qint64 PAGED_SIZE = qint64(8) << 20;
+/* resident notes of such files, while nothing depends on them */
+static const size_t PAGED_BUDGET = 1 << 22;
+
+/* edits inside J_COMMIT */
+enum {
+	J_INSERT,
+	J_ERASE,
+	J_VELOCITY,
+	J_CTRL,
+	J_ADD_TRACK
+};
+
+/* a track's index; replaced once the file has changed, while
+ * snapshots taken through shared_index() keep the old one
+ */
+struct File::CachedIndex
+{
+	QSharedPointer<const NoteIndex> index;
+	unsigned generation;
+};
+
+/* a plan rendering on the pool; file is cleared once the result isn't
+ * wanted anymore
+ */
+struct PlanBuild
+{
+	QMutex mutex;
+	/* woken when done */
+	QWaitCondition cond;
+	File *file;
+	unsigned generation;
+	PlaybackPlan::Mode mode;
+	bool done;
+	QSharedPointer<const PlaybackPlan> plan;
+};
+
+class PlanJob : public QRunnable
+{
+public:
+	PlanJob(QSharedPointer<PlanBuild> _build, FileSnapshot *_snapshot)
+		:build(_build),
+		snapshot(_snapshot)
+	{
+	}
+
+	~PlanJob()
+	{
+		delete snapshot;
+	}
+
+	void run()
+	{
+		TRACE_SPAN("File::plan");
+		QSharedPointer<const PlaybackPlan> plan;
+		vmd_file_t file;
+		vmd_file_init(&file);
+		if (build_snapshot(&file, *snapshot))
+			plan = QSharedPointer<const PlaybackPlan>(new PlaybackPlan(&file, build->mode));
+		vmd_file_fini(&file);
+		delete snapshot;
+		snapshot = NULL;
+
+		QMutexLocker lock(&build->mutex);
+		build->done = true;
+		build->plan = plan;
+		build->cond.wakeAll();
+		if (build->file != NULL)
+			QMetaObject::invokeMethod(build->file, "plan_built", Qt::QueuedConnection);
+	}
+
+private:
+	QSharedPointer<PlanBuild> build;
+	FileSnapshot *snapshot;
+};
+
+static void
+cancel(QSharedPointer<PlanBuild> build)
+{
+	if (build.isNull())
+		return;
+	QMutexLocker lock(&build->mutex);
+	build->file = NULL;
+}
 
 File::File()
 	:filename_(),
 	revision_(NULL),
-	saved_revision_(NULL)
+	saved_revision_(NULL),
+	saving_revision_(NULL),
+	saver_(new FileSaver(this)),
+	bouncer_(NULL),
+	journal_(new Journal(this)),
+	journal_started_(false),
+	generation_(0),
+	loading_(false),
+	plan_generation_(0),
+	pager_(NULL)
 {
+	connect(saver_, SIGNAL(saved(QString, QString)), this, SLOT(save_finished(QString, QString)));
 	vmd_file_init(this);
 	revision_ = new FileRevision(this, "");
+	start_journal(QString());
 }
 
 File::File(QString fn)
 	:filename_(fn),
 	revision_(NULL),
-	saved_revision_(NULL)
+	saved_revision_(NULL),
+	saving_revision_(NULL),
+	saver_(new FileSaver(this)),
+	bouncer_(NULL),
+	journal_(new Journal(this)),
+	journal_started_(false),
+	generation_(0),
+	loading_(false),
+	plan_generation_(0),
+	pager_(NULL)
 {
-	vmd_bool_t native;
-	if (vmd_file_import(this, fn.toLocal8Bit().data(), &native) != VMD_OK)
+	TRACE_SPAN("File::import");
+	FileStats::Timer timer(&stats_, FileStats::IMPORT);
+	connect(saver_, SIGNAL(saved(QString, QString)), this, SLOT(save_finished(QString, QString)));
+	vmd_bool_t native = false;
+	vmd_status_t status;
+	{
+		NativeMap *map = new NativeMap(fn);
+		vmd_file_init(this);
+		if (map->native()) {
+			bool ok;
+			if (map->size() >= size_t(PAGED_SIZE)) {
+				pager_ = new Pager(this, map);
+				ok = pager_->init();
+			} else {
+				ok = native_import(this, *map) == VMD_OK;
+				delete map;
+			}
+			if (!ok) {
+				delete pager_;
+				vmd_file_fini(this);
+				throw std::runtime_error("Damaged file");
+			}
+			status = VMD_OK;
+			native = true;
+		} else {
+			delete map;
+			SmfMap smf(fn);
+			status = smf_import(this, smf);
+		}
+	}
+	if (status != VMD_OK) {
+		/* not plain enough for the mapped reader */
+		vmd_file_fini(this);
+		status = vmd_file_import(this, fn.toLocal8Bit().data(), &native);
+	}
+	if (status != VMD_OK)
 		throw std::runtime_error("Invalid file");
 	revision_ = new FileRevision(this, "");
 	if (native)
 		saved_revision_ = revision_;
+	start_journal(fn);
 }
 
 File::~File()
 {
+	wait_saved();
+	cancel(plan_build_);
+	journal_->discard();
+	drop_caches();
+	qDeleteAll(indices_);
 	while (revision_->prev() != NULL)
 		revision_ = revision_->prev();
 	delete revision_;
 	vmd_file_fini(this);
+	delete pager_;
 }
 
 void
-File::save_as(QString fn)
+File::set_filename(QString fn)
 {
-	vmd_file_export(this, fn.toLocal8Bit().data());
 	filename_ = fn;
-	saved_revision_ = revision_;
+
+	QByteArray rec;
+	QDataStream s(&rec, QIODevice::WriteOnly);
+	s << quint8(J_FILENAME) << fn;
+	journal(rec);
+}
+
+void
+File::save_as(QString fn)
+{
+	wait_saved();
+	if (pager_ != NULL && !fn.endsWith(NATIVE_SUFFIX)) {
+		/* other formats are written from the loaded notes only */
+		require_all();
+		if (!pager_->complete()) {
+			emit saveFailed(fn + ": the file is not fully loaded; redo or edit it first");
+			return;
+		}
+	}
+	saving_revision_ = revision_;
+	if (!saver_->save(fn)) {
+		saving_revision_ = NULL;
+		emit saveFailed(fn + ": cannot start saving");
+	}
+}
+
+void
+File::bounce(QString fn, PlaybackPlan::Mode mode)
+{
+	if (pager_ != NULL) {
+		require_all();
+		if (!pager_->complete()) {
+			emit saveFailed(fn + ": the file is not fully loaded; redo or edit it first");
+			return;
+		}
+	}
+	if (bouncer_ == NULL) {
+		bouncer_ = new FileSaver(this);
+		connect(bouncer_, SIGNAL(saved(QString, QString)), this, SLOT(bounce_finished(QString, QString)));
+	}
+	if (!bouncer_->bounce(fn, mode, plan(mode)))
+		emit saveFailed(fn + ": cannot start exporting");
+}
+
+void
+File::bounce_finished(QString fn, QString error)
+{
+	if (!error.isEmpty())
+		emit saveFailed(fn + ": " + error);
+}
+
+void
+File::wait_saved()
+{
+	if (saving()) {
+		saver_->wait();
+		QCoreApplication::sendPostedEvents(this);
+	}
+}
+
+void
+File::save_finished(QString fn, QString error)
+{
+	if (error.isEmpty()) {
+		filename_ = fn;
+		saved_revision_ = saving_revision_;
+
+		QByteArray rec;
+		QDataStream s(&rec, QIODevice::WriteOnly);
+		s << quint8(J_SAVED) << fn << qint32(revision_index(saved_revision_));
+		journal(rec);
+	} else
+		emit saveFailed(fn + ": " + error);
+	saving_revision_ = NULL;
 	emit acted();
 }
 
 void
 File::commit(QString descr)
 {
+	TRACE_SPAN("File::commit");
+	FileStats::Timer timer(&stats_, FileStats::COMMIT);
 	FileRevision *newrev;
 
 	try {
@@ -53,17 +304,39 @@ File::commit(QString descr)
 		return;
 	}
 
+	newrev->edit_bytes_ = edits_.size();
 	delete revision_->next_;
 	revision_->next_ = newrev;
 	revision_ = newrev;
+
+	QByteArray rec;
+	QDataStream s(&rec, QIODevice::WriteOnly);
+	s << quint8(J_COMMIT) << descr << edits_;
+	journal(rec);
+	edits_.clear();
+
+	drop_caches();
 	emit acted();
 }
 
 void
 File::update(FileRevision *rev)
 {
+	TRACE_SPAN("File::update");
+	FileStats::Timer timer(&stats_, FileStats::UNDO);
 	vmd_file_update(this, rev->rev_);
 	revision_ = rev;
+	edits_.clear();
+	/* pages loaded since the revision was committed are gone again */
+	if (pager_ != NULL)
+		pager_->set_residency(rev->resident_);
+
+	QByteArray rec;
+	QDataStream s(&rec, QIODevice::WriteOnly);
+	s << quint8(J_UPDATE) << qint32(revision_index(rev));
+	journal(rec);
+
+	drop_caches();
 	emit acted();
 }
 
@@ -74,15 +347,608 @@ File::revert()
 }
 
 vmd_track_t *
-File::add_track(vmd_chanmask_t cm)
+File::add_track(vmd_chanmask_t cm, const QString &scale)
 {
-	if (tracks == VMD_MAX_TRACKS - 1)
+	vmd_notesystem_t ns;
+	if (!scale.isEmpty()) {
+		bool tet;
+		int n = scale.toInt(&tet);
+		ns = tet ? vmd_notesystem_tet(n) : vmd_notesystem_import(scale.toLocal8Bit().data());
+		if (ns.pitches == NULL)
+			return NULL;
+	}
+
+	vmd_track_t *ret = append_track(cm, scale.isEmpty() ? NULL : &ns);
+	commit("Add Track");
+	return ret;
+}
+
+vmd_track_t *
+File::add_track(vmd_chanmask_t cm, const vmd_notesystem_t &ns)
+{
+	vmd_notesystem_t copy = ns;
+	copy.pitches = (int *)malloc(ns.size * sizeof(*ns.pitches));
+	memcpy(copy.pitches, ns.pitches, ns.size * sizeof(*ns.pitches));
+
+	vmd_track_t *ret = append_track(cm, &copy);
+	commit("Add Track");
+	return ret;
+}
+
+vmd_track_t *
+File::append_track(vmd_chanmask_t cm, vmd_notesystem_t *ns)
+{
+	if (tracks == VMD_MAX_TRACKS - 1) {
+		if (ns != NULL)
+			free(ns->pitches);
 		throw std::runtime_error("Max number of tracks reached");
+	}
 	vmd_track_t *ret = track[tracks++] = vmd_track_create(this, cm);
-	commit("Add Track");
+	if (ns != NULL)
+		vmd_track_set_notesystem(ret, *ns);
+
+	/* the table rather than the scale, so replay doesn't depend on the
+	 * Scala file
+	 */
+	const vmd_notesystem_t &t = ret->notesystem;
+	QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+	s << quint8(J_ADD_TRACK) << quint32(cm) << qint32(ns ? t.size : 0);
+	if (ns != NULL) {
+		s << qint32(t.end_pitch);
+		for (int i = 0; i < t.size; i++)
+			s << qint32(t.pitches[i]);
+	}
+	return ret;
+}
+
+static void
+put_note(QDataStream &s, quint8 type, vmd_note_t *note)
+{
+	s << type
+	  << qint32(vmd_track_idx(note->track))
+	  << qint32(note->on_time)
+	  << qint32(note->off_time)
+	  << qint32(note->pitch)
+	  << qint32(note->on_vel)
+	  << qint32(note->off_vel)
+	  << qint32(note_data(note).channel);
+}
+
+vmd_note_t *
+File::insert_note(vmd_track_t *track, vmd_time_t on_time, vmd_time_t off_time, vmd_pitch_t pitch)
+{
+	vmd_note_t *ret = vmd_track_insert(track, on_time, off_time, pitch);
+	if (ret != NULL) {
+		QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+		put_note(s, J_INSERT, ret);
+		pin(ret);
+		generation_++;
+	}
+	return ret;
+}
+
+vmd_note_t *
+File::copy_note(vmd_note_t *note, vmd_track_t *track, vmd_time_t dt, vmd_pitch_t dp)
+{
+	vmd_note_t *ret = vmd_copy_note(note, track, dt, dp);
+	if (ret != NULL) {
+		QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+		put_note(s, J_INSERT, ret);
+		pin(ret);
+		generation_++;
+	}
+	return ret;
+}
+
+NoteData
+note_data(const vmd_note_t *note)
+{
+	NoteData ret = {
+		note->on_time, note->off_time, note->pitch, note->on_vel, note->off_vel,
+		note->channel != NULL ? int(note->channel - note->track->file->channel) : -1
+	};
 	return ret;
 }
 
+/* vmd_copy_note() reads only the fields of its source, so a note that is
+ * in no track serves as one; that keeps the channel, which inserting
+ * doesn't set
+ */
+vmd_note_t *
+insert_note_data(vmd_file_t *file, vmd_track_t *track, const NoteData &d, vmd_time_t dt, vmd_pitch_t dp)
+{
+	if (d.channel < 0 || d.channel >= VMD_CHANNELS) {
+		vmd_note_t *ret = vmd_track_insert(track, d.on_time + dt, d.off_time + dt, d.pitch + dp);
+		if (ret != NULL) {
+			ret->on_vel = d.on_vel;
+			ret->off_vel = d.off_vel;
+		}
+		return ret;
+	}
+
+	vmd_note_t proto;
+	memset(&proto, 0, sizeof(proto));
+	proto.track = track;
+	proto.channel = &file->channel[d.channel];
+	proto.on_time = d.on_time;
+	proto.off_time = d.off_time;
+	proto.pitch = d.pitch;
+	proto.on_vel = d.on_vel;
+	proto.off_vel = d.off_vel;
+	return vmd_copy_note(&proto, track, dt, dp);
+}
+
+size_t
+File::insert_notes(vmd_track_t *track, const std::vector<NoteData> &notes, vmd_time_t dt, vmd_pitch_t dp)
+{
+	size_t ret = 0;
+	QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+	for (size_t i = 0; i < notes.size(); i++) {
+		if (vmd_note_t *note = insert_note_data(this, track, notes[i], dt, dp)) {
+			put_note(s, J_INSERT, note);
+			pin(note);
+			ret++;
+		}
+	}
+	if (ret > 0)
+		generation_++;
+	return ret;
+}
+
+void
+File::erase_note(vmd_note_t *note)
+{
+	QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+	put_note(s, J_ERASE, note);
+	pin(note);
+	vmd_erase_note(note);
+	generation_++;
+}
+
+void
+File::set_velocity(vmd_note_t *note, int on_vel, int off_vel)
+{
+	note->on_vel = on_vel;
+	note->off_vel = off_vel;
+	QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+	put_note(s, J_VELOCITY, note);
+	pin(note);
+	generation_++;
+}
+
+void
+File::set_ctrl(vmd_track_t *track, int ctrl, int value)
+{
+	vmd_track_set_ctrl(track, ctrl, value);
+	QDataStream s(&edits_, QIODevice::WriteOnly | QIODevice::Append);
+	s << quint8(J_CTRL) << qint32(vmd_track_idx(track)) << qint32(ctrl) << qint32(value);
+}
+
+void
+File::pin(vmd_note_t *note)
+{
+	if (pager_ != NULL && pager_->pages() > 0 && vmd_track_idx(note->track) < int(pager_->map().header().tracks))
+		pager_->pin(pager_->page_at(note->on_time));
+}
+
+void
+File::touch()
+{
+	drop_caches();
+	emit acted();
+}
+
+void
+File::reset_history()
+{
+	FileRevision *root = revision_;
+	while (root->prev() != NULL)
+		root = root->prev();
+	FileRevision *rev = new FileRevision(this, "");
+	rev->prev_ = NULL;
+	delete root;
+
+	revision_ = rev;
+	saved_revision_ = NULL;
+	edits_.clear();
+	start_journal(filename_);
+	drop_caches();
+	emit acted();
+}
+
+void
+File::begin_load()
+{
+	loading_ = true;
+	/* shown unmodified while it streams in */
+	saved_revision_ = revision_;
+	emit acted();
+}
+
+void
+File::end_load()
+{
+	loading_ = false;
+	reset_history();
+	/* nothing was changed since it was read */
+	saved_revision_ = revision_;
+	emit acted();
+}
+
+File::Usage
+File::usage() const
+{
+	Usage ret = {0, 0, 0, 0, 0};
+	for (int i = 0; i < tracks; i++)
+		ret.notes += vmd_bst_size(&track[i]->notes);
+	ret.note_bytes = ret.notes * sizeof(vmd_note_t);
+
+	FileRevision *rev = revision_;
+	while (rev->prev() != NULL)
+		rev = rev->prev();
+	for (; rev != NULL; rev = rev->next()) {
+		ret.revisions++;
+		ret.edit_bytes += rev->edit_bytes_;
+	}
+
+	for (QHash<vmd_track_t *, CachedIndex *>::const_iterator i = indices_.constBegin(); i != indices_.constEnd(); ++i)
+		ret.cache_bytes += i.value()->index->memory();
+	return ret;
+}
+
+const NoteIndex *
+File::index(vmd_track_t *track)
+{
+	return shared_index(track).data();
+}
+
+QSharedPointer<const NoteIndex>
+File::shared_index(vmd_track_t *track)
+{
+	CachedIndex *&c = indices_[track];
+	if (c == NULL)
+		c = new CachedIndex;
+	if (c->index.isNull() || c->generation != generation_) {
+		c->index = QSharedPointer<const NoteIndex>(new NoteIndex(track));
+		c->generation = generation_;
+	}
+	return c->index;
+}
+
+QSharedPointer<const PlaybackPlan>
+File::plan(PlaybackPlan::Mode mode, int wait_msec)
+{
+	if (pager_ != NULL)
+		return QSharedPointer<const PlaybackPlan>();
+	if (!plan_.isNull() && plan_generation_ == generation_ && plan_->mode() == mode)
+		return plan_;
+	if (plan_build_.isNull() || plan_build_->generation != generation_ || plan_build_->mode != mode) {
+		cancel(plan_build_);
+		plan_build_ = QSharedPointer<PlanBuild>(new PlanBuild);
+		plan_build_->file = this;
+		plan_build_->generation = generation_;
+		plan_build_->mode = mode;
+		plan_build_->done = false;
+		QThreadPool::globalInstance()->start(new PlanJob(plan_build_, take_snapshot(this)));
+	}
+
+	if (wait_msec > 0) {
+		{
+			QMutexLocker lock(&plan_build_->mutex);
+			if (!plan_build_->done)
+				plan_build_->cond.wait(&plan_build_->mutex, wait_msec);
+		}
+		/* takes it now if done; the queued call then finds nothing */
+		plan_built();
+		if (!plan_.isNull() && plan_generation_ == generation_ && plan_->mode() == mode)
+			return plan_;
+	}
+	return QSharedPointer<const PlaybackPlan>();
+}
+
+void
+File::plan_built()
+{
+	if (plan_build_.isNull())
+		return;
+	{
+		QMutexLocker lock(&plan_build_->mutex);
+		/* from a build canceled after it finished */
+		if (!plan_build_->done)
+			return;
+		plan_ = plan_build_->plan;
+		plan_generation_ = plan_build_->generation;
+	}
+	plan_build_.clear();
+}
+
+void
+File::start_journal(const QString &base)
+{
+	journal_->discard();
+	journal_started_ = false;
+	journal_base_ = base;
+	journal_pending_.clear();
+	if (!filename_.isEmpty())
+		set_filename(filename_);
+}
+
+void
+File::journal(const QByteArray &rec)
+{
+	if (!journal_started_) {
+		/* nothing to recover until the first commit or undo */
+		quint8 type = rec.isEmpty() ? 0xff : quint8(rec[0]);
+		if (type != J_COMMIT && type != J_UPDATE) {
+			journal_pending_.append(rec);
+			return;
+		}
+		journal_started_ = true;
+		journal_->open(journal_base_);
+		for (int i = 0; i < journal_pending_.size(); i++)
+			journal_->append(journal_pending_[i]);
+		journal_pending_.clear();
+	}
+	journal_->append(rec);
+}
+
+int
+File::revision_index(FileRevision *rev)
+{
+	FileRevision *i = revision_;
+	while (i->prev() != NULL)
+		i = i->prev();
+	for (int ret = 0; i != NULL; i = i->next(), ret++) {
+		if (i == rev)
+			return ret;
+	}
+	return -1;
+}
+
+FileRevision *
+File::revision_at(int idx)
+{
+	if (idx < 0)
+		return NULL;
+	FileRevision *ret = revision_;
+	while (ret->prev() != NULL)
+		ret = ret->prev();
+	while (ret != NULL && idx-- > 0)
+		ret = ret->next();
+	return ret;
+}
+
+/* same-pitch notes don't overlap, so at most one is sounding at its
+ * on time
+ */
+static vmd_note_t *
+find_note(vmd_track_t *track, vmd_time_t on_time, vmd_time_t off_time, vmd_pitch_t pitch)
+{
+	for (vmd_note_t *i = vmd_track_range(track, on_time, on_time + 1, pitch, pitch + 1); i != NULL; i = i->next) {
+		if (i->on_time == on_time && i->off_time == off_time && i->pitch == pitch)
+			return i;
+	}
+	return NULL;
+}
+
+void
+File::replay_edits(const QByteArray &edits)
+{
+	QDataStream s(edits);
+	while (!s.atEnd()) {
+		quint8 type;
+		s >> type;
+		if (type == J_ADD_TRACK) {
+			quint32 cm;
+			qint32 size, end_pitch;
+			s >> cm >> size;
+			if (s.status() != QDataStream::Ok || size > edits.size())
+				break;
+			if (size <= 0) {
+				append_track(cm, NULL);
+				continue;
+			}
+			vmd_notesystem_t ns;
+			s >> end_pitch;
+			ns.size = size;
+			ns.end_pitch = end_pitch;
+			ns.pitches = (int *)malloc(size * sizeof(*ns.pitches));
+			for (int i = 0; i < size; i++) {
+				qint32 p;
+				s >> p;
+				ns.pitches[i] = p;
+			}
+			if (s.status() != QDataStream::Ok) {
+				free(ns.pitches);
+				break;
+			}
+			append_track(cm, &ns);
+			continue;
+		}
+		if (type == J_CTRL) {
+			qint32 idx, ctrl, value;
+			s >> idx >> ctrl >> value;
+			if (idx >= 0 && idx < tracks)
+				set_ctrl(track[idx], ctrl, value);
+			continue;
+		}
+
+		qint32 idx, on_time, off_time, pitch, on_vel, off_vel, channel;
+		s >> idx >> on_time >> off_time >> pitch >> on_vel >> off_vel >> channel;
+		if (s.status() != QDataStream::Ok)
+			break;
+		if (idx < 0 || idx >= tracks)
+			continue;
+		vmd_track_t *t = track[idx];
+
+		if (type == J_INSERT) {
+			NoteData d = {on_time, off_time, pitch, on_vel, off_vel, channel};
+			insert_notes(t, std::vector<NoteData>(1, d));
+			continue;
+		}
+
+		vmd_note_t *note = find_note(t, on_time, off_time, pitch);
+		if (note == NULL)
+			continue;
+		if (type == J_ERASE)
+			erase_note(note);
+		else if (type == J_VELOCITY)
+			set_velocity(note, on_vel, off_vel);
+	}
+}
+
+void
+File::replay(const QByteArray &rec)
+{
+	QDataStream s(rec);
+	quint8 type;
+	s >> type;
+
+	switch (type) {
+	case J_COMMIT: {
+		QString descr;
+		QByteArray edits;
+		s >> descr >> edits;
+		replay_edits(edits);
+		commit(descr);
+		break;
+	}
+	case J_UPDATE: {
+		qint32 idx;
+		s >> idx;
+		if (FileRevision *rev = revision_at(idx))
+			update(rev);
+		break;
+	}
+	case J_FILENAME: {
+		QString fn;
+		s >> fn;
+		set_filename(fn);
+		break;
+	}
+	case J_SAVED: {
+		QString fn;
+		qint32 idx;
+		s >> fn >> idx;
+		saving_revision_ = revision_at(idx);
+		save_finished(fn, QString());
+		break;
+	}
+	case J_PAGES: {
+		QList<qint32> pages;
+		s >> pages;
+		std::vector<int> p(pages.begin(), pages.end());
+		if (pager_ != NULL)
+			load_pages(p, pager_->clock());
+		break;
+	}
+	}
+}
+
+bool
+File::recoverable(const QString &journal)
+{
+	QString base;
+	QList<QByteArray> records;
+	if (!Journal::read(journal, &base, &records))
+		return false;
+
+	bool ret = false;
+	for (int i = 0; i < records.size(); i++) {
+		quint8 type = records[i].isEmpty() ? 0xff : quint8(records[i][0]);
+		if (type == J_COMMIT || type == J_UPDATE)
+			ret = true;
+		else if (type == J_SAVED)
+			ret = false;
+	}
+	return ret;
+}
+
+File *
+File::recover(const QString &journal)
+{
+	QString base;
+	QList<QByteArray> records;
+	if (!Journal::read(journal, &base, &records))
+		throw std::runtime_error("Unreadable journal");
+
+	File *ret = base.isEmpty() ? new File() : new File(base);
+	try {
+		for (int i = 0; i < records.size(); i++)
+			ret->replay(records[i]);
+	} catch (...) {
+		delete ret;
+		throw;
+	}
+	return ret;
+}
+
+void
+File::require(vmd_time_t beg, vmd_time_t end)
+{
+	if (pager_ == NULL || pager_->pages() == 0 || end <= beg)
+		return;
+
+	unsigned since = pager_->clock();
+	std::vector<int> missing;
+	for (int p = pager_->page_at(beg - pager_->max_length()); p <= pager_->page_at(end - 1); p++) {
+		pager_->use(p);
+		if (!pager_->resident(p))
+			missing.push_back(p);
+	}
+	if (!missing.empty())
+		load_pages(missing, since);
+}
+
+void
+File::load_pages(const std::vector<int> &pages, unsigned keep_since)
+{
+	TRACE_SPAN("File::load_pages");
+	QList<qint32> loaded;
+	for (size_t i = 0; i < pages.size(); i++) {
+		if (pager_->resident(pages[i]))
+			continue;
+		if (pager_->load(pages[i]))
+			loaded.append(pages[i]);
+		else
+			qWarning("%s: page %d is damaged", filename_.toLocal8Bit().data(), pages[i]);
+	}
+
+	if (!loaded.isEmpty()) {
+		QByteArray rec;
+		QDataStream s(&rec, QIODevice::WriteOnly);
+		s << quint8(J_PAGES) << loaded;
+		journal(rec);
+	}
+
+	/* loads and evictions are not commits: the notes of unedited pages
+	 * are the same in every revision
+	 */
+	pager_->trim(PAGED_BUDGET, keep_since);
+	drop_caches();
+	QMetaObject::invokeMethod(this, "acted", Qt::QueuedConnection);
+}
+
+void
+File::drop_caches()
+{
+	/* playback holds on to the plan it plays */
+	plan_.clear();
+	/* indices of the remaining tracks are replaced when next asked for */
+	QMutableHashIterator<vmd_track_t *, CachedIndex *> i(indices_);
+	while (i.hasNext()) {
+		i.next();
+		int j = 0;
+		while (j < tracks && track[j] != i.key())
+			j++;
+		if (j == tracks) {
+			delete i.value();
+			i.remove();
+		}
+	}
+	generation_++;
+}
+
 void
 File::undo()
 {
@@ -104,11 +970,14 @@ File::redo()
 FileRevision::FileRevision(File *f, QString _descr)
 	:rev_(vmd_file_commit(f)),
 	descr_(_descr),
+	edit_bytes_(0),
 	prev_(f->revision()),
 	next_(NULL)
 {
 	if (rev_ == NULL)
 		throw std::runtime_error("File commit failed");
+	if (f->pager() != NULL)
+		resident_ = f->pager()->residency();
 }
 
 FileRevision::~FileRevision()
@@ -5,11 +5,40 @@
 #ifndef FILE_H
 #define FILE_H
 
+#include <QByteArray>
+#include <QHash>
+#include <QList>
 #include <QObject>
+#include <QSharedPointer>
 #include <QString>
+#include <vector>
 #include <vomid.h>
+#include "file_stats.h"
+#include "playback_plan.h"
 
 class FileRevision;
+class FileSaver;
+struct PlanBuild;
+class Journal;
+class NoteIndex;
+class Pager;
+
+/* the fields of a note, without the track; channel is an index into
+ * the file's channels
+ */
+struct NoteData
+{
+	vmd_time_t on_time, off_time;
+	vmd_pitch_t pitch;
+	int on_vel, off_vel;
+	int channel;
+};
+
+NoteData note_data(const vmd_note_t *);
+/* inserts a note with the given fields, moved by dt and dp, into a
+ * track of the file; NULL if it collides
+ */
+vmd_note_t *insert_note_data(vmd_file_t *, vmd_track_t *, const NoteData &, vmd_time_t dt = 0, vmd_pitch_t dp = 0);
 
 class File : public QObject, public vmd_file_t
 {
@@ -24,12 +53,100 @@ public:
 	FileRevision *saved_revision() { return saved_revision_; }
 	QString filename() const { return filename_; }
 	bool saved() const { return revision_ == saved_revision_; }
+	/* bumped whenever the notes may have changed */
+	unsigned generation() const { return generation_; }
 
+	void set_filename(QString);
+	/* saves in the background; saved() turns true once the file is written */
 	void save_as(QString);
+	bool saving() const { return saving_revision_ != NULL; }
+	void wait_saved();
+	/* exports what playback sends, in the background; failures are
+	 * reported like those of saves
+	 */
+	void bounce(QString, PlaybackPlan::Mode);
 	void commit(QString);
 	void update(FileRevision *);
 	void revert();
-	vmd_track_t *add_track(vmd_chanmask_t = VMD_CHANMASK_NODRUMS);
+	/* scale is empty for the default one, a number for an equal
+	 * temperament or the name of a Scala file; returns NULL if the
+	 * scale can't be loaded
+	 */
+	vmd_track_t *add_track(vmd_chanmask_t = VMD_CHANMASK_NODRUMS, const QString &scale = QString());
+	/* with a copy of the given notesystem */
+	vmd_track_t *add_track(vmd_chanmask_t, const vmd_notesystem_t &);
+
+	/* edits made through these are journaled, and survive a crash once
+	 * they are committed
+	 */
+	vmd_note_t *insert_note(vmd_track_t *, vmd_time_t on_time, vmd_time_t off_time, vmd_pitch_t);
+	vmd_note_t *copy_note(vmd_note_t *, vmd_track_t *, vmd_time_t dt, vmd_pitch_t dp);
+	/* inserts a batch, moved by dt and dp, keeping channels; returns
+	 * how many notes fit
+	 */
+	size_t insert_notes(vmd_track_t *, const std::vector<NoteData> &, vmd_time_t dt = 0, vmd_pitch_t dp = 0);
+	void erase_note(vmd_note_t *);
+	void set_velocity(vmd_note_t *, int on_vel, int off_vel);
+	void set_ctrl(vmd_track_t *, int ctrl, int value);
+
+	/* notes were changed outside of a commit */
+	void touch();
+	/* makes the current state the only revision */
+	void reset_history();
+
+	/* While a loader fills the file, it can be viewed and played, but
+	 * not edited or saved, and nothing is journaled. end_load() makes the
+	 * loaded notes the only revision, saved as if they had been imported,
+	 * and the journal's base the loaded file.
+	 */
+	bool loading() const { return loading_; }
+	void begin_load();
+	void end_load();
+
+	/* built on demand, valid until the next edit, commit or update */
+	const NoteIndex *index(vmd_track_t *);
+	/* the same index, shared: it stays a snapshot of this generation's
+	 * notes, that other threads may read, after the file changes. Its
+	 * note pointers are only good until then.
+	 */
+	QSharedPointer<const NoteIndex> shared_index(vmd_track_t *);
+	/* Rendered for the current revision on a pool thread, from a
+	 * snapshot taken by the first call; NULL until it is ready, waiting
+	 * at most wait_msec for that, and for files opened out of core.
+	 * Shared, so playback can hold on to it across edits.
+	 */
+	QSharedPointer<const PlaybackPlan> plan(PlaybackPlan::Mode = PlaybackPlan::BEND, int wait_msec = 0);
+
+	/* Big native files are opened out of core: only the notes of the
+	 * measures some view, playback or edit asked for are loaded, in any
+	 * revision. Loads are not commits; each revision remembers which
+	 * pages it had, and going to it brings back that set. Pages no edit
+	 * has touched are evicted again when over budget.
+	 */
+	const Pager *pager() const { return pager_; }
+	/* loads the notes starting in [beg, end) */
+	void require(vmd_time_t beg, vmd_time_t end);
+	void require_all() { require(0, VMD_MAX_TIME); }
+
+	/* memory use, for the diagnostics view; bytes are estimates */
+	struct Usage
+	{
+		size_t notes, note_bytes;
+		int revisions;
+		/* the journal records of the edits the revisions were committed
+		 * with; not what libvomid keeps for them, which it doesn't tell
+		 */
+		size_t edit_bytes;
+		/* of the note indices */
+		size_t cache_bytes;
+	};
+	Usage usage() const;
+	FileStats *stats() { return &stats_; }
+
+	/* whether a journal left by a crashed session holds unsaved changes */
+	static bool recoverable(const QString &journal);
+	/* rebuilds the file from such a journal; throws if it can't */
+	static File *recover(const QString &journal);
 
 public slots:
 	void undo();
@@ -37,11 +154,51 @@ public slots:
 
 signals:
 	void acted();
+	void saveFailed(QString);
+
+private slots:
+	void save_finished(QString, QString);
+	void bounce_finished(QString, QString);
+	void plan_built();
 
 private:
+	void drop_caches();
+	int revision_index(FileRevision *);
+	FileRevision *revision_at(int);
+	/* takes the pitches of the notesystem; NULL keeps the default one */
+	vmd_track_t *append_track(vmd_chanmask_t, vmd_notesystem_t *);
+	void start_journal(const QString &base);
+	void journal(const QByteArray &rec);
+	void replay_edits(const QByteArray &);
+	void replay(const QByteArray &);
+	void load_pages(const std::vector<int> &, unsigned keep_since);
+	/* keeps the note's page from being evicted */
+	void pin(vmd_note_t *);
+
 	QString filename_;
 	FileRevision *revision_;
 	FileRevision *saved_revision_;
+	FileRevision *saving_revision_;
+	FileSaver *saver_;
+	/* created by the first bounce */
+	FileSaver *bouncer_;
+	/* opened by the first commit or undo, so files that are only read
+	 * or converted never start one; records until then wait here
+	 */
+	Journal *journal_;
+	bool journal_started_;
+	QString journal_base_;
+	QList<QByteArray> journal_pending_;
+	QByteArray edits_;
+	unsigned generation_;
+	bool loading_;
+	struct CachedIndex;
+	QHash<vmd_track_t *, CachedIndex *> indices_;
+	QSharedPointer<const PlaybackPlan> plan_;
+	unsigned plan_generation_;
+	QSharedPointer<PlanBuild> plan_build_;
+	Pager *pager_;
+	FileStats stats_;
 };
 
 class FileRevision
@@ -60,6 +217,10 @@ protected:
 private:
 	vmd_file_rev_t *rev_;
 	QString descr_;
+	/* pages of a paged file that were loaded when it was committed */
+	std::vector<char> resident_;
+	/* size of its edits' journal record */
+	size_t edit_bytes_;
 	FileRevision *prev_, *next_;
 };
 
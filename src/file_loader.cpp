@@ -0,0 +1,244 @@
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+#include <stdexcept>
+#include "file.h"
+#include "file_loader.h"
+#include "trace.h"
+
+/* GUI thread time spent inserting notes per event loop iteration */
+const int step_msec = 15;
+/* how far the inserted part of the file grows at once, in quarters */
+const int step_quarters = 16;
+/* views are refreshed at most this often while loading */
+const int touch_msec = 100;
+/* how often a queued loader checks whether it was canceled */
+const int queue_poll_msec = 100;
+
+/* loaders decoding at once; the rest wait in run() */
+static QSemaphore loader_slots(QThread::idealThreadCount());
+static QAtomicInt decoding(0);
+
+/* a libvomid import, shared between the loader and the job doing it */
+struct LibraryImport
+{
+	QMutex mutex;
+	/* NULL once the loader is gone */
+	FileLoader *loader;
+	QThread *thread;
+	QString path;
+	/* the result, until the loader takes it */
+	File *file;
+	QString error;
+};
+
+class LibraryImportJob : public QRunnable
+{
+public:
+	LibraryImportJob(QSharedPointer<LibraryImport> _import) : import(_import) { }
+
+	void run()
+	{
+		TRACE_SPAN("FileLoader::import");
+		File *f = NULL;
+		QString error;
+		try {
+			f = new File(import->path);
+		} catch (const std::exception &ex) {
+			error = ex.what();
+		}
+
+		QMutexLocker lock(&import->mutex);
+		if (import->loader == NULL) {
+			delete f;
+			return;
+		}
+		if (f != NULL)
+			f->moveToThread(import->thread);
+		import->file = f;
+		import->error = error;
+		QMetaObject::invokeMethod(import->loader, "hand_over", Qt::QueuedConnection);
+	}
+
+private:
+	QSharedPointer<LibraryImport> import;
+};
+
+FileLoader::FileLoader(File *_file, const QString &_path)
+	:QThread(_file),
+	file_(_file),
+	path_(_path),
+	canceled_(0),
+	busy_(true),
+	division_(0),
+	total_(0),
+	done_(0),
+	horizon_(0)
+{
+	connect(this, SIGNAL(decoded()), this, SLOT(insert_decoded()));
+	connect(&timer_, SIGNAL(timeout()), this, SLOT(step()));
+	file_->begin_load();
+	started_.start();
+}
+
+FileLoader::~FileLoader()
+{
+	canceled_ = 1;
+	wait();
+	if (!import_.isNull()) {
+		QMutexLocker lock(&import_->mutex);
+		import_->loader = NULL;
+		/* handed over to a hand_over() that won't run */
+		delete import_->file;
+		import_->file = NULL;
+	}
+}
+
+void
+FileLoader::cancel()
+{
+	if (!busy_ || canceled_.fetchAndStoreOrdered(1) != 0)
+		return;
+	busy_ = false;
+	timer_.stop();
+	emit canceled();
+}
+
+void
+FileLoader::run()
+{
+	while (!loader_slots.tryAcquire(1, queue_poll_msec)) {
+		if (canceled_)
+			return;
+	}
+	QSemaphoreReleaser releaser(&loader_slots);
+	decoding.ref();
+	run_slot();
+	decoding.deref();
+}
+
+void
+FileLoader::run_slot()
+{
+	TRACE_SPAN("FileLoader::decode");
+	emit progress(0, 0);
+	{
+		/* with several files in flight each gets a single thread */
+		int threads = decoding.loadRelaxed() > 1 ? 1 : 0;
+		SmfMap smf(path_);
+		bool ok = smf.valid() && smf.division() > 0 && smf.format() != 2
+			&& smf_decode_tracks(smf, &tracks_, threads);
+		for (size_t i = 0; ok && i < tracks_.size(); i++)
+			ok = tracks_[i].supported;
+		if (canceled_)
+			return;
+		if (ok) {
+			division_ = smf.division();
+			emit decoded();
+			return;
+		}
+	}
+
+	tracks_.clear();
+	import_library();
+}
+
+void
+FileLoader::import_library()
+{
+	import_ = QSharedPointer<LibraryImport>(new LibraryImport);
+	import_->loader = this;
+	import_->thread = thread();
+	import_->path = path_;
+	import_->file = NULL;
+	QThreadPool::globalInstance()->start(new LibraryImportJob(import_));
+}
+
+void
+FileLoader::insert_decoded()
+{
+	if (canceled_)
+		return;
+
+	file_->division = division_;
+	targets_.resize(tracks_.size());
+	inserted_.assign(tracks_.size(), 0);
+	for (size_t i = 0; i < tracks_.size(); i++) {
+		total_ += tracks_[i].notes.size();
+		if (!smf_create_tracks(file_, tracks_[i], &targets_[i])) {
+			/* out of tracks */
+			tracks_.clear();
+			import_library();
+			return;
+		}
+	}
+	file_->touch();
+	last_touch_.start();
+	timer_.start(0);
+}
+
+void
+FileLoader::step()
+{
+	TRACE_SPAN("FileLoader::step");
+	QElapsedTimer t;
+	t.start();
+
+	while (done_ < total_ && t.elapsed() < step_msec) {
+		horizon_ += vmd_time_t(division_) * step_quarters;
+		for (size_t i = 0; i < tracks_.size(); i++) {
+			const std::vector<SmfNote> &notes = tracks_[i].notes;
+			size_t beg = inserted_[i], end = beg;
+			while (end < notes.size() && notes[end].on_time < horizon_)
+				end++;
+			if (!smf_insert_notes(targets_[i], tracks_[i], beg, end)) {
+				/* colliding notes; libvomid decides what to keep */
+				timer_.stop();
+				tracks_.clear();
+				emit progress(0, 0);
+				import_library();
+				return;
+			}
+			inserted_[i] = end;
+			done_ += end - beg;
+		}
+	}
+	if (done_ < total_ && last_touch_.elapsed() < touch_msec)
+		return;
+	file_->touch();
+	last_touch_.restart();
+	emit progress(done_, total_);
+
+	if (done_ == total_) {
+		timer_.stop();
+		tracks_.clear();
+		file_->end_load();
+		file_->stats()->add(FileStats::IMPORT, started_.nsecsElapsed());
+		busy_ = false;
+		emit loaded();
+	}
+}
+
+void
+FileLoader::hand_over()
+{
+	File *f;
+	QString error;
+	{
+		QMutexLocker lock(&import_->mutex);
+		f = import_->file;
+		error = import_->error;
+		import_->file = NULL;
+	}
+	if (!busy_) {
+		delete f;
+		return;
+	}
+	busy_ = false;
+	if (f == NULL)
+		emit failed(error);
+	else
+		emit replaced(f);
+}
@@ -0,0 +1,91 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef FILE_LOADER_H
+#define FILE_LOADER_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include <QTimer>
+#include <vector>
+#include "smf.h"
+
+class File;
+struct LibraryImport;
+
+/* Loads a file into an (initially empty) File in the background.
+ *
+ * The worker thread decodes all tracks from the mapping; the notes are
+ * then inserted on the GUI thread a few measures at a time, so the
+ * beginning of the file can be viewed and played while the rest streams
+ * in. Files the mapped reader can't handle, or whose notes it can't
+ * insert, are imported by libvomid on the thread pool into a separate
+ * File, which is handed over with replaced(). That import can't be
+ * interrupted: a loader destroyed meanwhile doesn't wait for it, and
+ * the File is deleted when it is done.
+ *
+ * Until loading is done the file can't be edited, so nothing is lost
+ * when it is replaced, and the journal starts from the loaded file.
+ *
+ * At most QThread::idealThreadCount() loaders decode at once; the others
+ * wait for a slot, so opening many files doesn't thrash the machine.
+ */
+class FileLoader : public QThread
+{
+	Q_OBJECT
+
+public:
+	FileLoader(File *, const QString &path);
+	~FileLoader();
+
+	File *file() const { return file_; }
+	QString path() const { return path_; }
+	bool busy() const { return busy_; }
+
+public slots:
+	void cancel();
+
+signals:
+	void progress(int value, int maximum);
+	void loaded();
+	void replaced(File *);
+	void failed(QString);
+	void canceled();
+
+	/* worker -> GUI thread */
+	void decoded();
+
+protected:
+	void run();
+
+private slots:
+	void insert_decoded();
+	void step();
+	void hand_over();
+
+private:
+	void run_slot();
+	void import_library();
+
+	File *file_;
+	QString path_;
+	QAtomicInt canceled_;
+	bool busy_;
+	QSharedPointer<LibraryImport> import_;
+
+	int division_;
+	std::vector<SmfTrack> tracks_;
+	std::vector<SmfTarget> targets_;
+	std::vector<size_t> inserted_;
+	size_t total_, done_;
+	vmd_time_t horizon_;
+	QTimer timer_;
+	QElapsedTimer last_touch_;
+	QElapsedTimer started_;
+};
+
+#endif /* FILE_LOADER_H */
@@ -0,0 +1,130 @@
+#include <QTemporaryFile>
+#include "file.h"
+#include "file_saver.h"
+#include "file_snapshot.h"
+#include "native.h"
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+FileSaver::FileSaver(File *_file)
+	:QThread(_file),
+	file_(_file),
+	native_(false),
+	bounce_(false),
+	mode_(PlaybackPlan::BEND),
+	snapshot_(NULL)
+{
+}
+
+FileSaver::~FileSaver()
+{
+	wait();
+	delete snapshot_;
+}
+
+bool
+FileSaver::save(const QString &path)
+{
+	wait();
+	bounce_ = false;
+	plan_.clear();
+	return start_export(path);
+}
+
+bool
+FileSaver::bounce(const QString &path, PlaybackPlan::Mode mode, QSharedPointer<const PlaybackPlan> plan)
+{
+	wait();
+	bounce_ = true;
+	mode_ = mode;
+	plan_ = plan;
+	return start_export(path);
+}
+
+bool
+FileSaver::start_export(const QString &path)
+{
+	path_ = path;
+	error_ = QString();
+
+	/* the temporary file must be on the same filesystem as the target */
+	QTemporaryFile tmp(path + ".XXXXXX");
+	tmp.setAutoRemove(false);
+	if (!tmp.open())
+		return false;
+	tmp_ = tmp.fileName().toLocal8Bit();
+	tmp.close();
+
+	delete snapshot_;
+	native_ = !bounce_ && path.endsWith(NATIVE_SUFFIX);
+	/* a plan that is ready needs no notes */
+	snapshot_ = plan_.isNull() ? take_snapshot(file_) : NULL;
+	start();
+	return true;
+}
+
+static bool
+sync_file(const char *path)
+{
+#ifdef Q_OS_WIN
+	/* the rename is written through */
+	(void)path;
+	return true;
+#else
+	int fd = ::open(path, O_WRONLY);
+	if (fd < 0)
+		return false;
+	bool ok = fsync(fd) == 0;
+	return ::close(fd) == 0 && ok;
+#endif
+}
+
+static bool
+replace_file(const char *from, const QString &to)
+{
+#ifdef Q_OS_WIN
+	return MoveFileExW((const wchar_t *)QString::fromLocal8Bit(from).utf16(),
+	                   (const wchar_t *)to.utf16(),
+	                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to.toLocal8Bit().data()) == 0;
+#endif
+}
+
+void
+FileSaver::run()
+{
+	bool ok;
+	if (bounce_ && !plan_.isNull()) {
+		ok = plan_->export_smf(tmp_.data()) == VMD_OK;
+	} else {
+		const FileSnapshot &s = *snapshot_;
+		vmd_file_t file;
+		vmd_file_init(&file);
+		ok = build_snapshot(&file, s);
+		if (ok && bounce_)
+			ok = PlaybackPlan(&file, mode_).export_smf(tmp_.data()) == VMD_OK;
+		else if (ok && native_)
+			ok = native_export(&file, tmp_.data(), s.base, &s.resident) == VMD_OK;
+		else if (ok)
+			ok = vmd_file_export(&file, tmp_.data()) == VMD_OK;
+		vmd_file_fini(&file);
+		delete snapshot_;
+		snapshot_ = NULL;
+	}
+	plan_.clear();
+
+	if (!ok || !sync_file(tmp_.data()))
+		error_ = "Export failed";
+	if (error_.isEmpty() && !replace_file(tmp_.data(), path_))
+		error_ = qt_error_string();
+	if (!error_.isEmpty())
+		QFile::remove(QString::fromLocal8Bit(tmp_));
+	emit saved(path_, error_);
+}
@@ -0,0 +1,60 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef FILE_SAVER_H
+#define FILE_SAVER_H
+
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QString>
+#include <QThread>
+#include "playback_plan.h"
+
+class File;
+struct FileSnapshot;
+
+/* Saves a file without blocking editing.
+ *
+ * save() copies the notes and settings of the current state on the
+ * calling thread, which takes a linear scan; a thread then builds a
+ * private vmd_file_t from the copy, exports it to a temporary file next
+ * to the target through a large write buffer, syncs it and atomically
+ * renames it over the target, while the file keeps being edited.
+ *
+ * bounce() exports the file's playback the same way, from its plan when
+ * that is ready, else from a plan rendered on the thread.
+ */
+class FileSaver : public QThread
+{
+	Q_OBJECT
+
+public:
+	FileSaver(File *);
+	~FileSaver();
+
+	/* return false if the export could not be started */
+	bool save(const QString &path);
+	bool bounce(const QString &path, PlaybackPlan::Mode, QSharedPointer<const PlaybackPlan>);
+
+signals:
+	void saved(QString path, QString error);
+
+protected:
+	void run();
+
+private:
+	bool start_export(const QString &path);
+
+	File *file_;
+	QString path_;
+	QByteArray tmp_;
+	bool native_;
+	bool bounce_;
+	PlaybackPlan::Mode mode_;
+	QSharedPointer<const PlaybackPlan> plan_;
+	FileSnapshot *snapshot_;
+	QString error_;
+};
+
+#endif /* FILE_SAVER_H */
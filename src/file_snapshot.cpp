@@ -0,0 +1,74 @@
+#include <stdlib.h>
+#include <string.h>
+#include "file_snapshot.h"
+#include "pager.h"
+
+FileSnapshot *
+take_snapshot(File *file)
+{
+	FileSnapshot *ret = new FileSnapshot;
+	ret->division = file->division;
+	for (int c = 0; c < VMD_FCTRLS; c++) {
+		/* the map's change points */
+		vmd_time_t time = 0, next;
+		for (;;) {
+			SnapshotCtrl s = {c, time, vmd_map_get(&file->ctrl[c], time, &next)};
+			ret->ctrls.push_back(s);
+			if (next == VMD_MAX_TIME || next <= time)
+				break;
+			time = next;
+		}
+	}
+
+	ret->tracks.resize(file->tracks);
+	for (int i = 0; i < file->tracks; i++) {
+		vmd_track_t *track = file->track[i];
+		SnapshotTrack &t = ret->tracks[i];
+		t.chanmask = track->chanmask;
+		for (int c = 0; c < VMD_CCTRLS; c++)
+			t.ctrl[c] = vmd_track_get_ctrl(track, c);
+		t.end_pitch = track->notesystem.end_pitch;
+		t.pitches.assign(track->notesystem.pitches, track->notesystem.pitches + track->notesystem.size);
+		t.name = QByteArray(track->name, strnlen(track->name, sizeof(track->name)));
+		t.notes.reserve(vmd_bst_size(&track->notes));
+		VMD_BST_FOREACH(vmd_bst_node_t *n, &track->notes)
+			t.notes.push_back(note_data(vmd_track_note(n)));
+	}
+
+	const Pager *pager = file->pager();
+	ret->base = pager != NULL ? &pager->map() : NULL;
+	if (pager != NULL)
+		ret->resident = pager->residency();
+	return ret;
+}
+
+bool
+build_snapshot(vmd_file_t *file, const FileSnapshot &s)
+{
+	file->division = s.division;
+	for (size_t i = 0; i < s.ctrls.size(); i++)
+		vmd_map_set(&file->ctrl[s.ctrls[i].ctrl], s.ctrls[i].time, s.ctrls[i].value);
+
+	for (size_t i = 0; i < s.tracks.size(); i++) {
+		const SnapshotTrack &t = s.tracks[i];
+		if (file->tracks == VMD_MAX_TRACKS - 1)
+			return false;
+		vmd_track_t *track = file->track[file->tracks++] = vmd_track_create(file, t.chanmask);
+		for (int c = 0; c < VMD_CCTRLS; c++)
+			vmd_track_set_ctrl(track, c, t.ctrl[c]);
+		if (!t.pitches.empty()) {
+			vmd_notesystem_t ns = track->notesystem;
+			ns.size = t.pitches.size();
+			ns.end_pitch = t.end_pitch;
+			ns.pitches = (int *)malloc(t.pitches.size() * sizeof(*ns.pitches));
+			memcpy(ns.pitches, &t.pitches[0], t.pitches.size() * sizeof(*ns.pitches));
+			vmd_track_set_notesystem(track, ns);
+		}
+		strncpy(track->name, t.name.constData(), sizeof(track->name) - 1);
+		for (size_t j = 0; j < t.notes.size(); j++) {
+			if (insert_note_data(file, track, t.notes[j]) == NULL)
+				return false;
+		}
+	}
+	return true;
+}
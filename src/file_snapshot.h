@@ -0,0 +1,50 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef FILE_SNAPSHOT_H
+#define FILE_SNAPSHOT_H
+
+#include <QByteArray>
+#include <vector>
+#include <vomid.h>
+#include "file.h"
+
+class NativeMap;
+
+struct SnapshotTrack
+{
+	vmd_chanmask_t chanmask;
+	int ctrl[VMD_CCTRLS];
+	vmd_pitch_t end_pitch;
+	std::vector<int> pitches;
+	QByteArray name;
+	std::vector<NoteData> notes;
+};
+
+struct SnapshotCtrl
+{
+	int ctrl;
+	vmd_time_t time;
+	int value;
+};
+
+/* A copy of a file's notes and settings, taken on the GUI thread in a
+ * linear scan, for saving and planning playback on other threads while
+ * the file keeps being edited.
+ */
+struct FileSnapshot
+{
+	int division;
+	std::vector<SnapshotCtrl> ctrls;
+	std::vector<SnapshotTrack> tracks;
+	/* unloaded pages of a paged file are taken from here */
+	const NativeMap *base;
+	std::vector<char> resident;
+};
+
+FileSnapshot *take_snapshot(File *);
+/* fills an empty file with the snapshot's loaded notes */
+bool build_snapshot(vmd_file_t *, const FileSnapshot &);
+
+#endif /* FILE_SNAPSHOT_H */
@@ -0,0 +1,31 @@
+#include <algorithm>
+#include "file_stats.h"
+
+FileStats::FileStats()
+{
+	std::fill(count_, count_ + KINDS, 0);
+}
+
+void
+FileStats::add(Kind kind, qint64 nsecs)
+{
+	samples_[kind][count_[kind] % SAMPLES] = nsecs;
+	count_[kind]++;
+}
+
+FileStats::Summary
+FileStats::summary(Kind kind) const
+{
+	Summary ret = {count_[kind], 0, 0, 0};
+	int n = std::min(int(count_[kind]), int(SAMPLES));
+	if (n == 0)
+		return ret;
+
+	ret.last_ms = samples_[kind][(count_[kind] - 1) % SAMPLES] / 1e6;
+	for (int i = 0; i < n; i++) {
+		double ms = samples_[kind][i] / 1e6;
+		ret.avg_ms += ms / n;
+		ret.max_ms = std::max(ret.max_ms, ms);
+	}
+	return ret;
+}
@@ -0,0 +1,56 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef FILE_STATS_H
+#define FILE_STATS_H
+
+#include <QElapsedTimer>
+
+/* Recent timings of a file's operations, for the diagnostics view. */
+class FileStats
+{
+public:
+	enum Kind
+	{
+		COMMIT,
+		UNDO,
+		PAINT,
+		IMPORT,
+		KINDS
+	};
+
+	/* of the recent samples */
+	struct Summary
+	{
+		int count;
+		double last_ms, avg_ms, max_ms;
+	};
+
+	/* times the scope it lives in */
+	class Timer
+	{
+	public:
+		Timer(FileStats *stats, Kind kind) : stats_(stats), kind_(kind) { t_.start(); }
+		~Timer() { stats_->add(kind_, t_.nsecsElapsed()); }
+
+	private:
+		FileStats *stats_;
+		Kind kind_;
+		QElapsedTimer t_;
+	};
+
+	FileStats();
+
+	void add(Kind, qint64 nsecs);
+	Summary summary(Kind) const;
+
+private:
+	enum { SAMPLES = 32 };
+
+	qint64 samples_[KINDS][SAMPLES];
+	/* of all samples; the recent ones are kept round-robin */
+	int count_[KINDS];
+};
+
+#endif /* FILE_STATS_H */
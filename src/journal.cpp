@@ -0,0 +1,243 @@
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QDir>
+#include <QLockFile>
+#include <QStandardPaths>
+#include "journal.h"
+#include "trace.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* minimum time between two syncs, in ms */
+static const int SYNC_INTERVAL = 50;
+
+/* 2: note records carry the channel */
+static const char MAGIC[4] = {'V', 'M', 'J', '2'};
+
+static QString
+journal_dir()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/journal";
+}
+
+static bool
+sync_file(QFile *f)
+{
+	if (!f->flush())
+		return false;
+#ifdef Q_OS_WIN
+	return _commit(f->handle()) == 0;
+#else
+	return fsync(f->handle()) == 0;
+#endif
+}
+
+static bool
+link_file(const QString &from, const QString &to)
+{
+#ifdef Q_OS_WIN
+	if (CreateHardLinkW((const wchar_t *)to.utf16(), (const wchar_t *)from.utf16(), NULL))
+		return true;
+#else
+	if (link(from.toLocal8Bit().data(), to.toLocal8Bit().data()) == 0)
+		return true;
+#endif
+	/* different filesystem */
+	return QFile::copy(from, to);
+}
+
+Journal::Journal(QObject *parent)
+	:QThread(parent),
+	lock_(NULL),
+	failed_(false),
+	stop_(false)
+{
+}
+
+Journal::~Journal()
+{
+	close();
+}
+
+bool
+Journal::open(const QString &base)
+{
+	static QAtomicInt counter;
+
+	discard();
+
+	QString dir = journal_dir();
+	if (!QDir().mkpath(dir))
+		return false;
+	path_ = QString("%1/%2-%3.vmj")
+		.arg(dir)
+		.arg(QCoreApplication::applicationPid())
+		.arg(counter.fetchAndAddRelaxed(1));
+
+	lock_ = new QLockFile(path_ + ".lock");
+	if (!lock_->tryLock(0))
+		goto fail;
+
+	if (!base.isEmpty() && !link_file(base, path_ + ".base"))
+		goto fail;
+
+	file_.setFileName(path_);
+	if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		goto fail;
+	{
+		char has_base = !base.isEmpty();
+		if (file_.write(MAGIC, sizeof(MAGIC)) != sizeof(MAGIC)
+		 || file_.write(&has_base, 1) != 1
+		 || !sync_file(&file_))
+			goto fail;
+	}
+
+	failed_ = false;
+	stop_ = false;
+	since_sync_.invalidate();
+	start();
+	return true;
+
+fail:
+	qWarning("%s: cannot start journal", path_.toLocal8Bit().data());
+	file_.close();
+	remove(path_);
+	delete lock_;
+	lock_ = NULL;
+	path_ = QString();
+	return false;
+}
+
+void
+Journal::append(const QByteArray &record)
+{
+	if (path_.isEmpty())
+		return;
+
+	QByteArray frame;
+	QDataStream s(&frame, QIODevice::WriteOnly);
+	s << quint32(record.size()) << quint16(qChecksum(record));
+	frame.append(record);
+
+	mutex_.lock();
+	queue_.append(frame);
+	cond_.wakeOne();
+	mutex_.unlock();
+}
+
+void
+Journal::run()
+{
+	mutex_.lock();
+	while (!stop_ || !queue_.isEmpty()) {
+		if (queue_.isEmpty()) {
+			cond_.wait(&mutex_);
+			continue;
+		}
+		/* let a burst of records share one sync */
+		if (!stop_ && since_sync_.isValid() && since_sync_.elapsed() < SYNC_INTERVAL) {
+			cond_.wait(&mutex_, SYNC_INTERVAL - since_sync_.elapsed());
+			continue;
+		}
+
+		QByteArray data = queue_;
+		queue_.clear();
+		mutex_.unlock();
+
+		{
+			TRACE_SPAN("Journal::sync");
+			if (!failed_ && (file_.write(data) != data.size() || !sync_file(&file_))) {
+				qWarning("%s: journal write failed", path_.toLocal8Bit().data());
+				failed_ = true;
+			}
+		}
+		since_sync_.start();
+
+		mutex_.lock();
+	}
+	mutex_.unlock();
+}
+
+void
+Journal::close()
+{
+	if (path_.isEmpty())
+		return;
+
+	mutex_.lock();
+	stop_ = true;
+	cond_.wakeOne();
+	mutex_.unlock();
+	wait();
+
+	file_.close();
+	delete lock_;
+	lock_ = NULL;
+}
+
+void
+Journal::discard()
+{
+	if (path_.isEmpty())
+		return;
+	close();
+	remove(path_);
+	path_ = QString();
+}
+
+QStringList
+Journal::orphans()
+{
+	QDir dir(journal_dir());
+	QStringList ret;
+
+	QStringList names = dir.entryList(QStringList() << "*.vmj", QDir::Files, QDir::Name);
+	for (int i = 0; i < names.size(); i++) {
+		QString path = dir.filePath(names[i]);
+		QLockFile lock(path + ".lock");
+		if (lock.tryLock(0))
+			ret << path;
+	}
+	return ret;
+}
+
+bool
+Journal::read(const QString &path, QString *base, QList<QByteArray> *records)
+{
+	QFile f(path);
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+	QByteArray data = f.readAll();
+	if (data.size() < int(sizeof(MAGIC)) + 1 || !data.startsWith(QByteArray(MAGIC, sizeof(MAGIC))))
+		return false;
+	*base = data[sizeof(MAGIC)] ? path + ".base" : QString();
+
+	QDataStream s(data);
+	s.skipRawData(sizeof(MAGIC) + 1);
+	records->clear();
+	while (!s.atEnd()) {
+		quint32 size;
+		quint16 sum;
+		s >> size >> sum;
+		if (s.status() != QDataStream::Ok || size > quint32(data.size()))
+			break;
+		QByteArray record(size, 0);
+		if (s.readRawData(record.data(), size) != int(size) || qChecksum(record) != sum)
+			break; /* torn by a crash */
+		records->append(record);
+	}
+	return true;
+}
+
+void
+Journal::remove(const QString &path)
+{
+	QFile::remove(path);
+	QFile::remove(path + ".base");
+}
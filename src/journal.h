@@ -0,0 +1,69 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+class QLockFile;
+
+/* Append-only crash-recovery journal.
+ *
+ * A journal starts from a base file, which is hard-linked (or copied)
+ * next to it so that saving over the original does not disturb it, and
+ * collects opaque records appended by the owner. Records are written
+ * and synced on a thread of their own; records appended while a sync is
+ * in progress share the next one. Each record is framed with its size
+ * and checksum, so a record torn by a crash ends the journal cleanly.
+ *
+ * A journal is locked while open; journals whose lock is free were left
+ * by a session that did not close them.
+ */
+class Journal : public QThread
+{
+	Q_OBJECT
+
+public:
+	Journal(QObject *parent = NULL);
+	~Journal();
+
+	/* starts a fresh journal; base may be empty */
+	bool open(const QString &base);
+	void append(const QByteArray &record);
+	/* closes and removes the journal */
+	void discard();
+
+	static QStringList orphans();
+	/* base is empty if the journal started from an empty file */
+	static bool read(const QString &path, QString *base, QList<QByteArray> *records);
+	static void remove(const QString &path);
+
+protected:
+	void run();
+
+private:
+	void close();
+
+	QString path_;
+	QLockFile *lock_;
+	QFile file_;
+	bool failed_;
+
+	QMutex mutex_;
+	QWaitCondition cond_;
+	QByteArray queue_;
+	bool stop_;
+	QElapsedTimer since_sync_;
+};
+
+#endif /* JOURNAL_H */
@@ -1,18 +1,44 @@
 #include <QApplication>
+#include <QElapsedTimer>
+#include <cstdio>
 #include <vomid.h>
 #include "player.h"
+#include "scala_library.h"
+#include "trace.h"
 #include "w_main.h"
 
 int main(int argc, char *argv[])
 {
+	QElapsedTimer startup;
+	startup.start();
 	QApplication app(argc, argv);
+	/* prints the time to the first frame and quits, failing if slow */
+	bool measure_startup = app.arguments().contains("--measure-startup");
 	Player player;
-	WMain main_window(&player);
+	ScalaLibrary scala;
+	WMain main_window(&player, &scala);
 
+	main_window.time_startup(startup);
+	if (measure_startup)
+		QObject::connect(&main_window, SIGNAL(firstFrame()), &app, SLOT(quit()), Qt::QueuedConnection);
 	main_window.show();
+	/* recovery may ask questions, which would stall the measurement */
+	if (!measure_startup)
+		main_window.recover();
+	scala.scan();
 
 	vmd_file_t f;
 	vmd_file_init(&f);
 
-	return app.exec();
+	int ret = app.exec();
+	if (measure_startup) {
+		printf("first frame: %lld ms\n", (long long)main_window.first_frame_msec());
+		return main_window.first_frame_msec() > WMain::first_frame_target_msec ? 1 : ret;
+	}
+#ifdef VOMID_TRACE
+	QByteArray trace = qgetenv("VOMID_TRACE_FILE");
+	if (!trace.isEmpty())
+		trace_dump(QString::fromLocal8Bit(trace));
+#endif
+	return ret;
 }
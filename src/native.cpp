@@ -0,0 +1,449 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "native.h"
+
+static const char MAGIC[8] = {'V', 'O', 'M', 'I', 'D', 'N', 'F', 0};
+static const quint32 ORDER_MARK = 0x01020304;
+static const quint32 VERSION = 2;
+
+static size_t
+align8(size_t n)
+{
+	return (n + 7) & ~size_t(7);
+}
+
+struct CrcTable
+{
+	quint32 entry[256];
+
+	CrcTable()
+	{
+		for (quint32 i = 0; i < 256; i++) {
+			quint32 c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			entry[i] = c;
+		}
+	}
+};
+
+quint32
+native_checksum(const void *data, size_t size)
+{
+	/* CRC-32 (IEEE); the table is built once, safely across threads */
+	static const CrcTable table;
+
+	const uchar *p = (const uchar *)data;
+	quint32 crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; i++)
+		crc = table.entry[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+size_t
+native_notes_layout(size_t n, size_t offset[6])
+{
+	offset[0] = 0;
+	offset[1] = offset[0] + align8(n * sizeof(qint32));
+	offset[2] = offset[1] + align8(n * sizeof(qint32));
+	offset[3] = offset[2] + align8(n * sizeof(qint32));
+	offset[4] = offset[3] + align8(n);
+	offset[5] = offset[4] + align8(n);
+	return offset[5] + align8(n);
+}
+
+NativeMap::NativeMap(const QString &path)
+	:file_(path),
+	data_(NULL),
+	size_(0),
+	native_(false),
+	valid_(false),
+	header_(NULL),
+	table_(NULL),
+	verified_(NULL)
+{
+	if (!file_.open(QIODevice::ReadOnly) || file_.size() < qint64(sizeof(NativeHeader)))
+		return;
+	size_ = file_.size();
+	data_ = file_.map(0, size_);
+	if (data_ == NULL)
+		return;
+
+	header_ = (const NativeHeader *)data_;
+	native_ = memcmp(header_->magic, MAGIC, sizeof(MAGIC)) == 0;
+	if (!native_ || header_->byte_order != ORDER_MARK || header_->version != VERSION)
+		return;
+
+	size_t table_size = size_t(header_->sections) * sizeof(NativeSection);
+	if (header_->sections > size_ / sizeof(NativeSection) || sizeof(NativeHeader) + table_size > size_)
+		return;
+	table_ = (const NativeSection *)(data_ + sizeof(NativeHeader));
+	if (native_checksum(table_, table_size) != header_->table_checksum)
+		return;
+	for (quint32 i = 0; i < header_->sections; i++) {
+		const NativeSection &s = table_[i];
+		if (s.offset % 8 != 0 || s.offset > size_ || s.size > size_ - s.offset)
+			return;
+	}
+	verified_ = new QAtomicInt[header_->sections];
+	valid_ = true;
+}
+
+NativeMap::~NativeMap()
+{
+	delete[] verified_;
+	if (data_ != NULL)
+		file_.unmap(const_cast<uchar *>(data_));
+}
+
+const NativeSection *
+NativeMap::section(quint32 type, quint32 track) const
+{
+	if (!valid_)
+		return NULL;
+
+	/* sections are written in a fixed order; search only if that fails */
+	quint32 i = type == NATIVE_CTRL ? track : header_->ctrls + 3 * track + (type - NATIVE_TRACK);
+	if (i >= header_->sections || table_[i].type != type || table_[i].track != track) {
+		for (i = 0; i < header_->sections; i++) {
+			if (table_[i].type == type && table_[i].track == track)
+				break;
+		}
+		if (i == header_->sections)
+			return NULL;
+	}
+
+	const NativeSection *s = &table_[i];
+	/* threads racing here both check it, which is harmless */
+	if (!verified_[i].loadAcquire()) {
+		if (native_checksum(data(s), s->size) != s->checksum)
+			return NULL;
+		verified_[i].storeRelease(1);
+	}
+	return s;
+}
+
+const NativeTrack *
+NativeMap::track(quint32 t) const
+{
+	const NativeSection *s = section(NATIVE_TRACK, t);
+	if (s == NULL || s->size < sizeof(NativeTrack))
+		return NULL;
+	const NativeTrack *ret = (const NativeTrack *)data(s);
+	if (ret->ctrls > NATIVE_MAX_CTRLS || ret->scale_size > (s->size - sizeof(NativeTrack)) / sizeof(qint32))
+		return NULL;
+	return ret;
+}
+
+bool
+NativeMap::notes(quint32 t, NativeNotes *ret) const
+{
+	const NativeSection *s = section(NATIVE_NOTES, t);
+	if (s == NULL)
+		return false;
+	size_t offset[6];
+	if (s->count > s->size || native_notes_layout(s->count, offset) > s->size)
+		return false;
+
+	const uchar *p = data(s);
+	ret->count = s->count;
+	ret->on_time = (const qint32 *)(p + offset[0]);
+	ret->off_time = (const qint32 *)(p + offset[1]);
+	ret->pitch = (const qint32 *)(p + offset[2]);
+	ret->on_vel = p + offset[3];
+	ret->off_vel = p + offset[4];
+	ret->channel = (const qint8 *)(p + offset[5]);
+	return true;
+}
+
+const quint32 *
+NativeMap::index(quint32 t, size_t *count) const
+{
+	const NativeSection *s = section(NATIVE_INDEX, t);
+	if (s == NULL || s->count >= s->size / sizeof(quint32))
+		return NULL;
+	*count = s->count;
+	return (const quint32 *)data(s);
+}
+
+/* Export */
+
+/* output buffer of the writer; sections are written as they are made,
+ * so only one track's columns are in memory at a time
+ */
+static const size_t WRITE_BUFFER = 1 << 20;
+
+struct NativeWriter
+{
+	FILE *f;
+	quint64 pos;
+	bool ok;
+	std::vector<NativeSection> table;
+
+	void pad(quint64 to)
+	{
+		static const uchar zeros[256] = {0};
+		while (pos < to) {
+			size_t n = std::min<quint64>(to - pos, sizeof(zeros));
+			ok = fwrite(zeros, 1, n, f) == n && ok;
+			pos += n;
+		}
+	}
+
+	void add(quint32 type, quint32 track, quint32 count, const void *data, size_t size)
+	{
+		NativeSection s;
+		s.type = type;
+		s.track = track;
+		s.offset = align8(pos);
+		s.size = size;
+		s.checksum = native_checksum(data, size);
+		s.count = count;
+		table.push_back(s);
+		pad(s.offset);
+		if (size > 0)
+			ok = fwrite(data, 1, size, f) == size && ok;
+		pos += size;
+	}
+};
+
+struct NoteRec
+{
+	qint32 on_time, off_time, pitch;
+	uchar on_vel, off_vel;
+	qint8 channel;
+
+	bool operator<(const NoteRec &that) const
+	{
+		return on_time != that.on_time ? on_time < that.on_time : pitch < that.pitch;
+	}
+};
+
+static void
+base_notes(std::vector<NoteRec> *ret, const NativeMap &base, quint32 t, const std::vector<char> &resident)
+{
+	size_t spans;
+	NativeNotes notes;
+	const quint32 *index = base.index(t, &spans);
+	if (index == NULL || !base.notes(t, &notes))
+		return;
+	for (size_t p = 0; p < spans && p < resident.size(); p++) {
+		if (resident[p])
+			continue;
+		for (size_t i = index[p]; i < index[p + 1] && i < notes.count; i++) {
+			NoteRec r = {
+				notes.on_time[i], notes.off_time[i], notes.pitch[i],
+				notes.on_vel[i], notes.off_vel[i], notes.channel[i]
+			};
+			ret->push_back(r);
+		}
+	}
+}
+
+static void
+export_track(NativeWriter *w, quint32 idx, vmd_track_t *track, quint32 index_span,
+             const NativeMap *base, const std::vector<char> *resident)
+{
+	const vmd_notesystem_t &ns = track->notesystem;
+	std::vector<uchar> settings(sizeof(NativeTrack) + ns.size * sizeof(qint32));
+	NativeTrack *nt = (NativeTrack *)&settings[0];
+	memset(nt, 0, sizeof(NativeTrack));
+	nt->chanmask = track->chanmask;
+	nt->ctrls = std::min(int(VMD_CCTRLS), int(NATIVE_MAX_CTRLS));
+	for (quint32 i = 0; i < nt->ctrls; i++)
+		nt->ctrl[i] = vmd_track_get_ctrl(track, i);
+	nt->end_pitch = ns.end_pitch;
+	nt->scale_size = ns.size;
+	for (int i = 0; i < ns.size; i++)
+		((qint32 *)(nt + 1))[i] = ns.pitches[i];
+	memcpy(nt->name, track->name, std::min(sizeof(nt->name), strnlen(track->name, sizeof(track->name))));
+
+	std::vector<NoteRec> notes;
+	notes.reserve(vmd_bst_size(&track->notes));
+	VMD_BST_FOREACH(vmd_bst_node_t *i, &track->notes) {
+		vmd_note_t *note = vmd_track_note(i);
+		NoteRec r = {
+			qint32(note->on_time), qint32(note->off_time), qint32(note->pitch),
+			uchar(note->on_vel), uchar(note->off_vel),
+			qint8(note->channel != NULL ? note->channel - track->file->channel : -1)
+		};
+		notes.push_back(r);
+	}
+	if (base != NULL && idx < base->header().tracks)
+		base_notes(&notes, *base, idx, *resident);
+	for (size_t i = 0; i < notes.size(); i++)
+		nt->max_length = std::max(nt->max_length, notes[i].off_time - notes[i].on_time);
+	std::stable_sort(notes.begin(), notes.end());
+	w->add(NATIVE_TRACK, idx, 1, &settings[0], settings.size());
+
+	size_t n = notes.size(), offset[6];
+	std::vector<uchar> columns(native_notes_layout(n, offset) + 1);
+	qint32 *on_time = (qint32 *)&columns[offset[0]];
+	qint32 *off_time = (qint32 *)&columns[offset[1]];
+	qint32 *pitch = (qint32 *)&columns[offset[2]];
+	for (size_t i = 0; i < n; i++) {
+		on_time[i] = notes[i].on_time;
+		off_time[i] = notes[i].off_time;
+		pitch[i] = notes[i].pitch;
+		columns[offset[3] + i] = notes[i].on_vel;
+		columns[offset[4] + i] = notes[i].off_vel;
+		columns[offset[5] + i] = notes[i].channel;
+	}
+	w->add(NATIVE_NOTES, idx, n, &columns[0], columns.size() - 1);
+
+	size_t spans = n == 0 ? 0 : notes.back().on_time / index_span + 1;
+	std::vector<quint32> index(spans + 1);
+	size_t j = 0;
+	for (size_t s = 0; s <= spans; s++) {
+		while (j < n && notes[j].on_time < qint32(s * index_span))
+			j++;
+		index[s] = j;
+	}
+	index[spans] = n;
+	w->add(NATIVE_INDEX, idx, spans, &index[0], index.size() * sizeof(quint32));
+}
+
+vmd_status_t
+native_export(vmd_file_t *file, const char *path, const NativeMap *base, const std::vector<char> *resident)
+{
+	NativeHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, MAGIC, sizeof(MAGIC));
+	h.byte_order = ORDER_MARK;
+	h.version = VERSION;
+	h.division = file->division;
+	h.tracks = file->tracks;
+	h.index_span = std::max(1, 4 * file->division);
+	h.ctrls = VMD_FCTRLS;
+	h.sections = h.ctrls + 3 * file->tracks;
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return VMD_ERROR;
+	setvbuf(f, NULL, _IOFBF, WRITE_BUFFER);
+	NativeWriter w = {f, 0, true, std::vector<NativeSection>()};
+	/* the header and the table are written last, over this */
+	w.pad(align8(sizeof(NativeHeader) + h.sections * sizeof(NativeSection)));
+
+	/* the maps' change points; a paged file has all of them */
+	for (int c = 0; c < VMD_FCTRLS; c++) {
+		std::vector<NativeCtrl> map;
+		for (vmd_time_t t = 0;;) {
+			vmd_time_t next;
+			NativeCtrl p = {qint32(t), vmd_map_get(&file->ctrl[c], t, &next)};
+			map.push_back(p);
+			if (next == VMD_MAX_TIME || next <= t)
+				break;
+			t = next;
+		}
+		w.add(NATIVE_CTRL, c, map.size(), &map[0], map.size() * sizeof(NativeCtrl));
+	}
+
+	for (int i = 0; i < file->tracks; i++)
+		export_track(&w, i, file->track[i], h.index_span, base, resident);
+
+	h.table_checksum = native_checksum(&w.table[0], w.table.size() * sizeof(NativeSection));
+	bool ok = w.ok && fseek(f, 0, SEEK_SET) == 0
+		&& fwrite(&h, sizeof(h), 1, f) == 1
+		&& fwrite(&w.table[0], sizeof(NativeSection), w.table.size(), f) == w.table.size();
+	ok = fclose(f) == 0 && ok;
+	return ok ? VMD_OK : VMD_ERROR;
+}
+
+/* Import */
+
+bool
+native_import_ctrls(vmd_file_t *file, const NativeMap &map)
+{
+	for (quint32 c = 0; c < map.header().ctrls && c < quint32(VMD_FCTRLS); c++) {
+		const NativeSection *s = map.section(NATIVE_CTRL, c);
+		if (s == NULL || s->count > s->size / sizeof(NativeCtrl))
+			return false;
+		const NativeCtrl *ctrl = (const NativeCtrl *)map.data(s);
+		for (quint32 i = 0; i < s->count; i++)
+			vmd_map_set(&file->ctrl[c], ctrl[i].time, ctrl[i].value);
+	}
+	return true;
+}
+
+vmd_track_t *
+native_create_track(vmd_file_t *file, const NativeMap &map, quint32 t)
+{
+	const NativeTrack *nt = map.track(t);
+	if (nt == NULL || file->tracks == VMD_MAX_TRACKS - 1)
+		return NULL;
+
+	vmd_track_t *track = file->track[file->tracks++] = vmd_track_create(file, nt->chanmask);
+	for (quint32 i = 0; i < nt->ctrls && i < VMD_CCTRLS; i++)
+		vmd_track_set_ctrl(track, i, nt->ctrl[i]);
+	if (nt->scale_size > 0) {
+		vmd_notesystem_t ns = track->notesystem;
+		ns.size = nt->scale_size;
+		ns.end_pitch = nt->end_pitch;
+		ns.pitches = (int *)malloc(nt->scale_size * sizeof(*ns.pitches));
+		memcpy(ns.pitches, nt + 1, nt->scale_size * sizeof(*ns.pitches));
+		vmd_track_set_notesystem(track, ns);
+	}
+	size_t name = std::min(strnlen(nt->name, sizeof(nt->name)), sizeof(track->name) - 1);
+	memcpy(track->name, nt->name, name);
+	track->name[name] = 0;
+	return track;
+}
+
+/* like insert_note_data(): vmd_track_insert() doesn't set the channel,
+ * vmd_copy_note() of a note in no track keeps it
+ */
+bool
+native_insert_notes(vmd_track_t *track, const NativeNotes &notes, size_t beg, size_t end,
+                    std::vector<vmd_note_t *> *inserted)
+{
+	for (size_t i = beg; i < end; i++) {
+		vmd_note_t *note;
+		int channel = notes.channel[i];
+		if (channel < 0 || channel >= VMD_CHANNELS) {
+			note = vmd_track_insert(track, notes.on_time[i], notes.off_time[i], notes.pitch[i]);
+			if (note == NULL)
+				return false;
+			note->on_vel = notes.on_vel[i];
+			note->off_vel = notes.off_vel[i];
+		} else {
+			vmd_note_t proto;
+			memset(&proto, 0, sizeof(proto));
+			proto.track = track;
+			proto.channel = &track->file->channel[channel];
+			proto.on_time = notes.on_time[i];
+			proto.off_time = notes.off_time[i];
+			proto.pitch = notes.pitch[i];
+			proto.on_vel = notes.on_vel[i];
+			proto.off_vel = notes.off_vel[i];
+			note = vmd_copy_note(&proto, track, 0, 0);
+			if (note == NULL)
+				return false;
+		}
+		if (inserted != NULL)
+			inserted->push_back(note);
+	}
+	return true;
+}
+
+vmd_status_t
+native_import(vmd_file_t *file, const NativeMap &map)
+{
+	if (!map.native())
+		return VMD_STOP;
+	if (!map.valid())
+		return VMD_ERROR;
+
+	if (!native_import_ctrls(file, map))
+		return VMD_ERROR;
+	file->division = map.header().division;
+	for (quint32 t = 0; t < map.header().tracks; t++) {
+		NativeNotes notes;
+		vmd_track_t *track = native_create_track(file, map, t);
+		if (track == NULL || !map.notes(t, &notes) || !native_insert_notes(track, notes, 0, notes.count))
+			return VMD_ERROR;
+	}
+	return VMD_OK;
+}
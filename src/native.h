@@ -0,0 +1,163 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef NATIVE_H
+#define NATIVE_H
+
+#include <QAtomicInt>
+#include <QFile>
+#include <QString>
+#include <vector>
+#include <vomid.h>
+
+/* Indexed native project format.
+ *
+ * A header and a section table followed by 8-byte aligned sections in
+ * host (little-endian) byte order, so that a mapped file is used as is:
+ * loading validates sizes and checksums instead of parsing. The notes
+ * still have to be inserted into libvomid's trees one by one, as it has
+ * no bulk build; that is why big files are opened through Pager, which
+ * inserts only the notes of the measures in use. The file controller
+ * maps come first, one section each; then each track has a settings
+ * section (controllers, notesystem and name), a notes section holding
+ * one column per note field, sorted by on time, and a time index with
+ * the first note of every span of index_span ticks.
+ */
+
+#define NATIVE_SUFFIX ".vomid"
+
+enum {
+	/* a file controller map; the section's track is the controller */
+	NATIVE_CTRL = 1,
+	NATIVE_TRACK,
+	NATIVE_NOTES,
+	NATIVE_INDEX
+};
+
+enum { NATIVE_MAX_CTRLS = 16, NATIVE_NAME_SIZE = 64 };
+
+struct NativeHeader
+{
+	char magic[8];
+	quint32 byte_order;
+	quint32 version;
+	quint32 division;
+	quint32 tracks;
+	quint32 index_span;
+	quint32 sections;
+	quint32 table_checksum;
+	/* file controller maps */
+	quint32 ctrls;
+};
+
+struct NativeSection
+{
+	quint32 type;
+	quint32 track;
+	quint64 offset;
+	quint64 size;
+	quint32 checksum;
+	quint32 count;
+};
+
+/* count change points */
+struct NativeCtrl
+{
+	qint32 time;
+	qint32 value;
+};
+
+/* followed by scale_size pitches */
+struct NativeTrack
+{
+	quint32 chanmask;
+	quint32 ctrls;
+	qint32 ctrl[NATIVE_MAX_CTRLS];
+	qint32 end_pitch;
+	quint32 scale_size;
+	/* longest note, to start time index lookups early enough */
+	qint32 max_length;
+	quint32 reserved;
+	/* NUL-padded */
+	char name[NATIVE_NAME_SIZE];
+};
+
+/* column views into a notes section */
+struct NativeNotes
+{
+	size_t count;
+	const qint32 *on_time;
+	const qint32 *off_time;
+	const qint32 *pitch;
+	const uchar *on_vel;
+	const uchar *off_vel;
+	/* index into the file's channels, -1 if the note has none */
+	const qint8 *channel;
+};
+
+class NativeMap
+{
+public:
+	explicit NativeMap(const QString &path);
+	~NativeMap();
+
+	/* the file starts like a native one */
+	bool native() const { return native_; }
+	/* the header and the section table are sound */
+	bool valid() const { return valid_; }
+	size_t size() const { return size_; }
+	const NativeHeader &header() const { return *header_; }
+
+	/* NULL if the section is missing or its checksum does not match */
+	const NativeSection *section(quint32 type, quint32 track) const;
+	const uchar *data(const NativeSection *s) const { return data_ + s->offset; }
+
+	const NativeTrack *track(quint32) const;
+	bool notes(quint32 track, NativeNotes *) const;
+	/* first note of each index span, count + 1 entries */
+	const quint32 *index(quint32 track, size_t *count) const;
+
+private:
+	QFile file_;
+	const uchar *data_;
+	size_t size_;
+	bool native_;
+	bool valid_;
+	const NativeHeader *header_;
+	const NativeSection *table_;
+	/* per section, set once its checksum matched; sections are looked
+	 * up from the GUI and the saver thread alike
+	 */
+	QAtomicInt *verified_;
+};
+
+quint32 native_checksum(const void *, size_t);
+
+/* lays out the columns of a notes section of n notes; returns its size */
+size_t native_notes_layout(size_t n, size_t offset[6]);
+
+/* Exports the file. If it is paged in from base, the notes of the
+ * pages that are not resident are taken from there.
+ */
+vmd_status_t native_export(vmd_file_t *, const char *path,
+                           const NativeMap *base = NULL, const std::vector<char> *resident = NULL);
+
+/* Sets the file controller maps. */
+bool native_import_ctrls(vmd_file_t *, const NativeMap &);
+
+/* Creates the vmd track for a native track, with its settings but
+ * without notes, which are inserted separately like with SMF. The
+ * inserted notes are appended to *inserted, also when one fails.
+ */
+vmd_track_t *native_create_track(vmd_file_t *, const NativeMap &, quint32 track);
+bool native_insert_notes(vmd_track_t *, const NativeNotes &, size_t beg, size_t end,
+                         std::vector<vmd_note_t *> *inserted = NULL);
+
+/* Imports a mapped file into an initialized vmd_file_t. Returns
+ * VMD_STOP if the file is not in the native format and VMD_ERROR if it
+ * is damaged.
+ */
+vmd_status_t native_import(vmd_file_t *, const NativeMap &);
+
+#endif /* NATIVE_H */
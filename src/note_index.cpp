@@ -0,0 +1,214 @@
+#include <algorithm>
+#include "note_index.h"
+
+static bool
+note_less(const vmd_note_t *a, const vmd_note_t *b)
+{
+	return a->on_time < b->on_time;
+}
+
+NoteIndex::NoteIndex(vmd_track_t *_track)
+	:track_(_track),
+	size_(0)
+{
+	vmd_pitch_t min_pitch = 0, max_pitch = 0;
+	vmd_time_t prev_on = 0;
+	bool in_order = true;
+	VMD_BST_FOREACH(vmd_bst_node_t *i, &track_->notes) {
+		vmd_note_t *n = vmd_track_note(i);
+		if (size_ == 0 || n->pitch < min_pitch)
+			min_pitch = n->pitch;
+		if (size_ == 0 || n->pitch > max_pitch)
+			max_pitch = n->pitch;
+		if (size_ > 0 && n->on_time < prev_on)
+			in_order = false;
+		prev_on = n->on_time;
+		size_++;
+	}
+
+	on_time_.resize(size_);
+	off_time_.resize(size_);
+	max_off_time_.resize(size_);
+	velocity_.resize(size_);
+	off_velocity_.resize(size_);
+	channel_.resize(size_);
+	notes_.resize(size_);
+	if (size_ == 0)
+		return;
+
+	/* the notes by on_time, if the tree doesn't yield them so */
+	std::vector<vmd_note_t *> sorted;
+	if (!in_order) {
+		VMD_BST_FOREACH(vmd_bst_node_t *i, &track_->notes)
+			sorted.push_back(vmd_track_note(i));
+		std::stable_sort(sorted.begin(), sorted.end(), note_less);
+	}
+
+	/* counting sort by pitch; notes come by on_time, and placing
+	 * them is stable, so buckets come out sorted
+	 */
+	std::vector<size_t> counts(max_pitch - min_pitch + 1, 0);
+	VMD_BST_FOREACH(vmd_bst_node_t *i, &track_->notes)
+		counts[vmd_track_note(i)->pitch - min_pitch]++;
+
+	size_t begin = 0;
+	for (size_t p = 0; p < counts.size(); p++) {
+		if (counts[p] == 0)
+			continue;
+		Bucket b = {vmd_pitch_t(min_pitch + p), begin, begin + counts[p], 0, 0, false};
+		buckets_.push_back(b);
+		begin += counts[p];
+		/* now the next free slot of the pitch */
+		counts[p] = b.begin;
+	}
+
+	vmd_bst_node_t *node = in_order ? vmd_bst_begin(&track_->notes) : NULL;
+	for (size_t i = 0; i < size_; i++) {
+		vmd_note_t *n;
+		if (in_order) {
+			n = vmd_track_note(node);
+			node = vmd_bst_next(node);
+		} else
+			n = sorted[i];
+		size_t j = counts[n->pitch - min_pitch]++;
+		on_time_[j] = n->on_time;
+		off_time_[j] = n->off_time;
+		velocity_[j] = n->on_vel;
+		off_velocity_[j] = n->off_vel;
+		channel_[j] = n->channel != NULL ? int(n->channel - track_->file->channel) : -1;
+		notes_[j] = n;
+	}
+
+	for (size_t i = 0; i < buckets_.size(); i++) {
+		Bucket &b = buckets_[i];
+		vmd_time_t max_off = off_time_[b.begin];
+		for (size_t j = b.begin; j < b.end; j++) {
+			if (j > b.begin && (off_time_[j] < max_off || on_time_[j] < off_time_[j - 1]))
+				b.overlapping = true;
+			max_off = std::max(max_off, off_time_[j]);
+			max_off_time_[j] = max_off;
+		}
+		b.time_beg = on_time_[b.begin];
+		b.time_end = max_off;
+	}
+}
+
+static bool
+bucket_pitch_less(const NoteIndex::Bucket &b, vmd_pitch_t p)
+{
+	return b.pitch < p;
+}
+
+NoteIndex::Run
+NoteIndex::run(size_t beg, size_t end, vmd_pitch_t pitch) const
+{
+	Run ret = {
+		pitch,
+		end - beg,
+		&on_time_[0] + beg,
+		&off_time_[0] + beg,
+		&velocity_[0] + beg,
+		&off_velocity_[0] + beg,
+		&channel_[0] + beg,
+		&notes_[0] + beg
+	};
+	return ret;
+}
+
+void
+NoteIndex::bucket_runs(const Bucket &b, vmd_time_t time_beg, vmd_time_t time_end, std::vector<Run> &ret) const
+{
+	if (b.time_end <= time_beg || b.time_beg >= time_end)
+		return;
+
+	/* the first entry reaching past time_beg, the first starting at time_end */
+	const vmd_time_t *max_off = &max_off_time_[0];
+	const vmd_time_t *on = &on_time_[0];
+	size_t beg = std::upper_bound(max_off + b.begin, max_off + b.end, time_beg) - max_off;
+	size_t end = std::lower_bound(on + beg, on + b.end, time_end) - on;
+	if (!b.overlapping) {
+		if (beg < end)
+			ret.push_back(run(beg, end, b.pitch));
+		return;
+	}
+
+	/* leave out the notes held shorter than some before them */
+	while (beg < end) {
+		while (beg < end && off_time_[beg] <= time_beg)
+			beg++;
+		size_t i = beg;
+		while (i < end && off_time_[i] > time_beg)
+			i++;
+		if (beg < i)
+			ret.push_back(run(beg, i, b.pitch));
+		beg = i;
+	}
+}
+
+void
+NoteIndex::runs(vmd_time_t time_beg, vmd_time_t time_end,
+                vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+                std::vector<Run> &ret) const
+{
+	std::vector<Bucket>::const_iterator b = std::lower_bound(
+		buckets_.begin(), buckets_.end(), pitch_beg, bucket_pitch_less);
+	for (; b != buckets_.end() && b->pitch < pitch_end; ++b)
+		bucket_runs(*b, time_beg, time_end, ret);
+}
+
+void *
+NoteIndex::for_range(vmd_time_t time_beg, vmd_time_t time_end,
+                     vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+                     callback_t clb, void *arg) const
+{
+	std::vector<Bucket>::const_iterator b = std::lower_bound(
+		buckets_.begin(), buckets_.end(), pitch_beg, bucket_pitch_less);
+	std::vector<Run> runs;
+	for (; b != buckets_.end() && b->pitch < pitch_end; ++b) {
+		runs.clear();
+		bucket_runs(*b, time_beg, time_end, runs);
+		for (size_t i = 0; i < runs.size(); i++) {
+			for (size_t j = 0; j < runs[i].size; j++) {
+				if (void *ret = clb(runs[i].notes[j], arg))
+					return ret;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *
+push_note(vmd_note_t *note, void *_notes)
+{
+	static_cast<std::vector<vmd_note_t *> *>(_notes)->push_back(note);
+	return NULL;
+}
+
+void
+NoteIndex::collect(vmd_time_t time_beg, vmd_time_t time_end,
+                   vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+                   std::vector<vmd_note_t *> &notes) const
+{
+	for_range(time_beg, time_end, pitch_beg, pitch_end, push_note, &notes);
+}
+
+static void *
+first_note(vmd_note_t *note, void *)
+{
+	return note;
+}
+
+vmd_note_t *
+NoteIndex::at(vmd_time_t time, vmd_pitch_t pitch) const
+{
+	return (vmd_note_t *)for_range(time, time + 1, pitch, pitch + 1, first_note, NULL);
+}
+
+size_t
+NoteIndex::memory() const
+{
+	return sizeof(*this) + buckets_.capacity() * sizeof(Bucket)
+		+ (on_time_.capacity() + off_time_.capacity() + max_off_time_.capacity()) * sizeof(vmd_time_t)
+		+ (velocity_.capacity() + off_velocity_.capacity() + channel_.capacity()) * sizeof(int)
+		+ notes_.capacity() * sizeof(vmd_note_t *);
+}
@@ -0,0 +1,105 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef NOTE_INDEX_H
+#define NOTE_INDEX_H
+
+#include <vector>
+#include <vomid.h>
+
+/* Time x pitch index of a track's notes.
+ *
+ * Notes are bucketed by pitch, and sorted by on_time inside a bucket.
+ * libvomid keeps notes of one pitch from overlapping, so their off_time
+ * is sorted as well, and the notes of a bucket sounding in a time range
+ * are a slice found by two binary searches. Buckets also know their
+ * time span, so a query skips pitches without notes in its range in
+ * constant time: O(log P + P' + sum of log n_p + k) for P pitches in
+ * the range, P' of them with hits. Should a bucket overlap all the same,
+ * its entries carry the running maximum of off_time and the slice is
+ * split around the notes that ended. Empty pitches take no space.
+ * All buckets share one set of parallel arrays (times, velocities,
+ * channel and the note itself), so building an index takes a few
+ * allocations however many pitches are used, and read-only scans
+ * through runs() touch only the fields they use.
+ *
+ * The index is a snapshot: it is valid until the track is modified.
+ * File keeps one per track and rebuilds it after any edit, commit or
+ * undo.
+ */
+class NoteIndex
+{
+public:
+	typedef void *(*callback_t)(vmd_note_t *, void *);
+
+	explicit NoteIndex(vmd_track_t *);
+
+	vmd_track_t *track() const { return track_; }
+	size_t size() const { return size_; }
+	/* bytes taken by the index */
+	size_t memory() const;
+
+	/* Same contract as vmd_track_for_range(): notes sounding in
+	 * [time_beg, time_end) with pitch in [pitch_beg, pitch_end).
+	 * Iteration stops at the first non-NULL value returned by clb.
+	 */
+	void *for_range(vmd_time_t time_beg, vmd_time_t time_end,
+	                vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+	                callback_t clb, void *arg) const;
+
+	/* appends the notes of the range to the vector */
+	void collect(vmd_time_t time_beg, vmd_time_t time_end,
+	             vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+	             std::vector<vmd_note_t *> &) const;
+
+	vmd_note_t *at(vmd_time_t, vmd_pitch_t) const;
+
+	/* Notes of one pitch sounding in a time range, sorted by on_time,
+	 * as parallel arrays.
+	 */
+	struct Run
+	{
+		vmd_pitch_t pitch;
+		size_t size;
+		const vmd_time_t *on_time, *off_time;
+		const int *velocity, *off_velocity;
+		/* into the file's channels */
+		const int *channel;
+		vmd_note_t *const *notes;
+	};
+
+	/* appends the runs of the range to the vector, by pitch; a pitch
+	 * has more than one only if its notes overlap
+	 */
+	void runs(vmd_time_t time_beg, vmd_time_t time_end,
+	          vmd_pitch_t pitch_beg, vmd_pitch_t pitch_end,
+	          std::vector<Run> &) const;
+
+	struct Bucket
+	{
+		vmd_pitch_t pitch;
+		/* of the bucket's entries */
+		size_t begin, end;
+		/* first on_time, last off_time */
+		vmd_time_t time_beg, time_end;
+		bool overlapping;
+	};
+
+private:
+	Run run(size_t beg, size_t end, vmd_pitch_t) const;
+	void bucket_runs(const Bucket &, vmd_time_t time_beg, vmd_time_t time_end, std::vector<Run> &) const;
+
+	vmd_track_t *track_;
+	size_t size_;
+	std::vector<Bucket> buckets_;
+	std::vector<vmd_time_t> on_time_, off_time_;
+	/* running maximum of off_time inside a bucket; off_time itself
+	 * unless the bucket overlaps
+	 */
+	std::vector<vmd_time_t> max_off_time_;
+	std::vector<int> velocity_, off_velocity_, channel_;
+	std::vector<vmd_note_t *> notes_;
+};
+
+#endif /* NOTE_INDEX_H */
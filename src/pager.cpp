@@ -0,0 +1,170 @@
+#include <algorithm>
+#include "pager.h"
+
+Pager::Pager(vmd_file_t *_file, NativeMap *_map)
+	:file_(_file),
+	map_(_map),
+	tracks_(0),
+	pages_(0),
+	page_size_(1),
+	max_length_(0),
+	resident_notes_(0),
+	clock_(0)
+{
+}
+
+Pager::~Pager()
+{
+	delete map_;
+}
+
+bool
+Pager::init()
+{
+	if (!map_->valid())
+		return false;
+
+	if (!native_import_ctrls(file_, *map_))
+		return false;
+	file_->division = map_->header().division;
+	page_size_ = map_->header().index_span;
+	tracks_ = map_->header().tracks;
+	for (int t = 0; t < tracks_; t++) {
+		size_t spans;
+		NativeNotes notes;
+		if (native_create_track(file_, *map_, t) == NULL || !map_->notes(t, &notes) || map_->index(t, &spans) == NULL)
+			return false;
+		pages_ = std::max(pages_, int(spans));
+		max_length_ = std::max(max_length_, vmd_time_t(map_->track(t)->max_length));
+	}
+
+	Page empty = {false, false, 0, 0};
+	page_.assign(pages_, empty);
+	for (int t = 0; t < tracks_; t++) {
+		size_t spans;
+		const quint32 *index = map_->index(t, &spans);
+		for (size_t p = 0; p < spans; p++)
+			page_[p].notes += index[p + 1] - index[p];
+	}
+	return true;
+}
+
+int
+Pager::page_at(vmd_time_t time) const
+{
+	if (time < 0)
+		return 0;
+	return std::min(time / page_size_, vmd_time_t(pages_ - 1));
+}
+
+void
+Pager::set_resident(int p, bool resident)
+{
+	if (page_[p].resident == resident)
+		return;
+	page_[p].resident = resident;
+	if (resident)
+		resident_notes_ += page_[p].notes;
+	else
+		resident_notes_ -= page_[p].notes;
+}
+
+bool
+Pager::complete() const
+{
+	for (int p = 0; p < pages_; p++) {
+		if (!page_[p].resident)
+			return false;
+	}
+	return true;
+}
+
+std::vector<char>
+Pager::residency() const
+{
+	std::vector<char> ret(pages_);
+	for (int p = 0; p < pages_; p++)
+		ret[p] = page_[p].resident;
+	return ret;
+}
+
+void
+Pager::set_residency(const std::vector<char> &resident)
+{
+	for (int p = 0; p < pages_; p++)
+		set_resident(p, p < int(resident.size()) && resident[p]);
+}
+
+bool
+Pager::load(int p)
+{
+	std::vector<vmd_note_t *> inserted;
+	bool ok = true;
+	for (int t = 0; t < tracks_ && ok; t++) {
+		size_t spans;
+		NativeNotes notes;
+		const quint32 *index = map_->index(t, &spans);
+		ok = index != NULL && map_->notes(t, &notes);
+		if (!ok || size_t(p) >= spans)
+			continue;
+		ok = index[p] <= index[p + 1] && index[p + 1] <= notes.count
+			&& native_insert_notes(file_->track[t], notes, index[p], index[p + 1], &inserted);
+	}
+	if (!ok) {
+		/* all or nothing, so that loading it again doesn't double notes */
+		for (size_t i = 0; i < inserted.size(); i++)
+			vmd_erase_note(inserted[i]);
+		return false;
+	}
+	set_resident(p, true);
+	return true;
+}
+
+struct EvictArg
+{
+	vmd_time_t beg, end;
+	std::vector<vmd_note_t *> notes;
+};
+
+static void *
+evict_clb(vmd_note_t *note, void *_arg)
+{
+	EvictArg *arg = (EvictArg *)_arg;
+	if (arg->beg <= note->on_time && note->on_time < arg->end)
+		arg->notes.push_back(note);
+	return NULL;
+}
+
+void
+Pager::evict(int p)
+{
+	EvictArg arg;
+	arg.beg = p * page_size_;
+	arg.end = arg.beg + page_size_;
+	for (int t = 0; t < tracks_; t++) {
+		arg.notes.clear();
+		vmd_track_for_range(file_->track[t], arg.beg, arg.end, evict_clb, &arg);
+		for (size_t i = 0; i < arg.notes.size(); i++)
+			vmd_erase_note(arg.notes[i]);
+	}
+	set_resident(p, false);
+}
+
+bool
+Pager::trim(size_t budget, unsigned keep_since)
+{
+	bool ret = false;
+	while (resident_notes_ > budget) {
+		int victim = -1;
+		for (int p = 0; p < pages_; p++) {
+			if (page_[p].resident && !page_[p].pinned && page_[p].used <= keep_since
+			 && (victim < 0 || page_[p].used < page_[victim].used))
+				victim = p;
+		}
+		if (victim < 0)
+			break;
+		evict(victim);
+		ret = true;
+	}
+	return ret;
+}
@@ -0,0 +1,80 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <vector>
+#include <vomid.h>
+#include "native.h"
+
+/* Pages notes of a mapped native file in and out of a vmd_file_t.
+ *
+ * A page is one span of the file's time index across all tracks; its
+ * notes are those starting in the span. The file gets its tracks and
+ * tempo map up front and the notes of a page when it is loaded, so the
+ * usual track API sees exactly the loaded notes. The pager only keeps
+ * the books; when loading and evicting is allowed is up to the owner.
+ */
+class Pager
+{
+public:
+	/* takes ownership of the map */
+	Pager(vmd_file_t *, NativeMap *);
+	~Pager();
+
+	/* creates the tracks; false if the file is damaged */
+	bool init();
+
+	const NativeMap &map() const { return *map_; }
+	int pages() const { return pages_; }
+	vmd_time_t page_size() const { return page_size_; }
+	/* of the longest note, which may reach into later pages */
+	vmd_time_t max_length() const { return max_length_; }
+	int page_at(vmd_time_t) const;
+
+	bool resident(int page) const { return page_[page].resident; }
+	void set_resident(int page, bool);
+	/* residency of all pages, for native_export() and revisions */
+	std::vector<char> residency() const;
+	void set_residency(const std::vector<char> &);
+	/* an edited page can't be evicted: loading it again would bring
+	 * back the notes from before the edit
+	 */
+	void pin(int page) { page_[page].pinned = true; }
+	size_t resident_notes() const { return resident_notes_; }
+	bool complete() const;
+
+	void use(int page) { page_[page].used = ++clock_; }
+	/* false if the page is damaged; it is then left out entirely */
+	bool load(int page);
+	void evict(int page);
+	/* evicts the least recently used pages until the budget is met,
+	 * except those used since the given stamp; returns whether any page
+	 * was evicted
+	 */
+	bool trim(size_t budget, unsigned keep_since);
+	unsigned clock() const { return clock_; }
+
+private:
+	struct Page
+	{
+		bool resident;
+		bool pinned;
+		unsigned used;
+		size_t notes;
+	};
+
+	vmd_file_t *file_;
+	NativeMap *map_;
+	int tracks_;
+	int pages_;
+	vmd_time_t page_size_;
+	vmd_time_t max_length_;
+	std::vector<Page> page_;
+	size_t resident_notes_;
+	unsigned clock_;
+};
+
+#endif /* PAGER_H */
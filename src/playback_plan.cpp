@@ -0,0 +1,868 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "playback_plan.h"
+#include "trace.h"
+
+static const int CHANNELS = 16;
+static const int DRUM_CHANNEL = 9;
+static const int NO_BEND = -1;
+static const int KEYS = 128;
+/* pitches are kept in MTS units, 1/16384 of a semitone */
+static const int SEMITONE = 1 << 14;
+/* per bend unit, for a range of two semitones */
+static const int BEND_STEP = 2 * SEMITONE / 8192;
+/* keys per tuning message, well within common SysEx buffers */
+static const int RETUNES_PER_MESSAGE = 32;
+/* the program, then the controllers */
+static const int SETUP_SLOTS = 129;
+static const int PROGRAM_SLOT = 0;
+static const int RESET_CONTROLLERS = 121;
+/* retuned instead of the default program 0, which the drum channel and
+ * other devices' channels may share
+ */
+static const int TUNING_PROGRAM = 1;
+
+static int
+clamp_pitch(int p)
+{
+	return std::max(0, std::min(p, KEYS * SEMITONE - 1));
+}
+
+/* of a note, as bent by libvomid; close enough to tell the notes
+ * starting together apart
+ */
+static int
+note_pitch(int key, int bend)
+{
+	return clamp_pitch(key * SEMITONE + (bend == NO_BEND ? 0 : (bend - 8192) * BEND_STEP));
+}
+
+/* notesystem units per semitone, from libvomid's own twelve-tone table */
+static double
+notesystem_semitone()
+{
+	vmd_notesystem_t tet = vmd_notesystem_tet(12);
+	double ret = tet.pitches[1] - tet.pitches[0];
+	free(tet.pitches);
+	return ret;
+}
+
+/* Of a track's pitch, exactly as its notesystem tunes it: step p % size
+ * of octave p / size, an octave spanning twelve keys from key 0.
+ */
+static int
+notesystem_pitch(const vmd_notesystem_t &ns, vmd_pitch_t p, double semitone)
+{
+	int octave = p / ns.size, step = p % ns.size;
+	double keys = octave * 12 + ns.pitches[step] / semitone;
+	return clamp_pitch(int(keys * SEMITONE + 0.5));
+}
+
+static int
+ctrl_slot(int ctrl)
+{
+	return 1 + ctrl;
+}
+
+/* Controllers that act as a sequence rather than a state: parameter
+ * numbers with their data entry, and channel mode messages. They are
+ * passed on in order, and not compared between channels.
+ */
+static bool
+sequenced(int ctrl)
+{
+	return ctrl == 6 || ctrl == 38 || (ctrl >= 96 && ctrl <= 101) || ctrl >= 120;
+}
+
+/* into ev, which takes 3 bytes; returns the size */
+static size_t
+setup_event(unsigned char *ev, int c, int slot, int value)
+{
+	if (slot == PROGRAM_SLOT) {
+		ev[0] = 0xC0 | c;
+		ev[1] = value;
+		return 2;
+	}
+	ev[0] = 0xB0 | c;
+	ev[1] = slot - 1;
+	ev[2] = value;
+	return 3;
+}
+
+/* a real-time single note tuning change */
+static void
+retune_message(std::vector<unsigned char> *ev, const int *keys, size_t n, const int *key_pitch)
+{
+	unsigned char head[] = {0xF0, 0x7F, 0x7F, 0x08, 0x02, TUNING_PROGRAM, (unsigned char)n};
+	ev->assign(head, head + sizeof(head));
+	for (size_t i = 0; i < n; i++) {
+		int k = keys[i], p = key_pitch[k];
+		ev->push_back(k);
+		ev->push_back(p / SEMITONE);
+		ev->push_back((p % SEMITONE) >> 7);
+		ev->push_back(p & 0x7F);
+	}
+	ev->push_back(0xF7);
+}
+
+struct PlanChannel
+{
+	/* program and controllers as sent, -1 if never */
+	int setup[SETUP_SLOTS];
+	/* program and controllers the input asks for */
+	int want[SETUP_SLOTS];
+	/* pitch bend the input asks for, and the one sent */
+	int want_bend, bend;
+	/* notes sounding on the channel, by key and by input channel */
+	unsigned char keys[128];
+	int notes, carried[CHANNELS];
+	/* output channels of this input channel's notes, by key, oldest first */
+	std::vector<signed char> routes[128];
+	/* when a note last started */
+	unsigned long used;
+};
+
+/* a note of the tracks, to tell which one libvomid plays */
+struct TrackNote
+{
+	vmd_time_t on_time;
+	/* -1 if not known */
+	int channel;
+	int pitch;
+	bool taken;
+};
+
+static bool
+track_note_less(const TrackNote &a, const TrackNote &b)
+{
+	return a.on_time < b.on_time;
+}
+
+struct PlanRender
+{
+	PlaybackPlan *plan;
+	PlanChannel channels[CHANNELS];
+	vmd_time_t time;
+	unsigned long serial;
+
+	/* MTS: the pitch each key is tuned to, the notes sounding on it
+	 * over all channels, and when it last started one
+	 */
+	int key_pitch[KEYS];
+	int key_notes[KEYS];
+	unsigned long key_used[KEYS];
+	/* by on_time */
+	std::vector<TrackNote> track_notes;
+
+	PlanRender(PlaybackPlan *_plan)
+		:plan(_plan),
+		time(0),
+		serial(0)
+	{
+		for (int k = 0; k < KEYS; k++) {
+			key_pitch[k] = k * SEMITONE;
+			key_notes[k] = 0;
+			key_used[k] = 0;
+		}
+		for (int c = 0; c < CHANNELS; c++) {
+			PlanChannel &ch = channels[c];
+			std::fill(ch.setup, ch.setup + SETUP_SLOTS, -1);
+			std::fill(ch.want, ch.want + SETUP_SLOTS, -1);
+			ch.want_bend = ch.bend = NO_BEND;
+			memset(ch.keys, 0, sizeof(ch.keys));
+			ch.notes = 0;
+			std::fill(ch.carried, ch.carried + CHANNELS, 0);
+			ch.used = 0;
+		}
+	}
+
+	void output(const unsigned char *ev, size_t size)
+	{
+		PlaybackPlan::Step s = {0, 0, (unsigned)size};
+		plan->data_.insert(plan->data_.end(), ev, ev + size);
+		plan->steps_.push_back(s);
+		PlaybackPlan::count(&plan->output_, ev, size);
+	}
+
+	void delay(vmd_time_t dtime, int tempo)
+	{
+		PlaybackPlan::Step s = {dtime, tempo, 0};
+		plan->steps_.push_back(s);
+		time += dtime;
+	}
+
+	/* whether c is set up as the input channel from asks */
+	bool matches(int c, int from) const
+	{
+		return memcmp(channels[c].setup, channels[from].want, sizeof(channels[c].setup)) == 0;
+	}
+
+	/* whether notes of input channels other than from sound on c */
+	bool shared(int c, int from) const
+	{
+		for (int x = 0; x < CHANNELS; x++) {
+			if (x != from && channels[c].carried[x] > 0)
+				return true;
+		}
+		return false;
+	}
+
+	/* whether setting the slot on c leaves the notes of other input
+	 * channels sounding there as their inputs ask
+	 */
+	bool compatible(int c, int from, int slot, int value) const
+	{
+		for (int x = 0; x < CHANNELS; x++) {
+			if (x != from && channels[c].carried[x] > 0 && channels[x].want[slot] != value)
+				return false;
+		}
+		return true;
+	}
+
+	bool fits(int c, int from, int key, int bend) const
+	{
+		return c != DRUM_CHANNEL && channels[c].bend == bend && channels[c].keys[key] == 0
+			&& matches(c, from);
+	}
+
+	int choose(int from, int key)
+	{
+		int bend = channels[from].want_bend;
+		if (fits(from, from, key, bend))
+			return from;
+
+		/* least recently used first, to let notes ring out */
+		int best = -1;
+		for (int c = 0; c < CHANNELS; c++) {
+			if (fits(c, from, key, bend) && (best < 0 || channels[c].used < channels[best].used))
+				best = c;
+		}
+		if (best >= 0)
+			return best;
+
+		/* a silent channel to retune and set up, preferably one
+		 * set up already
+		 */
+		if (channels[from].notes == 0)
+			return from;
+		bool best_matches = false;
+		for (int c = 0; c < CHANNELS; c++) {
+			if (c == DRUM_CHANNEL || channels[c].notes != 0)
+				continue;
+			bool m = matches(c, from);
+			if (best < 0 || (m && !best_matches)
+			    || (m == best_matches && channels[c].used < channels[best].used)) {
+				best = c;
+				best_matches = m;
+			}
+		}
+		return best >= 0 ? best : from;
+	}
+
+	void send_setup(int c, int slot, int value)
+	{
+		unsigned char ev[3];
+		output(ev, setup_event(ev, c, slot, value));
+		channels[c].setup[slot] = value;
+	}
+
+	void sync_slot(int c, int from, int slot)
+	{
+		int value = channels[from].want[slot];
+		if (value >= 0 && channels[c].setup[slot] != value && compatible(c, from, slot, value))
+			send_setup(c, slot, value);
+	}
+
+	/* brings c to the program and controllers from asks for, as far
+	 * as the notes of other input channels on c allow
+	 */
+	void sync(int c, int from)
+	{
+		/* bank select before the program */
+		sync_slot(c, from, ctrl_slot(0));
+		sync_slot(c, from, ctrl_slot(32));
+		sync_slot(c, from, PROGRAM_SLOT);
+		for (int ctrl = 1; ctrl < 128; ctrl++) {
+			if (ctrl != 32)
+				sync_slot(c, from, ctrl_slot(ctrl));
+		}
+	}
+
+	void retune(const std::vector<int> &keys)
+	{
+		std::vector<unsigned char> ev;
+		for (size_t i = 0; i < keys.size(); i += RETUNES_PER_MESSAGE) {
+			size_t n = std::min(keys.size() - i, size_t(RETUNES_PER_MESSAGE));
+			retune_message(&ev, &keys[i], n, key_pitch);
+			output(&ev[0], ev.size());
+		}
+	}
+
+	/* selects the retuned program on all channels but the drums, by
+	 * RPN 3, and deselects the parameter again
+	 */
+	void select_tuning()
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			if (c == DRUM_CHANNEL)
+				continue;
+			unsigned char ev[][3] = {{101, 0}, {100, 3}, {6, TUNING_PROGRAM}, {101, 127}, {100, 127}};
+			for (size_t i = 0; i < sizeof(ev) / sizeof(ev[0]); i++) {
+				unsigned char cc[3] = {(unsigned char)(0xB0 | c), ev[i][0], ev[i][1]};
+				output(cc, sizeof(cc));
+			}
+		}
+	}
+
+	/* the pitches of the tracks' notes, as their notesystems tune them */
+	void collect(vmd_file_t *file)
+	{
+		double semitone = notesystem_semitone();
+		for (int t = 0; t < file->tracks; t++) {
+			vmd_track_t *track = file->track[t];
+			const vmd_notesystem_t &ns = track->notesystem;
+			if (track->chanmask == VMD_CHANMASK_DRUMS)
+				continue;
+			VMD_BST_FOREACH(vmd_bst_node_t *i, &track->notes) {
+				vmd_note_t *n = vmd_track_note(i);
+				int c = n->channel != NULL ? int(n->channel - file->channel) : -1;
+				if (c == DRUM_CHANNEL)
+					continue;
+				int p = ns.size > 0 && ns.pitches != NULL ? notesystem_pitch(ns, n->pitch, semitone)
+					: clamp_pitch(n->pitch * SEMITONE);
+				TrackNote tn = {n->on_time, c, p, false};
+				track_notes.push_back(tn);
+			}
+		}
+		std::stable_sort(track_notes.begin(), track_notes.end(), track_note_less);
+	}
+
+	/* the distinct pitches played; empty if there are more than keys */
+	std::vector<int> pitches() const
+	{
+		std::vector<int> ret;
+		for (size_t i = 0; i < track_notes.size(); i++)
+			ret.push_back(track_notes[i].pitch);
+		std::sort(ret.begin(), ret.end());
+		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+		if (ret.size() > size_t(KEYS))
+			ret.clear();
+		return ret;
+	}
+
+	/* The pitch of the track note an input note plays: of the notes
+	 * starting now, the one nearest the bent pitch, on the input's
+	 * channel if that is known. The bent pitch if none is within a
+	 * semitone of it.
+	 */
+	int exact_pitch(int from, int bent)
+	{
+		TrackNote now = {time, 0, 0, false};
+		std::vector<TrackNote>::iterator i = std::lower_bound(
+			track_notes.begin(), track_notes.end(), now, track_note_less);
+		std::vector<TrackNote>::iterator best = track_notes.end();
+		int best_score = 0;
+		for (; i != track_notes.end() && i->on_time == time; ++i) {
+			int d = abs(i->pitch - bent);
+			if (i->taken || d > SEMITONE)
+				continue;
+			int score = d + (i->channel == from || i->channel < 0 ? 0 : 2 * SEMITONE);
+			if (best == track_notes.end() || score < best_score) {
+				best = i;
+				best_score = score;
+			}
+		}
+		if (best == track_notes.end())
+			return bent;
+		best->taken = true;
+		return best->pitch;
+	}
+
+	/* gives each of at most KEYS pitches, sorted, a key near its own;
+	 * all keys are sent, as the synth may keep an earlier tuning
+	 */
+	void tune_all(const std::vector<int> &pitches)
+	{
+		int n = pitches.size(), prev = -1;
+		for (int i = 0; i < n; i++) {
+			int k = (pitches[i] + SEMITONE / 2) / SEMITONE;
+			k = std::min(std::max(k, prev + 1), KEYS - (n - i));
+			key_pitch[k] = pitches[i];
+			prev = k;
+		}
+		std::vector<int> keys(KEYS);
+		for (int k = 0; k < KEYS; k++)
+			keys[k] = k;
+		retune(keys);
+	}
+
+	/* a key tuned to the pitch, retuning a silent one if need be */
+	int mts_key(int pitch)
+	{
+		int nominal = std::min((pitch + SEMITONE / 2) / SEMITONE, KEYS - 1);
+		if (key_pitch[nominal] == pitch)
+			return nominal;
+		int best = -1;
+		for (int k = 0; k < KEYS; k++) {
+			if (key_pitch[k] == pitch)
+				return k;
+			if (key_notes[k] == 0 && (best < 0 || key_used[k] < key_used[best]
+			    || (key_used[k] == key_used[best] && abs(k - nominal) < abs(best - nominal))))
+				best = k;
+		}
+		/* all keys sounding; play it out of tune */
+		if (best < 0)
+			return nominal;
+		key_pitch[best] = pitch;
+		retune(std::vector<int>(1, best));
+		return best;
+	}
+
+	void mts_note_on(int from, int key, int vel)
+	{
+		int k = mts_key(exact_pitch(from, note_pitch(key, channels[from].want_bend)));
+		unsigned char ev[3] = {(unsigned char)(0x90 | from), (unsigned char)k, (unsigned char)vel};
+		output(ev, sizeof(ev));
+		key_notes[k]++;
+		key_used[k] = ++serial;
+		channels[from].routes[key].push_back(k);
+	}
+
+	void mts_note_off(int from, int key, int vel)
+	{
+		std::vector<signed char> &routes = channels[from].routes[key];
+		if (routes.empty())
+			return;
+		int k = routes.front();
+		routes.erase(routes.begin());
+		unsigned char ev[3] = {(unsigned char)(0x80 | from), (unsigned char)k, (unsigned char)vel};
+		output(ev, sizeof(ev));
+		key_notes[k]--;
+	}
+
+	void note_on(int from, int key, int vel)
+	{
+		int c = choose(from, key);
+		PlanChannel &ch = channels[c];
+		sync(c, from);
+		int bend = channels[from].want_bend;
+		if (ch.bend != bend) {
+			/* back to the center for inputs that never bent */
+			int value = bend == NO_BEND ? 8192 : bend;
+			unsigned char ev[3] = {(unsigned char)(0xE0 | c), (unsigned char)(value & 0x7F), (unsigned char)(value >> 7)};
+			output(ev, sizeof(ev));
+			ch.bend = bend;
+		}
+		unsigned char ev[3] = {(unsigned char)(0x90 | c), (unsigned char)key, (unsigned char)vel};
+		output(ev, sizeof(ev));
+		ch.keys[key]++;
+		ch.notes++;
+		ch.carried[from]++;
+		ch.used = ++serial;
+		channels[from].routes[key].push_back(c);
+	}
+
+	void note_off(int from, int key, int vel)
+	{
+		std::vector<signed char> &routes = channels[from].routes[key];
+		if (routes.empty())
+			return;
+		int c = routes.front();
+		routes.erase(routes.begin());
+		PlanChannel &ch = channels[c];
+		unsigned char ev[3] = {(unsigned char)(0x80 | c), (unsigned char)key, (unsigned char)vel};
+		output(ev, sizeof(ev));
+		ch.keys[key]--;
+		ch.notes--;
+		ch.carried[from]--;
+	}
+
+	/* Programs and controllers also go to the channels carrying the
+	 * input channel's notes, so those follow it, but not where they
+	 * would change notes of other input channels sounding there; such
+	 * a channel is set up again when a note of the input is next put
+	 * on it.
+	 */
+	void channel_setup(int from, const unsigned char *ev, size_t size)
+	{
+		bool program = (ev[0] & 0xF0) == 0xC0;
+		if (size != (program ? 2u : 3u)) {
+			output(ev, size);
+			return;
+		}
+		if (!program && sequenced(ev[1])) {
+			unsigned char copy[3] = {ev[0], ev[1], ev[2]};
+			for (int c = 0; c < CHANNELS; c++) {
+				if ((c != from && channels[c].carried[from] == 0) || shared(c, from))
+					continue;
+				copy[0] = 0xB0 | c;
+				output(copy, size);
+				if (ev[1] == RESET_CONTROLLERS) {
+					std::fill(channels[c].setup + ctrl_slot(0), channels[c].setup + SETUP_SLOTS, -1);
+					channels[c].bend = NO_BEND;
+				}
+			}
+			if (ev[1] == RESET_CONTROLLERS) {
+				std::fill(channels[from].want + ctrl_slot(0), channels[from].want + SETUP_SLOTS, -1);
+				channels[from].want_bend = NO_BEND;
+			}
+			return;
+		}
+		int slot = program ? PROGRAM_SLOT : ctrl_slot(ev[1]);
+		int value = program ? ev[1] : ev[2];
+		channels[from].want[slot] = value;
+		for (int c = 0; c < CHANNELS; c++) {
+			if ((c == from || channels[c].carried[from] > 0) && compatible(c, from, slot, value))
+				send_setup(c, slot, value);
+		}
+	}
+
+	void event(const unsigned char *ev, size_t size)
+	{
+		PlaybackPlan::count(&plan->input_, ev, size);
+		if (size == 0 || size > 3 || (ev[0] & 0xF0) == 0xF0 || (ev[0] & 0x0F) == DRUM_CHANNEL) {
+			output(ev, size);
+			return;
+		}
+		int type = ev[0] & 0xF0, from = ev[0] & 0x0F;
+
+		bool mts = plan->mode_ == PlaybackPlan::MTS;
+		switch (type) {
+		case 0x90:
+			if (size == 3 && ev[2] > 0) {
+				if (mts)
+					mts_note_on(from, ev[1], ev[2]);
+				else
+					note_on(from, ev[1], ev[2]);
+				break;
+			}
+			/* fall through */
+		case 0x80:
+			if (mts)
+				mts_note_off(from, ev[1], size == 3 ? ev[2] : 0);
+			else
+				note_off(from, ev[1], size == 3 ? ev[2] : 0);
+			break;
+		case 0xA0: {
+			/* to where the latest note of the key went */
+			std::vector<signed char> &routes = channels[from].routes[ev[1]];
+			unsigned char copy[3] = {ev[0], ev[1], size == 3 ? ev[2] : (unsigned char)0};
+			if (!routes.empty() && mts)
+				copy[1] = routes.back();
+			else if (!routes.empty())
+				copy[0] = 0xA0 | routes.back();
+			output(copy, size);
+			break;
+		}
+		case 0xB0:
+		case 0xC0:
+			/* notes never change channels under MTS */
+			if (mts)
+				output(ev, size);
+			else
+				channel_setup(from, ev, size);
+			break;
+		case 0xE0:
+			/* sent with the notes that need it */
+			if (size == 3)
+				channels[from].want_bend = ev[1] | (ev[2] << 7);
+			break;
+		default:
+			output(ev, size);
+		}
+	}
+};
+
+static void
+render_event(unsigned char *ev, size_t size, void *arg)
+{
+	static_cast<PlanRender *>(arg)->event(ev, size);
+}
+
+static vmd_status_t
+render_delay(vmd_time_t dtime, int tempo, void *arg)
+{
+	static_cast<PlanRender *>(arg)->delay(dtime, tempo);
+	return VMD_OK;
+}
+
+PlaybackPlan::PlaybackPlan(vmd_file_t *file, Mode _mode)
+	:mode_(_mode),
+	division_(file->division)
+{
+	TRACE_SPAN("PlaybackPlan::render");
+	memset(&input_, 0, sizeof(input_));
+	memset(&output_, 0, sizeof(output_));
+	PlanRender r(this);
+	if (mode_ == MTS) {
+		r.select_tuning();
+		r.collect(file);
+		r.tune_all(r.pitches());
+	}
+	vmd_file_play(file, 0, render_event, render_delay, &r, NULL);
+	steps_.shrink_to_fit();
+	data_.shrink_to_fit();
+}
+
+/* What the events before a seek position leave set: per channel the
+ * last program, controllers, pressure and bend, with the sequenced
+ * controllers in order, and the last tuning of each key. Notes before
+ * the position are dropped.
+ */
+struct PlanSeek
+{
+	int setup[CHANNELS][SETUP_SLOTS];
+	int pressure[CHANNELS], bend[CHANNELS];
+	std::vector<unsigned char> sequence[CHANNELS];
+	int key_pitch[KEYS];
+	/* anything else, in order */
+	std::vector<std::vector<unsigned char> > other;
+
+	PlanSeek()
+	{
+		for (int c = 0; c < CHANNELS; c++) {
+			std::fill(setup[c], setup[c] + SETUP_SLOTS, -1);
+			pressure[c] = bend[c] = -1;
+		}
+		std::fill(key_pitch, key_pitch + KEYS, -1);
+	}
+
+	static bool is_retune(const unsigned char *ev, size_t size)
+	{
+		static const unsigned char head[] = {0xF0, 0x7F, 0x7F, 0x08, 0x02, TUNING_PROGRAM};
+		return size >= 8 && memcmp(ev, head, sizeof(head)) == 0 && size == 8 + 4 * size_t(ev[6]);
+	}
+
+	void event(const unsigned char *ev, size_t size)
+	{
+		if (size == 0)
+			return;
+		if (is_retune(ev, size)) {
+			for (int i = 0; i < ev[6]; i++) {
+				const unsigned char *k = ev + 7 + 4 * i;
+				key_pitch[k[0] & 0x7F] = k[1] * SEMITONE + (k[2] << 7) + k[3];
+			}
+			return;
+		}
+		int type = ev[0] & 0xF0, c = ev[0] & 0x0F;
+		if (type == 0x80 || type == 0x90 || type == 0xA0)
+			return;
+		if (type == 0xB0 && size == 3 && sequenced(ev[1])) {
+			/* sounding notes are dropped anyway */
+			if (ev[1] == 120 || ev[1] == 123)
+				return;
+			if (ev[1] == RESET_CONTROLLERS) {
+				std::fill(setup[c] + ctrl_slot(0), setup[c] + SETUP_SLOTS, -1);
+				pressure[c] = bend[c] = -1;
+			}
+			sequence[c].insert(sequence[c].end(), ev, ev + 3);
+		} else if (type == 0xB0 && size == 3)
+			setup[c][ctrl_slot(ev[1])] = ev[2];
+		else if (type == 0xC0 && size == 2)
+			setup[c][PROGRAM_SLOT] = ev[1];
+		else if (type == 0xD0 && size == 2)
+			pressure[c] = ev[1];
+		else if (type == 0xE0 && size == 3)
+			bend[c] = ev[1] | (ev[2] << 7);
+		else
+			other.push_back(std::vector<unsigned char>(ev, ev + size));
+	}
+
+	void send_slot(int c, int slot, vmd_event_clb_t event_clb, void *arg)
+	{
+		unsigned char ev[3];
+		if (setup[c][slot] >= 0)
+			event_clb(ev, setup_event(ev, c, slot, setup[c][slot]), arg);
+	}
+
+	void flush(vmd_event_clb_t event_clb, void *arg)
+	{
+		/* vmd_event_clb_t takes a mutable buffer */
+		for (size_t i = 0; i < other.size(); i++)
+			event_clb(&other[i][0], other[i].size(), arg);
+
+		std::vector<int> keys;
+		for (int k = 0; k < KEYS; k++) {
+			if (key_pitch[k] >= 0)
+				keys.push_back(k);
+		}
+		std::vector<unsigned char> ev;
+		for (size_t i = 0; i < keys.size(); i += RETUNES_PER_MESSAGE) {
+			size_t n = std::min(keys.size() - i, size_t(RETUNES_PER_MESSAGE));
+			retune_message(&ev, &keys[i], n, key_pitch);
+			event_clb(&ev[0], ev.size(), arg);
+		}
+
+		for (int c = 0; c < CHANNELS; c++) {
+			for (size_t i = 0; i < sequence[c].size(); i += 3)
+				event_clb(&sequence[c][i], 3, arg);
+			/* bank select before the program */
+			send_slot(c, ctrl_slot(0), event_clb, arg);
+			send_slot(c, ctrl_slot(32), event_clb, arg);
+			send_slot(c, PROGRAM_SLOT, event_clb, arg);
+			for (int ctrl = 1; ctrl < 128; ctrl++) {
+				if (ctrl != 32)
+					send_slot(c, ctrl_slot(ctrl), event_clb, arg);
+			}
+			if (pressure[c] >= 0) {
+				unsigned char p[2] = {(unsigned char)(0xD0 | c), (unsigned char)pressure[c]};
+				event_clb(p, sizeof(p), arg);
+			}
+			if (bend[c] >= 0) {
+				unsigned char b[3] = {(unsigned char)(0xE0 | c), (unsigned char)(bend[c] & 0x7F), (unsigned char)(bend[c] >> 7)};
+				event_clb(b, sizeof(b), arg);
+			}
+		}
+	}
+};
+
+vmd_status_t
+PlaybackPlan::play(vmd_time_t from, vmd_event_clb_t event_clb, vmd_delay_clb_t delay_clb, void *arg) const
+{
+	PlanSeek seek;
+	bool seeking = true;
+	vmd_time_t time = 0;
+	size_t offset = 0;
+	std::vector<unsigned char> ev;
+	for (size_t i = 0; i < steps_.size(); i++) {
+		const Step &s = steps_[i];
+		if (s.size != 0) {
+			const unsigned char *e = &data_[offset];
+			offset += s.size;
+			if (time < from) {
+				seek.event(e, s.size);
+				continue;
+			}
+			if (seeking) {
+				seek.flush(event_clb, arg);
+				seeking = false;
+			}
+			/* vmd_event_clb_t takes a mutable buffer */
+			ev.assign(e, e + s.size);
+			event_clb(&ev[0], ev.size(), arg);
+			continue;
+		}
+		vmd_time_t end = time + s.dtime;
+		vmd_time_t dtime = time >= from ? s.dtime : end - from;
+		time = end;
+		if (end <= from)
+			continue;
+		if (seeking) {
+			seek.flush(event_clb, arg);
+			seeking = false;
+		}
+		if (delay_clb(dtime, s.tempo, arg) != VMD_OK)
+			return VMD_STOP;
+	}
+	if (seeking)
+		seek.flush(event_clb, arg);
+	return VMD_OK;
+}
+
+void
+PlaybackPlan::count(Counts *c, const unsigned char *ev, size_t size)
+{
+	c->events++;
+	c->bytes += size;
+	if (size == 0)
+		return;
+	int type = ev[0] & 0xF0;
+	if (type == 0x90 && size == 3 && ev[2] > 0)
+		c->notes++;
+	else if (type == 0xE0)
+		c->bends++;
+	else if (ev[0] == 0xF0)
+		c->sysex++;
+}
+
+/* Export: plays the plan without waiting and records what would be sent */
+
+struct PlanExport
+{
+	std::vector<unsigned char> track;
+	vmd_time_t pending;
+	int tempo;
+
+	void vlq(unsigned v)
+	{
+		unsigned char buf[4];
+		int n = 0;
+		do {
+			buf[n++] = v & 0x7F;
+			v >>= 7;
+		} while (v != 0 && n < 4);
+		while (n-- > 0)
+			track.push_back(buf[n] | (n > 0 ? 0x80 : 0));
+	}
+
+	void event(const unsigned char *ev, size_t size)
+	{
+		vlq(pending);
+		pending = 0;
+		/* SysEx is stored with its length */
+		if (size > 1 && ev[0] == 0xF0) {
+			track.push_back(0xF0);
+			vlq(size - 1);
+			ev++;
+			size--;
+		}
+		track.insert(track.end(), ev, ev + size);
+	}
+};
+
+static void
+export_event(unsigned char *ev, size_t size, void *arg)
+{
+	static_cast<PlanExport *>(arg)->event(ev, size);
+}
+
+static vmd_status_t
+export_delay(vmd_time_t dtime, int tempo, void *arg)
+{
+	PlanExport *e = static_cast<PlanExport *>(arg);
+	e->pending += dtime;
+	if (tempo != e->tempo) {
+		unsigned char ev[6] = {0xFF, 0x51, 0x03, (unsigned char)(tempo >> 16), (unsigned char)(tempo >> 8), (unsigned char)tempo};
+		e->event(ev, sizeof(ev));
+		e->tempo = tempo;
+	}
+	return VMD_OK;
+}
+
+static void
+put32(std::vector<unsigned char> *out, unsigned v)
+{
+	for (int i = 3; i >= 0; i--)
+		out->push_back((unsigned char)(v >> (i * 8)));
+}
+
+vmd_status_t
+PlaybackPlan::export_smf(const char *path) const
+{
+	PlanExport e;
+	e.pending = 0;
+	e.tempo = -1;
+	play(0, export_event, export_delay, &e);
+	unsigned char eot[3] = {0xFF, 0x2F, 0x00};
+	e.event(eot, sizeof(eot));
+
+	std::vector<unsigned char> out;
+	const char *hdr = "MThd";
+	out.insert(out.end(), hdr, hdr + 4);
+	put32(&out, 6);
+	unsigned char fmt[6] = {0, 0, 0, 1, (unsigned char)(division_ >> 8), (unsigned char)division_};
+	out.insert(out.end(), fmt, fmt + 6);
+	const char *trk = "MTrk";
+	out.insert(out.end(), trk, trk + 4);
+	put32(&out, e.track.size());
+	out.insert(out.end(), e.track.begin(), e.track.end());
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL)
+		return VMD_ERROR;
+	bool ok = fwrite(&out[0], 1, out.size(), f) == out.size();
+	ok = fclose(f) == 0 && ok;
+	return ok ? VMD_OK : VMD_ERROR;
+}
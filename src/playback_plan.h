@@ -0,0 +1,98 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef PLAYBACK_PLAN_H
+#define PLAYBACK_PLAN_H
+
+#include <vector>
+#include <vomid.h>
+
+/* The MIDI a file plays, rendered ahead with channels reassigned.
+ *
+ * libvomid plays microtonal notes by spreading them over channels and
+ * retuning a channel with a pitch bend before each note. The plan takes
+ * its output once and reassigns the notes: a note goes to a channel that
+ * is already bent as it needs and set up with the program and controllers
+ * of its input channel, and only if there is none is a free channel
+ * retuned and set up. Bends that change nothing are dropped. Programs and
+ * controllers follow the notes of their input channel, except onto
+ * channels where they would change notes of other input channels. The
+ * drum channel is left alone.
+ *
+ * For synths that support the MIDI Tuning Standard, the plan can instead
+ * retune keys, and drop the bends altogether: each pitch played gets a
+ * key of its own, tuned by a real-time single note tuning change, and
+ * notes stay on their channels as plain note-ons. The pitches are those
+ * of the tracks' notesystems, not the bends, which only tell apart the
+ * notes starting together. If the file plays at most 128 pitches, all
+ * keys are tuned once at the start; otherwise a silent key is retuned
+ * when a pitch without one is needed. The keys of tuning program 1 are
+ * retuned, and RPN 3 selects it on all channels but the drums. Plans
+ * that bend send no tuning messages, as synths without MTS may not
+ * ignore them.
+ *
+ * This assumes libvomid bends a channel before the notes that need it,
+ * and not while they sound, with the default range of two semitones.
+ *
+ * File renders the plan of its current revision on a thread; playback
+ * replays it with the callbacks of vmd_file_play(), and bounces export
+ * it.
+ */
+class PlaybackPlan
+{
+public:
+	enum Mode
+	{
+		BEND,
+		MTS
+	};
+
+	explicit PlaybackPlan(vmd_file_t *, Mode = BEND);
+
+	Mode mode() const { return mode_; }
+	int division() const { return division_; }
+
+	/* Same contract as vmd_file_play(). What controllers, programs,
+	 * bends and tunings before the start leave set is sent first, one
+	 * event per channel and controller or key, without delays.
+	 */
+	vmd_status_t play(vmd_time_t from, vmd_event_clb_t, vmd_delay_clb_t, void *arg) const;
+
+	/* Writes what play() sends as a type 0 Standard MIDI File: the
+	 * performance, not the tracks, so it doesn't load back as the same
+	 * file.
+	 */
+	vmd_status_t export_smf(const char *path) const;
+
+	/* of the rendered and the planned output */
+	struct Counts
+	{
+		size_t events, bytes, notes, bends, sysex;
+	};
+	Counts input() const { return input_; }
+	Counts output() const { return output_; }
+
+	static void count(Counts *, const unsigned char *, size_t);
+
+private:
+	friend struct PlanRender;
+
+	/* a delay, or an event if size isn't 0, whose bytes follow those
+	 * of the previous events in data_
+	 */
+	struct Step
+	{
+		vmd_time_t dtime;
+		int tempo;
+		unsigned size;
+	};
+
+	Mode mode_;
+	int division_;
+	std::vector<Step> steps_;
+	std::vector<unsigned char> data_;
+	Counts input_, output_;
+};
+
+#endif /* PLAYBACK_PLAN_H */
@@ -1,10 +1,19 @@
 #include <QAction>
 #include <QThread>
 #include <QTimer>
+#include "clock.h"
+#include "playback_plan.h"
 #include "player.h"
-
-Player::Player()
-	:file_(NULL),
+#include "trace.h"
+
+/* clock defaults to the wall clock */
+Player::Player(Clock *_clock, PlayerSink *_sink)
+	:clock_(_clock != NULL ? _clock : Clock::system()),
+	sink_(_sink),
+	file_(NULL),
+	lateness_(0),
+	max_lateness_(0),
+	mts_(false),
 	stopping_(false)
 {
 	connect(this, SIGNAL(finished()), this, SLOT(stop()));
@@ -22,19 +31,35 @@ Player::time() const
 		return -1;
 
 	QMutexLocker locker(&mutex_);
-	double dsec = vmd_systime() - system_time_;
+	double dsec = clock_->now() - system_time_;
 	vmd_time_t dt = vmd_systime2time(dsec, tempo_, file_->division);
 	return time_ + dt;
 }
 
+double
+Player::lateness() const
+{
+	QMutexLocker locker(&mutex_);
+	return lateness_;
+}
+
+double
+Player::max_lateness() const
+{
+	QMutexLocker locker(&mutex_);
+	return max_lateness_;
+}
+
 void
-Player::play(vmd_file_t *_file, vmd_time_t _time)
+Player::play(vmd_file_t *_file, vmd_time_t _time, QSharedPointer<const PlaybackPlan> _plan)
 {
 	stop();
 	file_ = _file;
+	plan_ = _plan;
 	time_ = _time;
 	tempo_ = vmd_map_get(&file_->ctrl[VMD_FCTRL_TEMPO], time_, NULL);
-	system_time_ = vmd_systime();
+	system_time_ = clock_->now();
+	lateness_ = max_lateness_ = 0;
 	start();
 }
 
@@ -48,16 +73,43 @@ Player::stop()
 	wait();
 	stopping_ = false;
 	file_ = NULL;
+	plan_.clear();
+}
+
+void
+Player::set_mts(bool _mts)
+{
+	mts_ = _mts;
+}
+
+QString
+Player::output_device() const
+{
+	QMutexLocker lock(&device_mutex_);
+	return device_;
 }
 
 bool
 Player::set_output_device(QString id)
 {
-	if (vmd_set_device(VMD_OUTPUT_DEVICE, id.toLatin1().data()) == VMD_OK) {
-		emit outputDeviceSet(id);
-		return true;
-	} else
+	QMutexLocker lock(&device_mutex_);
+	if (vmd_set_device(VMD_OUTPUT_DEVICE, id.toLatin1().data()) != VMD_OK)
 		return false;
+	device_ = id;
+	lock.unlock();
+	emit outputDeviceSet(id);
+	return true;
+}
+
+void
+Player::fall_back_on(QStringList ids)
+{
+	TRACE_SPAN("Player::fall_back_on");
+	for (int i = 0; i < ids.size(); i++) {
+		/* checked each time, as one may be chosen meanwhile */
+		if (ids.contains(output_device()) || set_output_device(ids[i]))
+			break;
+	}
 }
 
 struct Playing
@@ -71,32 +123,47 @@ struct Playing
 void
 Player::run()
 {
+	TRACE_SPAN("Player::run");
 	QMutexLocker locker(&stop_mutex_);
-	vmd_reset_output();
-	vmd_file_play(file_, time_, s_event_clb, s_delay_clb, this, NULL);
-	vmd_notes_off();
+	if (sink_ == NULL)
+		vmd_reset_output();
+	if (plan_.isNull())
+		vmd_file_play(file_, time_, s_event_clb, s_delay_clb, this, NULL);
+	else
+		plan_->play(time_, s_event_clb, s_delay_clb, this);
+	if (sink_ == NULL)
+		vmd_notes_off();
 }
 
 void
 Player::event_clb(unsigned char *ev, size_t size)
 {
-	vmd_output(ev, size);
+	if (sink_ != NULL)
+		sink_->event(ev, size, clock_->now());
+	else
+		vmd_output(ev, size);
 }
 
 vmd_status_t
 Player::delay_clb(vmd_time_t dtime, int _tempo)
 {
-	vmd_flush_output();
+	if (sink_ == NULL) {
+		TRACE_SPAN("Player::flush");
+		vmd_flush_output();
+	}
 
 	double fin_time = system_time_ + vmd_time2systime(dtime, _tempo, file_->division);
 
-	int msec_wait = int((fin_time - vmd_systime()) * 1000);
-	if (msec_wait < 0)
-		msec_wait = 0;
-	if (stop_cond_.wait(&stop_mutex_, msec_wait) || stopping_)
+	while (!stopping_ && clock_->now() < fin_time)
+		clock_->wait_until(&stop_cond_, &stop_mutex_, fin_time);
+	if (stopping_)
 		return VMD_STOP;
 
+	double late = (clock_->now() - fin_time) * 1000;
 	QMutexLocker lock(&mutex_);
+	lateness_ = late > 0 ? late : 0;
+	if (lateness_ > max_lateness_)
+		max_lateness_ = lateness_;
 	time_ += dtime;
 	system_time_ = fin_time;
 	tempo_ = _tempo;
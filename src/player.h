@@ -6,24 +6,58 @@
 #define PLAYER_H
 
 #include <QMutex>
+#include <QSharedPointer>
+#include <QStringList>
 #include <QThread>
 #include <QWaitCondition>
 #include <vomid.h>
 
+class Clock;
+class PlaybackPlan;
+
+/* Takes the events of a playback instead of the output device, with the
+ * clock time they were sent at; called on the player's thread
+ */
+class PlayerSink
+{
+public:
+	virtual ~PlayerSink() { }
+	virtual void event(const unsigned char *, size_t, double time) = 0;
+};
+
 class Player : public QThread
 {
 	Q_OBJECT
 
 public:
-	Player();
+	/* the sink defaults to the output device */
+	explicit Player(Clock *clock = NULL, PlayerSink *sink = NULL);
 	~Player();
-	void play(vmd_file_t *, vmd_time_t);
+	/* plays the plan if given, else the file itself */
+	void play(vmd_file_t *, vmd_time_t,
+	          QSharedPointer<const PlaybackPlan> = QSharedPointer<const PlaybackPlan>());
 	vmd_file_t *file() const { return file_; }
+	Clock *clock() const { return clock_; }
+	/* empty until a device is set */
+	QString output_device() const;
 	vmd_time_t time() const;
+	/* how late the last and the latest event of this playback were, ms */
+	double lateness() const;
+	double max_lateness() const;
+	/* whether plans should retune keys rather than bend channels;
+	 * without a plan, libvomid bends them all the same
+	 */
+	bool mts() const { return mts_; }
 
 public slots:
 	void stop();
 	bool set_output_device(QString id);
+	/* unless the device is one of them, sets the first of the devices
+	 * that opens
+	 */
+	void fall_back_on(QStringList ids);
+	/* from the next playback */
+	void set_mts(bool);
 
 signals:
 	void outputDeviceSet(QString);
@@ -37,12 +71,20 @@ private:
 	static void s_event_clb(unsigned char *, size_t, void *);
 	static vmd_status_t s_delay_clb(vmd_time_t, int, void *);
 
+	Clock *clock_;
+	PlayerSink *sink_;
 	vmd_file_t *file_;
+	QSharedPointer<const PlaybackPlan> plan_;
 	vmd_time_t time_;
 	int tempo_;
 	double system_time_;
+	double lateness_, max_lateness_;
+	bool mts_;
 
 	mutable QMutex mutex_;
+	/* serializes device changes, which may come from any thread */
+	mutable QMutex device_mutex_;
+	QString device_;
 
 	QMutex stop_mutex_;
 	QWaitCondition stop_cond_;
@@ -0,0 +1,207 @@
+#include <QDataStream>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <stdlib.h>
+#include "scala_library.h"
+
+static const quint32 CACHE_MAGIC = 0x564d5343; /* "VMSC" */
+static const quint32 CACHE_VERSION = 1;
+/* files scanned between progress() signals */
+static const int progress_step = 64;
+
+vmd_notesystem_t
+ScalaTuning::notesystem() const
+{
+	vmd_notesystem_t ret;
+	ret.size = pitches.size();
+	ret.end_pitch = end_pitch;
+	ret.pitches = (int *)pitches.data();
+	return ret;
+}
+
+static QDataStream &
+operator <<(QDataStream &s, const ScalaTuning &t)
+{
+	return s << t.path << t.mtime << t.description << t.end_pitch << t.pitches;
+}
+
+static QDataStream &
+operator >>(QDataStream &s, ScalaTuning &t)
+{
+	return s >> t.path >> t.mtime >> t.description >> t.end_pitch >> t.pitches;
+}
+
+static QString
+cache_path()
+{
+	return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/scala.cache";
+}
+
+static bool
+by_name(const ScalaTuning &a, const ScalaTuning &b)
+{
+	return QString::compare(QFileInfo(a.path).fileName(), QFileInfo(b.path).fileName(), Qt::CaseInsensitive) < 0;
+}
+
+ScalaTuning
+ScalaLibrary::parse(const QString &path)
+{
+	ScalaTuning ret;
+	ret.path = path;
+	ret.mtime = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+	ret.end_pitch = 0;
+
+	/* the first line that isn't a comment */
+	QFile f(path);
+	if (f.open(QIODevice::ReadOnly)) {
+		while (!f.atEnd()) {
+			QString line = QString::fromLatin1(f.readLine()).trimmed();
+			if (!line.startsWith('!')) {
+				ret.description = line;
+				break;
+			}
+		}
+	}
+
+	vmd_notesystem_t ns = vmd_notesystem_import(path.toLocal8Bit().data());
+	if (ns.pitches != NULL) {
+		ret.end_pitch = ns.end_pitch;
+		ret.pitches.resize(ns.size);
+		std::copy(ns.pitches, ns.pitches + ns.size, ret.pitches.begin());
+		free(ns.pitches);
+	}
+	return ret;
+}
+
+ScalaLibrary::ScalaLibrary(QObject *parent)
+	:QThread(parent),
+	canceled_(0)
+{
+	load_cache();
+}
+
+ScalaLibrary::~ScalaLibrary()
+{
+	canceled_ = 1;
+	wait();
+}
+
+QString
+ScalaLibrary::dir() const
+{
+	QMutexLocker lock(&mutex_);
+	return dir_;
+}
+
+QVector<ScalaTuning>
+ScalaLibrary::tunings() const
+{
+	QMutexLocker lock(&mutex_);
+	return tunings_;
+}
+
+void
+ScalaLibrary::scan(QString dir)
+{
+	canceled_ = 1;
+	wait();
+	canceled_ = 0;
+	if (!dir.isEmpty()) {
+		QMutexLocker lock(&mutex_);
+		if (dir != dir_)
+			tunings_.clear();
+		dir_ = dir;
+	}
+	start(QThread::LowPriority);
+}
+
+void
+ScalaLibrary::run()
+{
+	QString dir = this->dir();
+	if (dir.isEmpty())
+		return;
+	QVector<ScalaTuning> old = tunings();
+	QHash<QString, const ScalaTuning *> known;
+	for (int i = 0; i < old.size(); i++)
+		known.insert(old[i].path, &old[i]);
+
+	QStringList paths;
+	QDirIterator it(dir, QStringList() << "*.scl" << "*.SCL", QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext() && !canceled_)
+		paths << it.next();
+
+	QVector<ScalaTuning> found;
+	found.reserve(paths.size());
+	for (int i = 0; i < paths.size() && !canceled_; i++) {
+		if (i % progress_step == 0)
+			emit progress(i, paths.size());
+		qint64 mtime = QFileInfo(paths[i]).lastModified().toMSecsSinceEpoch();
+		const ScalaTuning *t = known.value(paths[i]);
+		if (t != NULL && t->mtime == mtime)
+			found.push_back(*t);
+		else
+			found.push_back(parse(paths[i]));
+	}
+	if (canceled_)
+		return;
+	std::sort(found.begin(), found.end(), by_name);
+
+	{
+		QMutexLocker lock(&mutex_);
+		if (dir != dir_)
+			return;
+		tunings_ = found;
+	}
+	save_cache();
+	emit progress(paths.size(), paths.size());
+	emit scanned();
+}
+
+bool
+ScalaLibrary::load_cache()
+{
+	QFile f(cache_path());
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream s(&f);
+	quint32 magic, version;
+	QString dir;
+	QVector<ScalaTuning> tunings;
+	s >> magic >> version;
+	if (magic != CACHE_MAGIC || version != CACHE_VERSION)
+		return false;
+	s >> dir >> tunings;
+	if (s.status() != QDataStream::Ok)
+		return false;
+
+	QMutexLocker lock(&mutex_);
+	dir_ = dir;
+	tunings_ = tunings;
+	return true;
+}
+
+void
+ScalaLibrary::save_cache()
+{
+	QString path = cache_path();
+	QDir().mkpath(QFileInfo(path).path());
+	QSaveFile f(path);
+	if (!f.open(QIODevice::WriteOnly))
+		return;
+
+	QDataStream s(&f);
+	{
+		QMutexLocker lock(&mutex_);
+		s << CACHE_MAGIC << CACHE_VERSION << dir_ << tunings_;
+	}
+	if (s.status() == QDataStream::Ok)
+		f.commit();
+}
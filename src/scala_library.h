@@ -0,0 +1,70 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef SCALA_LIBRARY_H
+#define SCALA_LIBRARY_H
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+#include <vomid.h>
+
+struct ScalaTuning
+{
+	QString path;
+	qint64 mtime;
+	QString description;
+	qint32 end_pitch;
+	/* empty if the file couldn't be parsed */
+	QVector<qint32> pitches;
+
+	bool valid() const { return !pitches.isEmpty(); }
+	/* points into pitches; File::add_track() copies it */
+	vmd_notesystem_t notesystem() const;
+};
+
+/* An index of a directory tree of Scala files.
+ *
+ * The parsed notesystem tables are kept in a cache keyed by path and
+ * modification time, so the index is available right away on startup
+ * and a rescan on the worker thread only parses the files that changed.
+ */
+class ScalaLibrary : public QThread
+{
+	Q_OBJECT
+
+public:
+	ScalaLibrary(QObject *parent = NULL);
+	~ScalaLibrary();
+
+	QString dir() const;
+	QVector<ScalaTuning> tunings() const;
+
+	/* parses a single file, in or out of the library */
+	static ScalaTuning parse(const QString &path);
+
+public slots:
+	/* rescans the current directory if called with none */
+	void scan(QString dir = QString());
+
+signals:
+	void progress(int value, int maximum);
+	void scanned();
+
+protected:
+	void run();
+
+private:
+	bool load_cache();
+	void save_cache();
+
+	mutable QMutex mutex_;
+	QString dir_;
+	QVector<ScalaTuning> tunings_;
+	QAtomicInt canceled_;
+};
+
+#endif /* SCALA_LIBRARY_H */
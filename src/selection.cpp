@@ -0,0 +1,136 @@
+#include "file.h"
+#include "note_index.h"
+#include "selection.h"
+
+Selection::Selection()
+	:file_(NULL),
+	track_(NULL),
+	generation_(0)
+{
+}
+
+Selection::Selection(File *_file, vmd_track_t *_track)
+	:file_(_file),
+	track_(_track),
+	generation_(_file->generation())
+{
+}
+
+void
+Selection::Snapshot::resolve(std::vector<vmd_note_t *> *notes, std::vector<Key> *found) const
+{
+	if (index.isNull())
+		return;
+	/* notes of one pitch don't overlap, so a key names one note; only
+	 * the index's copies of the times are read, never the notes
+	 */
+	std::vector<NoteIndex::Run> runs;
+	for (size_t i = 0; i < keys.size(); i++) {
+		const Key &k = keys[i];
+		runs.clear();
+		index->runs(k.on_time, k.on_time + 1, k.pitch, k.pitch + 1, runs);
+		for (size_t r = 0; r < runs.size(); r++) {
+			const NoteIndex::Run &run = runs[r];
+			size_t j = 0;
+			while (j < run.size && run.on_time[j] != k.on_time)
+				j++;
+			if (j == run.size || run.off_time[j] != k.off_time)
+				continue;
+			notes->push_back(run.notes[j]);
+			if (found != NULL)
+				found->push_back(k);
+			break;
+		}
+	}
+}
+
+QSharedPointer<const NoteIndex>
+Selection::index() const
+{
+	int t = 0;
+	while (t < file_->tracks && file_->track[t] != track_)
+		t++;
+	if (t == file_->tracks)
+		return QSharedPointer<const NoteIndex>();
+	return file_->shared_index(track_);
+}
+
+Selection::Snapshot
+Selection::snapshot() const
+{
+	refresh();
+	Snapshot ret;
+	if (file_ == NULL)
+		return ret;
+	ret.index = index();
+	if (!ret.index.isNull())
+		ret.keys = keys_;
+	return ret;
+}
+
+void
+Selection::refresh() const
+{
+	if (file_ == NULL || file_->generation() == generation_)
+		return;
+	generation_ = file_->generation();
+	if (notes_.empty())
+		return;
+
+	Snapshot s;
+	s.index = index();
+	s.keys.swap(keys_);
+	notes_.clear();
+	set_.clear();
+	s.resolve(&notes_, &keys_);
+	for (size_t i = 0; i < notes_.size(); i++)
+		set_.insert(notes_[i]);
+}
+
+const std::vector<vmd_note_t *> &
+Selection::notes() const
+{
+	refresh();
+	return notes_;
+}
+
+bool
+Selection::contains(vmd_note_t *note) const
+{
+	refresh();
+	return set_.contains(note);
+}
+
+void
+Selection::add(vmd_note_t *note)
+{
+	refresh();
+	if (set_.contains(note))
+		return;
+	Key k = {note->on_time, note->off_time, note->pitch};
+	keys_.push_back(k);
+	notes_.push_back(note);
+	set_.insert(note);
+}
+
+void
+Selection::set(std::vector<vmd_note_t *> &notes)
+{
+	clear();
+	keys_.reserve(notes.size());
+	notes_.reserve(notes.size());
+	set_.reserve(notes.size());
+	for (size_t i = 0; i < notes.size(); i++)
+		add(notes[i]);
+	notes.clear();
+}
+
+void
+Selection::clear()
+{
+	keys_.clear();
+	notes_.clear();
+	set_.clear();
+	if (file_ != NULL)
+		generation_ = file_->generation();
+}
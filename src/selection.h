@@ -0,0 +1,81 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <QSet>
+#include <QSharedPointer>
+#include <vector>
+#include <vomid.h>
+
+class File;
+class NoteIndex;
+
+/* A set of notes of one track.
+ *
+ * It does not touch the notes' next and mark fields, so any number of
+ * selections may exist at once. Membership is a hash lookup. Besides the
+ * notes, the selection keeps their times and pitches; when the file's
+ * generation changes it finds its notes again by those through the
+ * track's index, so it lasts through edits, undo and page loads, and
+ * only loses the notes that are gone.
+ *
+ * Other threads take a snapshot() and find the notes in it instead; it
+ * holds the keys and the track's shared index, and reading it touches
+ * neither the selection nor the file.
+ */
+class Selection
+{
+public:
+	struct Key
+	{
+		vmd_time_t on_time, off_time;
+		vmd_pitch_t pitch;
+	};
+
+	struct Snapshot
+	{
+		QSharedPointer<const NoteIndex> index;
+		std::vector<Key> keys;
+
+		/* the notes of the keys still in the index, and in keys, those
+		 * keys; pointers are good as long as the index is
+		 */
+		void resolve(std::vector<vmd_note_t *> *, std::vector<Key> *keys = NULL) const;
+	};
+
+	Selection();
+	Selection(File *, vmd_track_t *);
+
+	File *file() const { return file_; }
+	vmd_track_t *track() const { return track_; }
+	bool empty() const { return size() == 0; }
+	size_t size() const { return notes().size(); }
+	/* as of the file's current state; copy them before editing */
+	const std::vector<vmd_note_t *> &notes() const;
+
+	bool contains(vmd_note_t *) const;
+	void add(vmd_note_t *);
+	void set(std::vector<vmd_note_t *> &);
+	void clear();
+
+	/* of the current state; empty if the track is gone */
+	Snapshot snapshot() const;
+
+private:
+	void refresh() const;
+	/* NULL if the track is gone */
+	QSharedPointer<const NoteIndex> index() const;
+
+	File *file_;
+	vmd_track_t *track_;
+	mutable unsigned generation_;
+	/* parallel to notes_ */
+	mutable std::vector<Key> keys_;
+	mutable std::vector<vmd_note_t *> notes_;
+	mutable QSet<vmd_note_t *> set_;
+};
+
+#endif /* SELECTION_H */
@@ -0,0 +1,353 @@
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <string.h>
+#include "smf.h"
+
+SmfMap::SmfMap(const QString &path)
+	:file_(path),
+	data_(NULL),
+	size_(0),
+	valid_(false),
+	format_(0),
+	division_(0)
+{
+	if (!file_.open(QIODevice::ReadOnly) || file_.size() < 14)
+		return;
+	size_ = file_.size();
+	data_ = file_.map(0, size_);
+	if (data_ == NULL)
+		return;
+
+	SmfReader r(data_, size_);
+	if (memcmp(r.pos(), "MThd", 4) != 0)
+		return;
+	r.skip(4);
+	uint hdr_size = r.u32();
+	const uchar *hdr_data = r.pos();
+	r.skip(hdr_size);
+	if (!r.ok())
+		return;
+	SmfReader hdr(hdr_data, hdr_size);
+	format_ = hdr.u16();
+	uint ntracks = hdr.u16();
+	division_ = short(hdr.u16());
+	if (!hdr.ok() || format_ > 2)
+		return;
+
+	tracks_.reserve(ntracks);
+	while (!r.at_end()) {
+		const uchar *id = r.pos();
+		r.skip(4);
+		uint size = r.u32();
+		SmfChunk chunk = {r.pos(), size};
+		r.skip(size);
+		if (!r.ok())
+			return;
+		if (memcmp(id, "MTrk", 4) == 0)
+			tracks_.push_back(chunk);
+	}
+	valid_ = tracks_.size() == ntracks;
+}
+
+SmfMap::~SmfMap()
+{
+	if (data_ != NULL)
+		file_.unmap(const_cast<uchar *>(data_));
+}
+
+void
+SmfTrack::clear()
+{
+	notes.clear();
+	tempos.clear();
+	name.clear();
+	channels = 0;
+	for (int c = 0; c < VMD_CHANNELS; c++) {
+		program[c] = -1;
+		volume[c] = -1;
+	}
+	events = 0;
+	supported = true;
+}
+
+const int MIDI_NOTES = 128;
+const int BEND_CENTER = 0x2000;
+
+/* a program or volume of the channel: the last one before its first
+ * note, or the first one after
+ */
+static void
+set_channel_ctrl(int *ctrl, int value, const SmfTrack *track, int channel)
+{
+	if (*ctrl < 0 || !(track->channels & (vmd_chanmask_t(1) << channel)))
+		*ctrl = value;
+}
+
+bool
+smf_decode_track(const SmfChunk &chunk, SmfTrack *track)
+{
+	SmfReader r(chunk.data, chunk.size);
+	vmd_time_t time = 0;
+	uint status = 0;
+
+	/* index of the sounding note in track->notes, per channel and pitch */
+	std::vector<int> sounding(VMD_CHANNELS * MIDI_NOTES, -1);
+	int bend[VMD_CHANNELS];
+	for (int c = 0; c < VMD_CHANNELS; c++)
+		bend[c] = BEND_CENTER;
+
+	track->clear();
+	bool end = false;
+	while (!r.at_end() && !end && track->supported) {
+		time += r.vlq();
+		uint b = r.u8();
+		if (b & 0x80) {
+			status = b;
+			if (status < 0xF0)
+				b = r.u8();
+		} else if (status == 0 || status >= 0xF0) {
+			return false;
+		}
+		track->events++;
+
+		if (status >= 0xF0) {
+			if (status == 0xFF) {
+				uint type = r.u8();
+				uint len = r.vlq();
+				const uchar *data = r.pos();
+				r.skip(len);
+				if (!r.ok())
+					break;
+				SmfReader meta(data, len);
+				switch (type) {
+				case 0x03:  /* sequence/track name */
+					track->name = QByteArray((const char *)data, len);
+					break;
+				case 0x2F:  /* end of track */
+					end = true;
+					break;
+				case 0x51:  /* tempo */
+					{
+						uint t = (meta.u8() << 16) | meta.u16();
+						SmfTempo tempo = {time, int(t)};
+						track->tempos.push_back(tempo);
+					}
+					break;
+				case 0x58:  /* time signature */
+					if (meta.u8() != 4 || meta.u8() != 2)
+						track->supported = false;
+					break;
+				default:
+					/* text, key signature, markers, ports and the like */
+					break;
+				}
+			} else if (status == 0xF0 || status == 0xF7) {
+				/* system exclusive and escapes */
+				r.skip(r.vlq());
+			} else {
+				/* not allowed in a file */
+				return false;
+			}
+			status = 0;
+			continue;
+		}
+
+		int channel = status & 0x0F;
+		switch (status & 0xF0) {
+		case 0x80:
+		case 0x90:
+			{
+				uint vel = r.u8();
+				int &i = sounding[channel * MIDI_NOTES + (b & 0x7F)];
+				bool on = (status & 0xF0) == 0x90 && vel > 0;
+				if (i >= 0) {
+					/* a re-triggered note has no off velocity of its own */
+					if (on)
+						track->supported = false;
+					/* note-on with zero velocity is a note-off */
+					track->notes[i].off_time = time;
+					track->notes[i].off_vel = vel;
+					i = -1;
+				}
+				if (on) {
+					if (bend[channel] != BEND_CENTER)
+						track->supported = false;
+					SmfNote n = {time, time, uchar(b & 0x7F), uchar(vel), 0, uchar(channel)};
+					i = track->notes.size();
+					track->notes.push_back(n);
+					track->channels |= vmd_chanmask_t(1) << channel;
+				}
+			}
+			break;
+		case 0xA0:  /* key pressure */
+			r.u8();
+			break;
+		case 0xB0:
+			{
+				uint value = r.u8();
+				if (b == 7)
+					set_channel_ctrl(&track->volume[channel], value, track, channel);
+			}
+			break;
+		case 0xC0:
+			set_channel_ctrl(&track->program[channel], b, track, channel);
+			break;
+		case 0xD0:  /* channel pressure */
+			break;
+		case 0xE0:
+			bend[channel] = b | (r.u8() << 7);
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < sounding.size(); i++) {
+		if (sounding[i] >= 0) {
+			/* unterminated */
+			track->notes[sounding[i]].off_time = time;
+			track->supported = false;
+		}
+	}
+	/* empty notes are left to vmd_file_import() */
+	for (size_t i = 0; i < track->notes.size() && track->supported; i++) {
+		if (track->notes[i].off_time <= track->notes[i].on_time)
+			track->supported = false;
+	}
+	return r.ok();
+}
+
+/* files smaller than this are decoded on the calling thread */
+const size_t parallel_min_size = 256 * 1024;
+
+class SmfDecodeJob : public QRunnable
+{
+public:
+	SmfDecodeJob(const SmfMap &_smf, const std::vector<size_t> &_order,
+	             std::vector<SmfTrack> *_tracks, QAtomicInt *_next, QAtomicInt *_failed)
+		:smf(_smf), order(_order), tracks(_tracks), next(_next), failed(_failed) { }
+
+	void run()
+	{
+		/* chunks are taken biggest first, so one huge track doesn't finish last */
+		int i;
+		while ((i = next->fetchAndAddRelaxed(1)) < int(order.size())) {
+			size_t t = order[i];
+			if (!smf_decode_track(smf.tracks()[t], &(*tracks)[t]))
+				failed->storeRelaxed(1);
+		}
+	}
+
+private:
+	const SmfMap &smf;
+	const std::vector<size_t> &order;
+	std::vector<SmfTrack> *tracks;
+	QAtomicInt *next;
+	QAtomicInt *failed;
+};
+
+struct ChunkBigger
+{
+	const SmfMap *smf;
+	bool operator ()(size_t a, size_t b) const { return smf->tracks()[a].size > smf->tracks()[b].size; }
+};
+
+bool
+smf_decode_tracks(const SmfMap &smf, std::vector<SmfTrack> *tracks, int threads)
+{
+	size_t n = smf.tracks().size();
+	tracks->resize(n);
+	if (threads <= 0)
+		threads = QThread::idealThreadCount();
+	threads = std::min<int>(threads, n);
+
+	if (threads <= 1 || smf.size() < parallel_min_size) {
+		for (size_t i = 0; i < n; i++) {
+			if (!smf_decode_track(smf.tracks()[i], &(*tracks)[i]))
+				return false;
+		}
+		return true;
+	}
+
+	std::vector<size_t> order(n);
+	for (size_t i = 0; i < n; i++)
+		order[i] = i;
+	ChunkBigger cmp = {&smf};
+	std::stable_sort(order.begin(), order.end(), cmp);
+
+	QAtomicInt next(0), failed(0);
+	QThreadPool pool;
+	pool.setMaxThreadCount(threads);
+	for (int i = 0; i < threads; i++)
+		pool.start(new SmfDecodeJob(smf, order, tracks, &next, &failed));
+	pool.waitForDone();
+	return failed.loadRelaxed() == 0;
+}
+
+bool
+smf_create_tracks(vmd_file_t *file, const SmfTrack &t, SmfTarget *target)
+{
+	for (size_t i = 0; i < t.tempos.size(); i++)
+		vmd_map_set(&file->ctrl[VMD_FCTRL_TEMPO], t.tempos[i].time, t.tempos[i].tempo);
+
+	/* each channel gets a track that plays on it */
+	for (int c = 0; c < VMD_CHANNELS; c++) {
+		target->track[c] = NULL;
+		vmd_chanmask_t cm = vmd_chanmask_t(1) << c;
+		if (!(t.channels & cm))
+			continue;
+		if (file->tracks == VMD_MAX_TRACKS - 1)
+			return false;
+		vmd_track_t *track = target->track[c] = file->track[file->tracks++] = vmd_track_create(file, cm);
+		if (t.program[c] >= 0)
+			vmd_track_set_ctrl(track, VMD_CCTRL_PROGRAM, t.program[c]);
+		if (t.volume[c] >= 0)
+			vmd_track_set_ctrl(track, VMD_CCTRL_VOLUME, t.volume[c]);
+		strncpy(track->name, t.name.constData(), sizeof(track->name) - 1);
+	}
+	return true;
+}
+
+bool
+smf_insert_notes(const SmfTarget &target, const SmfTrack &t, size_t beg, size_t end)
+{
+	for (size_t i = beg; i < end; i++) {
+		const SmfNote &n = t.notes[i];
+		vmd_note_t *note = vmd_track_insert(target.track[n.channel], n.on_time, n.off_time, n.pitch);
+		if (note == NULL)
+			return false;
+		note->on_vel = n.on_vel;
+		note->off_vel = n.off_vel;
+	}
+	return true;
+}
+
+vmd_status_t
+smf_import(vmd_file_t *file, const SmfMap &smf, size_t *events, int threads)
+{
+	if (!smf.valid())
+		return VMD_ERROR;
+	if (smf.division() <= 0 || smf.format() == 2)
+		return VMD_STOP;
+
+	std::vector<SmfTrack> tracks;
+	if (!smf_decode_tracks(smf, &tracks, threads))
+		return VMD_ERROR;
+	for (size_t i = 0; i < tracks.size(); i++) {
+		if (events != NULL)
+			*events += tracks[i].events;
+		if (!tracks[i].supported)
+			return VMD_STOP;
+	}
+
+	/* merge in file order, exactly as a serial import would */
+	file->division = smf.division();
+	for (size_t i = 0; i < tracks.size(); i++) {
+		const SmfTrack &track = tracks[i];
+		SmfTarget target;
+		if (!smf_create_tracks(file, track, &target) || !smf_insert_notes(target, track, 0, track.notes.size()))
+			return VMD_STOP;
+	}
+	return VMD_OK;
+}
@@ -0,0 +1,185 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef SMF_H
+#define SMF_H
+
+#include <QByteArray>
+#include <QFile>
+#include <vector>
+#include <vomid.h>
+
+/* Standard MIDI File access straight from a memory mapping.
+ *
+ * SmfMap maps the file and locates its chunks; nothing is copied, every
+ * later read decodes bytes and variable-length quantities in place.
+ */
+
+struct SmfChunk
+{
+	const uchar *data;
+	size_t size;
+};
+
+class SmfMap
+{
+public:
+	explicit SmfMap(const QString &path);
+	~SmfMap();
+
+	bool valid() const { return valid_; }
+	size_t size() const { return size_; }
+	int format() const { return format_; }
+	int division() const { return division_; }
+	const std::vector<SmfChunk> &tracks() const { return tracks_; }
+
+private:
+	QFile file_;
+	const uchar *data_;
+	size_t size_;
+	bool valid_;
+	int format_;
+	int division_;
+	std::vector<SmfChunk> tracks_;
+};
+
+/* Bounds-checked big-endian cursor */
+class SmfReader
+{
+public:
+	SmfReader(const uchar *beg, size_t size) : p_(beg), end_(beg + size), ok_(true) { }
+
+	bool ok() const { return ok_; }
+	bool at_end() const { return p_ >= end_; }
+	const uchar *pos() const { return p_; }
+
+	uint u8()
+	{
+		if (p_ >= end_)
+			return fail();
+		return *p_++;
+	}
+
+	uint u16()
+	{
+		if (end_ - p_ < 2)
+			return fail();
+		uint ret = (p_[0] << 8) | p_[1];
+		p_ += 2;
+		return ret;
+	}
+
+	uint u32()
+	{
+		if (end_ - p_ < 4)
+			return fail();
+		uint ret = (uint(p_[0]) << 24) | (p_[1] << 16) | (p_[2] << 8) | p_[3];
+		p_ += 4;
+		return ret;
+	}
+
+	/* variable-length quantity, at most 4 bytes */
+	uint vlq()
+	{
+		uint ret = 0;
+		for (int i = 0; i < 4; i++) {
+			if (p_ >= end_)
+				return fail();
+			uchar b = *p_++;
+			ret = (ret << 7) | (b & 0x7F);
+			if (!(b & 0x80))
+				return ret;
+		}
+		return fail();
+	}
+
+	void skip(size_t n)
+	{
+		if (size_t(end_ - p_) < n)
+			fail();
+		else
+			p_ += n;
+	}
+
+private:
+	uint fail() { ok_ = false; p_ = end_; return 0; }
+
+	const uchar *p_, *end_;
+	bool ok_;
+};
+
+/* Notes and settings decoded from one MTrk chunk */
+struct SmfNote
+{
+	vmd_time_t on_time, off_time;
+	uchar pitch, on_vel, off_vel, channel;
+};
+
+struct SmfTempo
+{
+	vmd_time_t time;
+	int tempo;
+};
+
+struct SmfTrack
+{
+	std::vector<SmfNote> notes;
+	std::vector<SmfTempo> tempos;
+	/* of the sequence/track name event */
+	QByteArray name;
+	/* channels of the notes */
+	vmd_chanmask_t channels;
+	/* per channel, -1 if never set */
+	int program[VMD_CHANNELS];
+	int volume[VMD_CHANNELS];
+	size_t events;
+	bool supported;
+
+	void clear();
+};
+
+/* Decodes a track chunk. The settings of a channel are the last program
+ * and volume before its first note, or else the first ones. Text and
+ * other metas, system exclusive messages, other controllers, aftertouch
+ * and pitch bends are skipped, as a vmd track has nowhere to keep them.
+ * Marks the track unsupported when it holds anything smf_import() can't
+ * reproduce exactly: re-triggered, unterminated or empty notes, notes
+ * starting while their channel is bent (libvomid reads those as
+ * microtonal), time signatures other than 4/4, and so on.
+ */
+bool smf_decode_track(const SmfChunk &, SmfTrack *);
+
+/* Decodes all track chunks of the map. Tracks are independent, so big
+ * files are decoded on a thread pool (threads = 0 means one per core);
+ * the result is the same as decoding them one by one.
+ */
+bool smf_decode_tracks(const SmfMap &, std::vector<SmfTrack> *, int threads = 0);
+
+/* the vmd tracks of a decoded track, one per channel it uses */
+struct SmfTarget
+{
+	vmd_track_t *track[VMD_CHANNELS];
+};
+
+/* Applies the tempo changes of a decoded track and creates a vmd track
+ * for each channel of its notes, named after it. Notes are inserted
+ * separately, so that huge tracks can be inserted piecewise;
+ * smf_create_tracks() returns false when the file runs out of tracks,
+ * and smf_insert_notes() when a note can't be inserted, and the file
+ * then has to be imported with vmd_file_import().
+ */
+bool smf_create_tracks(vmd_file_t *, const SmfTrack &, SmfTarget *);
+bool smf_insert_notes(const SmfTarget &, const SmfTrack &, size_t beg, size_t end);
+
+/* Imports a mapped file into an initialized vmd_file_t.
+ *
+ * Covers the note data of format 0 and 1 files: tracks on any number of
+ * channels, programs and volumes, tempo changes, names and 4/4 time.
+ * Returns VMD_STOP when the file needs vmd_file_import(), VMD_ERROR when
+ * it is malformed. The number of decoded events is added to *events.
+ * Tracks are decoded with smf_decode_tracks().
+ */
+vmd_status_t smf_import(vmd_file_t *, const SmfMap &, size_t *events = NULL, int threads = 0);
+
+#endif /* SMF_H */
@@ -0,0 +1,162 @@
+#include "trace.h"
+
+#ifdef VOMID_TRACE
+
+#include <QAtomicInteger>
+#include <QCoreApplication>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/* spans kept per thread */
+const int buffer_size = 1 << 14;
+
+struct TraceEvent
+{
+	/* odd while being written, 2 * n + 2 once event n is complete */
+	QAtomicInteger<quint64> seq;
+	const char *name;
+	int tid;
+	long long begin, dur;
+};
+
+/* written by one thread at a time; reused once that thread exits */
+struct TraceBuffer
+{
+	QAtomicInt in_use;
+	int tid;
+	QAtomicInteger<quint64> head;
+	TraceEvent events[buffer_size];
+};
+
+/* guards registration and dumping, never recording */
+static QMutex registry_mutex;
+static std::vector<TraceBuffer *> buffers;
+static QMap<int, QString> thread_names;
+static int last_tid = 0;
+
+struct BufferOwner
+{
+	TraceBuffer *buffer;
+
+	BufferOwner() : buffer(NULL) { }
+	~BufferOwner()
+	{
+		if (buffer != NULL)
+			buffer->in_use.storeRelease(0);
+	}
+};
+
+static thread_local BufferOwner owner;
+
+static long long
+now()
+{
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static QString
+thread_name()
+{
+	QThread *t = QThread::currentThread();
+	if (QCoreApplication::instance() != NULL && t == QCoreApplication::instance()->thread())
+		return "main";
+	if (!t->objectName().isEmpty())
+		return t->objectName();
+	return t->metaObject()->className();
+}
+
+static TraceBuffer *
+local_buffer()
+{
+	if (owner.buffer != NULL)
+		return owner.buffer;
+
+	QMutexLocker lock(&registry_mutex);
+	TraceBuffer *b = NULL;
+	for (size_t i = 0; b == NULL && i < buffers.size(); i++) {
+		if (buffers[i]->in_use.testAndSetOrdered(0, 1))
+			b = buffers[i];
+	}
+	if (b == NULL) {
+		b = new TraceBuffer();
+		b->in_use.storeRelaxed(1);
+		buffers.push_back(b);
+	}
+	b->tid = ++last_tid;
+	thread_names.insert(b->tid, thread_name());
+	return owner.buffer = b;
+}
+
+TraceSpan::TraceSpan(const char *name)
+	:name_(name),
+	begin_(now())
+{
+}
+
+TraceSpan::~TraceSpan()
+{
+	long long end = now();
+	TraceBuffer *b = local_buffer();
+	quint64 n = b->head.loadRelaxed();
+	TraceEvent &e = b->events[n % buffer_size];
+
+	e.seq.storeRelaxed(2 * n + 1);
+	std::atomic_thread_fence(std::memory_order_release);
+	e.name = name_;
+	e.tid = b->tid;
+	e.begin = begin_;
+	e.dur = end - begin_;
+	e.seq.storeRelease(2 * n + 2);
+	b->head.storeRelease(n + 1);
+}
+
+bool
+trace_dump(const QString &path)
+{
+	QFile f(path);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+
+	QMutexLocker lock(&registry_mutex);
+	qint64 pid = QCoreApplication::applicationPid();
+	QByteArray out = "{\"traceEvents\": [\n";
+	bool first = true;
+
+	for (QMap<int, QString>::const_iterator i = thread_names.constBegin(); i != thread_names.constEnd(); ++i) {
+		out += first ? " " : ",";
+		out += QString("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %1, \"tid\": %2, \"args\": {\"name\": \"%3\"}}\n")
+			.arg(pid).arg(i.key()).arg(i.value()).toUtf8();
+		first = false;
+	}
+
+	for (size_t i = 0; i < buffers.size(); i++) {
+		TraceBuffer *b = buffers[i];
+		quint64 head = b->head.loadAcquire();
+		quint64 n = head > quint64(buffer_size) ? head - buffer_size : 0;
+		for (; n < head; n++) {
+			TraceEvent &e = b->events[n % buffer_size];
+			quint64 seq = e.seq.loadAcquire();
+			const char *name = e.name;
+			int tid = e.tid;
+			long long begin = e.begin, dur = e.dur;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			/* skip events overwritten while we read them */
+			if (seq != 2 * n + 2 || e.seq.loadRelaxed() != seq)
+				continue;
+			out += first ? " " : ",";
+			out += QString("{\"name\": \"%1\", \"ph\": \"X\", \"pid\": %2, \"tid\": %3, \"ts\": %4, \"dur\": %5}\n")
+				.arg(QString::fromLatin1(name)).arg(pid).arg(tid).arg(begin / 1e3, 0, 'f', 3).arg(dur / 1e3, 0, 'f', 3).toUtf8();
+			first = false;
+		}
+	}
+	out += "]}\n";
+	return f.write(out) == out.size();
+}
+
+#endif
@@ -0,0 +1,49 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Scoped trace spans, dumped as Chrome trace-event JSON.
+ *
+ *	void File::commit(...)
+ *	{
+ *		TRACE_SPAN("File::commit");
+ *		...
+ *
+ * Spans are only compiled in with VOMID_TRACE defined (the VOMID_TRACE
+ * CMake option); otherwise TRACE_SPAN expands to nothing. Each thread
+ * records into its own ring buffer without locking, so the oldest spans
+ * of a busy thread are overwritten. Names must be string literals.
+ */
+
+#ifdef VOMID_TRACE
+
+#include <QString>
+
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char *name);
+	~TraceSpan();
+
+private:
+	const char *name_;
+	long long begin_;
+};
+
+/* writes the spans recorded so far; safe while other threads record */
+bool trace_dump(const QString &path);
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CAT(trace_span_, __LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name) do { } while (0)
+
+#endif
+
+#endif /* TRACE_H */
@@ -0,0 +1,312 @@
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "file.h"
+#include "transform.h"
+
+/* notes of one track, structure-of-arrays */
+struct NoteBuffer
+{
+	vmd_track_t *track;
+	std::vector<vmd_note_t *> note;
+	std::vector<vmd_time_t> on_time, off_time;
+	std::vector<vmd_pitch_t> pitch;
+	std::vector<int> on_vel, off_vel;
+	/* into the file's channels, or -1 */
+	std::vector<int> channel;
+	std::vector<vmd_time_t> new_on_time, new_off_time;
+	std::vector<int> new_on_vel, new_off_vel;
+
+	void extract(vmd_track_t *);
+	size_t merge_collisions();
+	size_t write_back(File *);
+
+	/* notes that merged into the one before them */
+	std::vector<bool> merged;
+};
+
+void
+NoteBuffer::extract(vmd_track_t *_track)
+{
+	size_t n = vmd_bst_size(&_track->notes);
+	track = _track;
+	note.reserve(n);
+	on_time.reserve(n);
+	off_time.reserve(n);
+	pitch.reserve(n);
+	on_vel.reserve(n);
+	off_vel.reserve(n);
+	channel.reserve(n);
+	VMD_BST_FOREACH(vmd_bst_node_t *i, &track->notes) {
+		vmd_note_t *note = vmd_track_note(i);
+		this->note.push_back(note);
+		on_time.push_back(note->on_time);
+		off_time.push_back(note->off_time);
+		pitch.push_back(note->pitch);
+		on_vel.push_back(note->on_vel);
+		off_vel.push_back(note->off_vel);
+		channel.push_back(note->channel != NULL ? int(note->channel - track->file->channel) : -1);
+	}
+	new_on_time = on_time;
+	new_off_time = off_time;
+	new_on_vel = on_vel;
+	new_off_vel = off_vel;
+}
+
+struct ByPitchTime
+{
+	const NoteBuffer *buf;
+
+	bool operator ()(size_t a, size_t b) const
+	{
+		if (buf->pitch[a] != buf->pitch[b])
+			return buf->pitch[a] < buf->pitch[b];
+		return buf->new_on_time[a] < buf->new_on_time[b];
+	}
+};
+
+/* libvomid refuses a note that overlaps another of its pitch, so notes
+ * moved onto each other are merged before anything is written: the
+ * first one takes the span and the loudest velocities of all, the
+ * others are marked merged. Returns their number.
+ */
+size_t
+NoteBuffer::merge_collisions()
+{
+	std::vector<size_t> order(note.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	ByPitchTime less = {this};
+	std::sort(order.begin(), order.end(), less);
+
+	size_t ret = 0;
+	merged.assign(note.size(), false);
+	for (size_t j = 0; j < order.size(); ) {
+		size_t first = order[j++];
+		while (j < order.size() && pitch[order[j]] == pitch[first]
+		       && new_on_time[order[j]] < new_off_time[first]) {
+			new_off_time[first] = std::max(new_off_time[first], new_off_time[order[j]]);
+			new_on_vel[first] = std::max(new_on_vel[first], new_on_vel[order[j]]);
+			new_off_vel[first] = std::max(new_off_vel[first], new_off_vel[order[j]]);
+			merged[order[j++]] = true;
+			ret++;
+		}
+	}
+	return ret;
+}
+
+size_t
+NoteBuffer::write_back(File *file)
+{
+	std::vector<size_t> moved;
+	size_t ret = 0;
+	for (size_t i = 0; i < note.size(); i++) {
+		if (merged[i] || new_on_time[i] != on_time[i] || new_off_time[i] != off_time[i]) {
+			moved.push_back(i);
+			ret++;
+		} else if (new_on_vel[i] != on_vel[i] || new_off_vel[i] != off_vel[i]) {
+			file->set_velocity(note[i], new_on_vel[i], new_off_vel[i]);
+			ret++;
+		}
+	}
+
+	/* erase first, so that moved notes never collide with their old
+	 * selves; after merging, they collide with nothing else
+	 */
+	for (size_t j = 0; j < moved.size(); j++)
+		file->erase_note(note[moved[j]]);
+	std::vector<NoteData> data;
+	data.reserve(moved.size());
+	for (size_t j = 0; j < moved.size(); j++) {
+		size_t i = moved[j];
+		if (merged[i])
+			continue;
+		NoteData d = {new_on_time[i], new_off_time[i], pitch[i], new_on_vel[i], new_off_vel[i], channel[i]};
+		data.push_back(d);
+	}
+	if (file->insert_notes(track, data) != data.size())
+		qWarning("Transform: some notes could not be inserted");
+	return ret;
+}
+
+/* Kernels. Plain loops over contiguous arrays without calls or
+ * aliasing, so that the compiler can vectorise them.
+ */
+
+static void
+quantize(vmd_time_t *on, vmd_time_t *off, size_t n, vmd_time_t grid, double strength)
+{
+	for (size_t i = 0; i < n; i++) {
+		vmd_time_t snapped = (on[i] + grid / 2) / grid * grid;
+		vmd_time_t d = vmd_time_t(std::floor((snapped - on[i]) * strength + 0.5));
+		on[i] += d;
+		off[i] += d;
+	}
+}
+
+static void
+swing(vmd_time_t *on, vmd_time_t *off, size_t n, vmd_time_t grid, double ratio)
+{
+	vmd_time_t delay = vmd_time_t(2 * grid * ratio) - grid;
+	for (size_t i = 0; i < n; i++) {
+		vmd_time_t d = (on[i] % (2 * grid) == grid) ? delay : 0;
+		on[i] += d;
+		off[i] += d;
+	}
+}
+
+static unsigned
+hash(unsigned x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352dU;
+	x ^= x >> 15;
+	x *= 0x846ca68bU;
+	x ^= x >> 16;
+	return x;
+}
+
+static void
+humanize(vmd_time_t *on, vmd_time_t *off, int *vel, size_t n, size_t base,
+         unsigned seed, vmd_time_t max_shift, int max_vel)
+{
+	for (size_t i = 0; i < n; i++) {
+		unsigned h = hash(unsigned(base + i) * 2654435761U + seed);
+		vmd_time_t d = max_shift > 0 ? vmd_time_t(h % (2 * max_shift + 1)) - max_shift : 0;
+		int dv = max_vel > 0 ? int((h >> 16) % (2 * max_vel + 1)) - max_vel : 0;
+		d = std::max(d, -on[i]);
+		on[i] += d;
+		off[i] += d;
+		vel[i] = std::min(std::max(vel[i] + dv, 1), 127);
+	}
+}
+
+static void
+time_scale(vmd_time_t *on, vmd_time_t *off, size_t n, double factor)
+{
+	for (size_t i = 0; i < n; i++) {
+		vmd_time_t len = off[i] - on[i];
+		on[i] = vmd_time_t(on[i] * factor + 0.5);
+		off[i] = on[i] + std::max(vmd_time_t(len * factor + 0.5), vmd_time_t(1));
+	}
+}
+
+static void
+velocity(int *vel, size_t n, double factor)
+{
+	for (size_t i = 0; i < n; i++)
+		vel[i] = std::min(std::max(int(vel[i] * factor + 0.5), 1), 127);
+}
+
+class TransformJob : public QRunnable
+{
+public:
+	TransformJob(const Transform *_t, NoteBuffer *_buf, size_t _beg, size_t _end)
+		:t(_t), buf(_buf), beg(_beg), end(_end) { }
+
+	void run();
+
+private:
+	const Transform *t;
+	NoteBuffer *buf;
+	size_t beg, end;
+};
+
+Transform::Transform(Op _op, vmd_time_t _grid, double _amount, unsigned _seed)
+	:op_(_op),
+	grid_(std::max(_grid, vmd_time_t(1))),
+	amount_(_amount),
+	seed_(_seed)
+{
+}
+
+const char *
+Transform::descr() const
+{
+	switch (op_) {
+	case QUANTIZE:   return "Quantize";
+	case SWING:      return "Swing";
+	case HUMANIZE:   return "Humanize";
+	case TIME_SCALE: return "Time Scale";
+	case VELOCITY:   return "Scale Velocity";
+	}
+	return "Transform";
+}
+
+void
+Transform::run(NoteBuffer *buf, size_t beg, size_t end) const
+{
+	vmd_time_t *on = &buf->new_on_time[beg];
+	vmd_time_t *off = &buf->new_off_time[beg];
+	int *vel = &buf->new_on_vel[beg];
+	size_t n = end - beg;
+
+	switch (op_) {
+	case QUANTIZE:
+		quantize(on, off, n, grid_, amount_);
+		break;
+	case SWING:
+		swing(on, off, n, grid_, amount_);
+		break;
+	case HUMANIZE:
+		humanize(on, off, vel, n, beg, seed_ + vmd_track_idx(buf->track), grid_, int(amount_ * 127));
+		break;
+	case TIME_SCALE:
+		time_scale(on, off, n, amount_);
+		break;
+	case VELOCITY:
+		velocity(vel, n, amount_);
+		break;
+	}
+}
+
+void
+TransformJob::run()
+{
+	t->run(buf, beg, end);
+}
+
+/* notes per job; small enough to balance, big enough to amortise */
+const size_t slice = 1 << 15;
+
+Transform::Stats
+Transform::apply(File *file) const
+{
+	Stats stats = {0, 0, 0, 0, 0};
+	QElapsedTimer total;
+	total.start();
+
+	file->require_all();
+	std::vector<NoteBuffer> bufs(file->tracks);
+	for (int i = 0; i < file->tracks; i++) {
+		bufs[i].extract(file->track[i]);
+		stats.notes += bufs[i].note.size();
+	}
+
+	QElapsedTimer kernel;
+	kernel.start();
+	QThreadPool pool;
+	pool.setMaxThreadCount(QThread::idealThreadCount());
+	for (size_t i = 0; i < bufs.size(); i++) {
+		for (size_t beg = 0; beg < bufs[i].note.size(); beg += slice) {
+			size_t end = std::min(beg + slice, bufs[i].note.size());
+			pool.start(new TransformJob(this, &bufs[i], beg, end));
+		}
+	}
+	pool.waitForDone();
+	stats.kernel_sec = kernel.nsecsElapsed() / 1e9;
+
+	for (size_t i = 0; i < bufs.size(); i++)
+		stats.merged += bufs[i].merge_collisions();
+	for (size_t i = 0; i < bufs.size(); i++)
+		stats.changed += bufs[i].write_back(file);
+	if (stats.changed > 0)
+		file->commit(descr());
+
+	stats.total_sec = total.nsecsElapsed() / 1e9;
+	return stats;
+}
@@ -0,0 +1,60 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <vomid.h>
+
+class File;
+struct NoteBuffer;
+
+/* Bulk note transforms over a whole file.
+ *
+ * The notes of all tracks are extracted into structure-of-arrays
+ * buffers, the kernels run over slices of the buffers on a thread pool,
+ * and the moved notes are written back under a single commit. Notes of
+ * one pitch that end up overlapping are merged into one with the
+ * loudest of their velocities, rather than lost to the collision.
+ * Velocity changes are made in place.
+ */
+class Transform
+{
+public:
+	enum Op {
+		QUANTIZE,     /* snap on_time to the grid; strength in [0, 1] */
+		SWING,        /* delay every second grid step; amount is the swing ratio, 0.5 is straight */
+		HUMANIZE,     /* random shift of up to grid ticks and velocity change of up to amount * 127 */
+		TIME_SCALE,   /* stretch times by amount around time 0 */
+		VELOCITY      /* multiply velocities by amount */
+	};
+
+	struct Stats
+	{
+		size_t notes;
+		size_t changed;
+		/* notes merged into others they were moved onto */
+		size_t merged;
+		double kernel_sec;
+		double total_sec;
+
+		double notes_per_sec() const { return kernel_sec > 0 ? notes / kernel_sec : 0; }
+	};
+
+	Transform(Op op, vmd_time_t grid, double amount, unsigned seed = 1);
+
+	Stats apply(File *) const;
+	const char *descr() const;
+
+	/* runs the kernel over notes [beg, end) of the buffer */
+	void run(NoteBuffer *, size_t beg, size_t end) const;
+
+private:
+	Op op_;
+	vmd_time_t grid_;
+	double amount_;
+	unsigned seed_;
+};
+
+#endif /* TRANSFORM_H */
@@ -1,18 +1,23 @@
-#include <QFileDialog>
 #include <QFileInfo>
 #include <QInputDialog>
+#include <QRandomGenerator>
 #include <QScrollBar>
 #include "file.h"
+#include "file_loader.h"
+#include "trace.h"
+#include "transform.h"
 #include "ui_w_file.h"
 #include "ui_w_main.h"
 #include "w_file.h"
 #include "w_file_info.h"
 #include "w_piano.h"
+#include "w_scala_picker.h"
 #include "w_track.h"
 
-WFile::WFile(File *_file, Player *_player, Ui_WMain *_main_ui)
+WFile::WFile(File *_file, Player *_player, ScalaLibrary *_scala, Ui_WMain *_main_ui)
 	:file_(_file),
 	player_(_player),
+	scala_(_scala),
 	main_ui_(_main_ui)
 {
 	file_->setParent(this);
@@ -20,6 +25,7 @@ WFile::WFile(File *_file, Player *_player, Ui_WMain *_main_ui)
 	ui->scroll_area->setFocusPolicy(Qt::NoFocus);
 	ui->scroll_area->horizontalScrollBar()->setFocusPolicy(Qt::NoFocus);
 	ui->scroll_area->verticalScrollBar()->setFocusPolicy(Qt::NoFocus);
+	ui->loading->hide();
 
 	connect(file_, SIGNAL(acted()), this, SLOT(update_label()));
 	connect(file_, SIGNAL(acted()), this, SLOT(update_tracks()));
@@ -52,6 +58,7 @@ WFile::open_track(vmd_track_t *track)
 	WPiano *piano = track ? new WPiano(file_, track, t, player_) : NULL;
 	ui->scroll_area->setWidget(piano);
 	if (piano != NULL) {
+		connect(piano, SIGNAL(message(QString)), main_ui_->statusbar, SLOT(showMessage(QString)));
 		piano->setFocus(Qt::OtherFocusReason);
 		piano->adjust_y();
 	}
@@ -60,9 +67,26 @@ WFile::open_track(vmd_track_t *track)
 	return piano;
 }
 
+void
+WFile::set_loader(FileLoader *loader)
+{
+	ui->loading->show();
+	connect(loader, SIGNAL(progress(int, int)), this, SLOT(load_progress(int, int)));
+	connect(loader, SIGNAL(loaded()), ui->loading, SLOT(hide()));
+	connect(ui->load_cancel, SIGNAL(clicked()), loader, SLOT(cancel()));
+}
+
+void
+WFile::load_progress(int value, int maximum)
+{
+	ui->load_progress->setMaximum(maximum);
+	ui->load_progress->setValue(value);
+}
+
 void
 WFile::update_tracks()
 {
+	TRACE_SPAN("WFile::update_tracks");
 	int i;
 	if (vmd_track_idx(track()) < 0) {
 		// WTF: doesn't work
@@ -109,27 +133,101 @@ WFile::addTet()
 {
 	bool ok;
 	int n = QInputDialog::getInt(this, "vomid", "Enter scale base:", 17, 2, 100, 1, &ok);
-	if (ok) {
-		vmd_track_t *track = file()->add_track();
-		vmd_track_set_notesystem(track, vmd_notesystem_tet(n));
-	}
+	if (ok)
+		file()->add_track(VMD_CHANMASK_NODRUMS, QString::number(n));
 }
 
 void
 WFile::addScala()
 {
-	QString fn = QFileDialog::getOpenFileName(
-		this,
-		QString(),
-		QString(),
-		"Scala files (*.scl);;All files (*)"
+	WScalaPicker picker(scala_, this);
+	if (picker.exec() && picker.tuning().valid())
+		file()->add_track(VMD_CHANMASK_NODRUMS, picker.tuning().notesystem());
+}
+
+bool
+WFile::ask_grid(const QString &prompt, vmd_time_t *ret)
+{
+	bool ok;
+	QString s = QInputDialog::getText(this, "vomid", prompt, QLineEdit::Normal, "1/16", &ok);
+	QStringList sl = s.split("/");
+	if (!ok || sl.size() != 2)
+		return false;
+	int n = sl[0].toInt();
+	int m = sl[1].toInt();
+	if (n <= 0 || m <= 0)
+		return false;
+	*ret = file()->division * 4 * n / m;
+	return *ret > 0;
+}
+
+void
+WFile::transform(const Transform &t)
+{
+	Transform::Stats st = t.apply(file());
+	main_ui_->statusbar->showMessage(
+		QString("%1: %2 of %3 notes changed, %4 merged, %5 Mnotes/s, %6 ms total")
+			.arg(t.descr())
+			.arg(st.changed)
+			.arg(st.notes)
+			.arg(st.merged)
+			.arg(st.notes_per_sec() / 1e6, 0, 'f', 1)
+			.arg(st.total_sec * 1000, 0, 'f', 1)
 	);
+}
 
-	vmd_notesystem_t ns = vmd_notesystem_import(fn.toLocal8Bit().data());
-	if (ns.pitches != NULL) {
-		vmd_track_t *track = file()->add_track();
-		vmd_track_set_notesystem(track, ns);
-	}
+void
+WFile::quantize()
+{
+	vmd_time_t grid;
+	if (!ask_grid("Quantize to grid:", &grid))
+		return;
+	bool ok;
+	int strength = QInputDialog::getInt(this, "vomid", "Strength (%):", 100, 0, 100, 1, &ok);
+	if (ok)
+		transform(Transform(Transform::QUANTIZE, grid, strength / 100.0));
+}
+
+void
+WFile::swing()
+{
+	vmd_time_t grid;
+	if (!ask_grid("Swing grid:", &grid))
+		return;
+	bool ok;
+	int ratio = QInputDialog::getInt(this, "vomid", "Swing (%, 50 is straight):", 66, 50, 75, 1, &ok);
+	if (ok)
+		transform(Transform(Transform::SWING, grid, ratio / 100.0));
+}
+
+void
+WFile::humanize()
+{
+	bool ok;
+	int ticks = QInputDialog::getInt(this, "vomid", "Max time shift (ticks):", file()->division / 32, 0, file()->division, 1, &ok);
+	if (!ok)
+		return;
+	int vel = QInputDialog::getInt(this, "vomid", "Max velocity change (%):", 10, 0, 100, 1, &ok);
+	if (ok)
+		transform(Transform(Transform::HUMANIZE, ticks, vel / 100.0, QRandomGenerator::global()->generate()));
+}
+
+void
+WFile::timeScale()
+{
+	bool ok;
+	double pct = QInputDialog::getDouble(this, "vomid", "Time scale (%):", 100, 1, 10000, 2, &ok);
+	if (ok && pct != 100)
+		transform(Transform(Transform::TIME_SCALE, 1, pct / 100.0));
+}
+
+void
+WFile::scaleVelocity()
+{
+	bool ok;
+	int pct = QInputDialog::getInt(this, "vomid", "Velocity scale (%):", 100, 1, 1000, 1, &ok);
+	if (ok && pct != 100)
+		transform(Transform(Transform::VELOCITY, 1, pct / 100.0));
 }
 
 void
@@ -6,11 +6,15 @@
 #define W_FILE_H
 
 #include <QFrame>
+#include <vomid.h>
 #include "util.h"
 
 struct vmd_track_t;
 class File;
+class FileLoader;
 class Player;
+class ScalaLibrary;
+class Transform;
 class Ui_WFile;
 class Ui_WMain;
 class WPiano;
@@ -20,13 +24,15 @@ class WFile : public QFrame
 	Q_OBJECT
 
 public:
-	WFile(File *, Player *, Ui_WMain *);
+	WFile(File *, Player *, ScalaLibrary *, Ui_WMain *);
 
 	File *file() const { return file_; }
+	Player *player() const { return player_; }
 	WPiano *piano() const;
 	vmd_track_t *track() const;
 
 	WPiano *open_track(vmd_track_t *);
+	void set_loader(FileLoader *);
 
 public slots:
 	void update_label();
@@ -37,11 +43,22 @@ public slots:
 	void addTet();
 	void addScala();
 
+	void quantize();
+	void swing();
+	void humanize();
+	void timeScale();
+	void scaleVelocity();
+
 	void showInfo();
+	void load_progress(int, int);
 
 private:
+	bool ask_grid(const QString &, vmd_time_t *);
+	void transform(const Transform &);
+
 	File *file_;
 	Player *player_;
+	ScalaLibrary *scala_;
 
 	pimpl_ptr<Ui_WFile> ui;
 	Ui_WMain *main_ui_;
@@ -1,8 +1,12 @@
+#include <QTimer>
 #include <vomid.h>
+#include "clipboard.h"
 #include "file.h"
+#include "player.h"
 #include "ui_w_file_info.h"
 #include "w_file.h"
 #include "w_file_info.h"
+#include "selection.h"
 #include "w_piano.h"
 
 enum {
@@ -10,6 +14,28 @@ enum {
 	TYPE_CHANNEL = QTreeWidgetItem::UserType + 1
 };
 
+/* how often the diagnostics are refreshed */
+const int diagnostics_msec = 500;
+
+static QString
+bytes_text(size_t bytes)
+{
+	if (bytes < 1024)
+		return QString::number(bytes) + " B";
+	if (bytes < 1024 * 1024)
+		return QString::number(bytes / 1024.0, 'f', 1) + " KiB";
+	return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MiB";
+}
+
+static QString
+timing_text(const FileStats::Summary &s)
+{
+	if (s.count == 0)
+		return "-";
+	return QString("last %1 ms, avg %2 ms, max %3 ms (%4 total)")
+		.arg(s.last_ms, 0, 'f', 2).arg(s.avg_ms, 0, 'f', 2).arg(s.max_ms, 0, 'f', 2).arg(s.count);
+}
+
 struct TrackItem : public QTreeWidgetItem
 {
 	TrackItem(QTreeWidget *tree) : QTreeWidgetItem(tree, TYPE_TRACK) { }
@@ -27,7 +53,8 @@ struct ChannelItem : public QTreeWidgetItem
 
 WFileInfo::WFileInfo(WFile *_wfile)
 	: QDialog(NULL),
-	wfile_(_wfile)
+	wfile_(_wfile),
+	diagnostics_timer_(new QTimer(this))
 {
 	ui->setupUi(this);
 	ui->fileName->setText(file()->filename());
@@ -59,6 +86,14 @@ WFileInfo::WFileInfo(WFile *_wfile)
 	ui->channelsTree->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
 	connect(ui->channelsTree, SIGNAL(itemDoubleClicked(QTreeWidgetItem *, int)),
 	        this, SLOT(channelsTreeItemDoubleClicked(QTreeWidgetItem *, int)));
+
+	setAttribute(Qt::WA_DeleteOnClose);
+	connect(wfile_, SIGNAL(destroyed()), diagnostics_timer_, SLOT(stop()));
+	connect(wfile_, SIGNAL(destroyed()), this, SLOT(close()));
+	connect(diagnostics_timer_, SIGNAL(timeout()), this, SLOT(update_diagnostics()));
+	update_diagnostics();
+	ui->diagnosticsTree->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
+	diagnostics_timer_->start(diagnostics_msec);
 }
 
 File *WFileInfo::file() const
@@ -71,18 +106,51 @@ void WFileInfo::channelsTreeItemDoubleClicked(QTreeWidgetItem *item, int)
 	if (item->type() == TYPE_TRACK) {
 		TrackItem *ti = static_cast<TrackItem *>(item);
 		WPiano *piano = wfile_->open_track(ti->track);
-		piano->setSelection(NULL);
+		piano->setSelection(Selection());
 	} else if (item->type() == TYPE_CHANNEL) {
 		ChannelItem *ci = static_cast<ChannelItem *>(item);
 		WPiano *piano = wfile_->open_track(ci->track);
-		vmd_note_t *sel = NULL;
+		Selection sel(file(), ci->track);
 		VMD_BST_FOREACH(vmd_bst_node_t *i, &ci->track->notes) {
 			vmd_note_t *n = vmd_track_note(i);
-			if (n->channel != ci->channel)
-				continue;
-			n->next = sel;
-			sel = n;
+			if (n->channel == ci->channel)
+				sel.add(n);
 		}
 		piano->setSelection(sel);
 	}
 }
+
+void WFileInfo::update_diagnostics()
+{
+	File::Usage usage = file()->usage();
+	FileStats *stats = file()->stats();
+	Player *player = wfile_->player();
+	QString lateness = "-";
+	if (player->file() == file()) {
+		lateness = QString("last %1 ms, max %2 ms")
+			.arg(player->lateness(), 0, 'f', 1).arg(player->max_lateness(), 0, 'f', 1);
+	}
+
+	const QString rows[][2] = {
+		{"Notes", QString::number(usage.notes) + " (" + bytes_text(usage.note_bytes) + ")"},
+		{"Revisions", QString::number(usage.revisions)},
+		{"Committed edits", bytes_text(usage.edit_bytes)},
+		{"Render caches", bytes_text(usage.cache_bytes)},
+		{"Clipboard", bytes_text(Clipboard::instance()->memory())},
+		{"Commit", timing_text(stats->summary(FileStats::COMMIT))},
+		{"Undo/redo", timing_text(stats->summary(FileStats::UNDO))},
+		{"Paint", timing_text(stats->summary(FileStats::PAINT))},
+		{"Import", timing_text(stats->summary(FileStats::IMPORT))},
+		{"Playback lateness", lateness},
+	};
+	const int n = sizeof(rows) / sizeof(rows[0]);
+
+	QTreeWidget *tree = ui->diagnosticsTree;
+	for (int i = 0; i < n; i++) {
+		QTreeWidgetItem *item = tree->topLevelItem(i);
+		if (item == NULL)
+			item = new QTreeWidgetItem(tree);
+		item->setText(0, rows[i][0]);
+		item->setText(1, rows[i][1]);
+	}
+}
@@ -9,6 +9,7 @@
 #include "util.h"
 
 class File;
+class QTimer;
 class QTreeWidgetItem;
 class Ui_FileInfoDialog;
 class WFile;
@@ -24,9 +25,11 @@ public:
 
 public slots:
 	void channelsTreeItemDoubleClicked(QTreeWidgetItem *, int);
+	void update_diagnostics();
 
 private:
 	WFile *wfile_;
+	QTimer *diagnostics_timer_;
 	pimpl_ptr<Ui_FileInfoDialog> ui;
 };
 
@@ -1,14 +1,20 @@
 #include <QActionGroup>
 #include <QCloseEvent>
+#include <QElapsedTimer>
 #include <QFileInfo>
 #include <QFileDialog>
 #include <QLabel>
 #include <QMessageBox>
 #include <QSignalMapper>
 #include <QStyle>
+#include <stdexcept>
+#include "device_scanner.h"
 #include "file.h"
+#include "file_loader.h"
+#include "journal.h"
 #include "player.h"
 #include "slot_proxy.h"
+#include "trace.h"
 #include "ui_w_main.h"
 #include "w_main.h"
 #include "w_file.h"
@@ -26,22 +32,24 @@ struct WMain::Impl
 	QActionGroup output_devices;
 	QSignalMapper device_mapper;
 	Player *player;
+	ScalaLibrary *scala;
+	DeviceScanner *devices;
+	/* of the files being opened, reported once all have finished */
+	QStringList load_errors;
+	QElapsedTimer startup;
+	qint64 first_frame_msec;
 
-	Impl(WMain *owner) : output_devices(owner) { }
+	Impl(WMain *owner) : output_devices(owner), first_frame_msec(-1) { }
 };
 
-static void
-enum_clb(const char *id, const char *name, void *me)
-{
-	((WMain *)me)->add_output_device(id, name);
-}
 
-WMain::WMain(Player *_player)
+WMain::WMain(Player *_player, ScalaLibrary *_scala)
 	: pimpl(this)
 {
 	pimpl->ui.setupUi(this);
 	pimpl->ui.statusbar->addPermanentWidget(pimpl->ui.file_compatible);
 	pimpl->player = _player;
+	pimpl->scala = _scala;
 
 	FILE_ACTION(Undo, undo());
 	FILE_ACTION(Redo, redo());
@@ -50,6 +58,11 @@ WMain::WMain(Player *_player)
 	WFILE_ACTION(TrkDrums, addDrums());
 	WFILE_ACTION(TrkTet, addTet());
 	WFILE_ACTION(TrkScala, addScala());
+	WFILE_ACTION(Quantize, quantize());
+	WFILE_ACTION(Swing, swing());
+	WFILE_ACTION(Humanize, humanize());
+	WFILE_ACTION(TimeScale, timeScale());
+	WFILE_ACTION(Velocity, scaleVelocity());
 
 	STDICON(New,     SP_FileIcon);
 	STDICON(Open,    SP_DialogOpenButton);
@@ -64,34 +77,85 @@ WMain::WMain(Player *_player)
 	STDSHORTCUT(Undo);
 	STDSHORTCUT(Redo);
 
+#ifdef VOMID_TRACE
+	QAction *dump_trace = new QAction("Dump Trace...", this);
+	pimpl->ui.menuFile->insertAction(pimpl->ui.actionQuit, dump_trace);
+	connect(dump_trace, SIGNAL(triggered()), this, SLOT(menu_dump_trace()));
+#endif
+
 	current_changed();
 	connect(&pimpl->device_mapper, SIGNAL(mapped(QString)), pimpl->player, SLOT(set_output_device(QString)));
 	connect(pimpl->player, SIGNAL(outputDeviceSet(QString)), this, SLOT(output_device_set(QString)));
-	vmd_enum_devices(VMD_OUTPUT_DEVICE, enum_clb, this);
+	connect(pimpl->ui.actionTuningMts, SIGNAL(toggled(bool)), pimpl->player, SLOT(set_mts(bool)));
+	pimpl->devices = new DeviceScanner(pimpl->player, this);
+	connect(pimpl->devices, SIGNAL(changed(QStringList, QStringList)),
+	        this, SLOT(output_devices_changed(QStringList, QStringList)));
+	connect(pimpl->ui.menuOutputDevices, SIGNAL(aboutToShow()), pimpl->devices, SLOT(rescan()));
+	pimpl->devices->start();
 }
 
 void
-WMain::add_output_device(const char *id, const char *name)
+WMain::time_startup(const QElapsedTimer &since)
+{
+	pimpl->startup = since;
+}
+
+qint64
+WMain::first_frame_msec() const
 {
-	QString label = QString(id) + QString("\t") + QString::fromLocal8Bit(name);
-	QAction *act = pimpl->ui.menuOutputDevices->addAction(label);
-	act->setData(QString(id));
-	pimpl->output_devices.addAction(act);
-	connect(act, SIGNAL(triggered()), &pimpl->device_mapper, SLOT(map()));
-	pimpl->device_mapper.setMapping(act, QString(id));
-
-	static bool set = false;
-	if (!set && pimpl->player->set_output_device(id))
-		set = true;
+	return pimpl->first_frame_msec;
 }
 
 void
-WMain::open(File *f)
+WMain::output_devices_changed(QStringList ids, QStringList names)
+{
+	foreach (QAction *act, pimpl->output_devices.actions()) {
+		pimpl->output_devices.removeAction(act);
+		delete act;
+	}
+	for (int i = 0; i < ids.size(); i++) {
+		QAction *act = pimpl->ui.menuOutputDevices->addAction(ids[i] + "\t" + names[i]);
+		act->setData(ids[i]);
+		pimpl->output_devices.addAction(act);
+		connect(act, SIGNAL(triggered()), &pimpl->device_mapper, SLOT(map()));
+		pimpl->device_mapper.setMapping(act, ids[i]);
+	}
+	output_device_set(pimpl->player->output_device());
+}
+
+WFile *
+WMain::open(File *f, int index)
 {
-	WFile *wfile = new WFile(f, pimpl->player, &pimpl->ui);
-	pimpl->ui.tabs->setCurrentIndex(pimpl->ui.tabs->addTab(wfile, ""));
+	WFile *wfile = new WFile(f, pimpl->player, pimpl->scala, &pimpl->ui);
+	pimpl->ui.tabs->setCurrentIndex(pimpl->ui.tabs->insertTab(index, wfile, ""));
 	wfile->update_label();
 	connect(f, SIGNAL(acted()), this, SLOT(current_changed()));
+	connect(f, SIGNAL(saveFailed(QString)), this, SLOT(save_failed(QString)));
+	return wfile;
+}
+
+void
+WMain::load(const QString &path)
+{
+	File *f = new File();
+	f->set_filename(path);
+	FileLoader *loader = new FileLoader(f, path);
+	open(f)->set_loader(loader);
+	connect(loader, SIGNAL(replaced(File *)), this, SLOT(load_replaced(File *)));
+	connect(loader, SIGNAL(failed(QString)), this, SLOT(load_failed(QString)));
+	connect(loader, SIGNAL(canceled()), this, SLOT(load_canceled()));
+	loader->start();
+}
+
+int
+WMain::index_of(File *f)
+{
+	for (int i = 0; i < pimpl->ui.tabs->count(); i++) {
+		WFile *w = qobject_cast<WFile *>(pimpl->ui.tabs->widget(i));
+		if (w != NULL && w->file() == f)
+			return i;
+	}
+	return -1;
 }
 
 File *
@@ -120,16 +184,11 @@ WMain::menu_open()
 		this,
 		QString(),
 		QString(),
-		"Midi files (*.mid);;All files (*)"
+		"Vomid and Midi files (*.vomid *.mid);;All files (*)"
 	);
 
-	foreach (const QString &i, files) {
-		try {
-			open(new File(i));
-		} catch (...) {
-			qWarning("Failed to open file");
-		}
-	}
+	foreach (const QString &i, files)
+		load(i);
 }
 
 void
@@ -142,6 +201,7 @@ WMain::menu_save()
 		menu_saveas();
 	else
 		f->save_as(f->filename());
+	current_changed();
 }
 
 void
@@ -155,12 +215,47 @@ WMain::menu_saveas()
 		this,
 		QString(),
 		QString(),
-		"Midi files (*.mid);;All files (*)"
+		"Midi files (*.mid);;Vomid projects (*.vomid);;All files (*)"
 	);
 	fd.setAcceptMode(QFileDialog::AcceptSave);
 	fd.setDefaultSuffix("mid");
 	if (fd.exec())
 		f->save_as(fd.selectedFiles().first());
+	current_changed();
+}
+
+void
+WMain::menu_bounce()
+{
+	File *f = file();
+	if (f == NULL)
+		return;
+
+	QFileDialog fd(
+		this,
+		QString(),
+		QString(),
+		"Midi files (*.mid);;All files (*)"
+	);
+	fd.setAcceptMode(QFileDialog::AcceptSave);
+	fd.setDefaultSuffix("mid");
+	if (fd.exec())
+		f->bounce(fd.selectedFiles().first(), pimpl->player->mts() ? PlaybackPlan::MTS : PlaybackPlan::BEND);
+}
+
+void
+WMain::menu_dump_trace()
+{
+#ifdef VOMID_TRACE
+	QString fn = QFileDialog::getSaveFileName(
+		this,
+		QString(),
+		"vomid-trace.json",
+		"Trace files (*.json);;All files (*)"
+	);
+	if (!fn.isEmpty() && !trace_dump(fn))
+		QMessageBox::warning(this, "vomid", "Failed to write " + fn);
+#endif
 }
 
 bool
@@ -173,6 +268,11 @@ WMain::close_tab(int idx)
 	}
 	pimpl->ui.tabs->setCurrentIndex(idx);
 	File *f = file();
+	FileLoader *loader = f->findChild<FileLoader *>();
+	if (loader != NULL && loader->busy()) {
+		loader->cancel();
+		return true;
+	}
 	bool close = true;
 	if (!f->saved()) {
 		int btn = QMessageBox::question(
@@ -185,6 +285,7 @@ WMain::close_tab(int idx)
 		switch (btn) {
 		case QMessageBox::Save:
 			menu_save();
+			f->wait_saved();
 			close = f->saved();
 			break;
 		case QMessageBox::Cancel:
@@ -196,10 +297,99 @@ WMain::close_tab(int idx)
 		}
 	}
 	if (close)
-		pimpl->ui.tabs->removeTab(idx);
+		discard_tab(idx);
 	return close;
 }
 
+void
+WMain::load_replaced(File *f)
+{
+	FileLoader *loader = qobject_cast<FileLoader *>(sender());
+	int idx = index_of(loader->file());
+	if (idx < 0) {
+		delete f;
+		return;
+	}
+	discard_tab(idx);
+	open(f, idx);
+}
+
+void
+WMain::load_failed(QString error)
+{
+	FileLoader *loader = qobject_cast<FileLoader *>(sender());
+	QString msg = QFileInfo(loader->path()).fileName() + ": " + error;
+	pimpl->load_errors << msg;
+	pimpl->ui.statusbar->showMessage("Failed to open " + msg);
+	load_canceled();
+
+	for (int i = 0; i < pimpl->ui.tabs->count(); i++) {
+		WFile *w = qobject_cast<WFile *>(pimpl->ui.tabs->widget(i));
+		FileLoader *other = w ? w->file()->findChild<FileLoader *>() : NULL;
+		if (other != NULL && other->busy())
+			return;
+	}
+	QMessageBox::warning(this, "vomid", "Failed to open:\n" + pimpl->load_errors.join("\n"));
+	pimpl->load_errors.clear();
+}
+
+void
+WMain::load_canceled()
+{
+	FileLoader *loader = qobject_cast<FileLoader *>(sender());
+	int idx = index_of(loader->file());
+	if (idx >= 0)
+		discard_tab(idx);
+}
+
+void
+WMain::discard_tab(int idx)
+{
+	WFile *w = qobject_cast<WFile *>(pimpl->ui.tabs->widget(idx));
+	if (pimpl->player->file() == w->file())
+		pimpl->player->stop();
+	pimpl->ui.tabs->removeTab(idx);
+	w->deleteLater();
+}
+
+void
+WMain::recover()
+{
+	QStringList found;
+	QStringList orphans = Journal::orphans();
+	for (int i = 0; i < orphans.size(); i++) {
+		if (File::recoverable(orphans[i]))
+			found << orphans[i];
+		else
+			Journal::remove(orphans[i]);
+	}
+	if (found.isEmpty())
+		return;
+
+	int btn = QMessageBox::question(
+		this,
+		"vomid",
+		QString("Unsaved changes to %1 file(s) were left by a previous session. Recover them?").arg(found.size()),
+		QMessageBox::Yes | QMessageBox::No
+	);
+	for (int i = 0; i < found.size(); i++) {
+		if (btn == QMessageBox::Yes) {
+			try {
+				open(File::recover(found[i]));
+			} catch (const std::exception &ex) {
+				qWarning("%s: %s", found[i].toLocal8Bit().data(), ex.what());
+			}
+		}
+		Journal::remove(found[i]);
+	}
+}
+
+void
+WMain::save_failed(QString msg)
+{
+	QMessageBox::warning(this, "vomid", "Failed to save " + msg);
+}
+
 void
 WMain::output_device_set(QString id)
 {
@@ -220,22 +410,26 @@ WMain::current_changed()
 	pimpl->file_proxy.setTarget(f);
 	pimpl->wfile_proxy.setTarget(wfile());
 
+	/* files still loading are only viewed and played */
+	bool editable = f != NULL && !f->loading();
+
 	/* File */
-	pimpl->ui.actionSave->setEnabled(f && !f->saved());
-	pimpl->ui.actionSaveAs->setEnabled(f != NULL);
+	pimpl->ui.actionSave->setEnabled(editable && !f->saved());
+	pimpl->ui.actionSaveAs->setEnabled(editable);
+	pimpl->ui.actionBounce->setEnabled(editable);
 	pimpl->ui.actionClose->setEnabled(f != NULL);
 	pimpl->ui.actionInfo->setEnabled(f != NULL);
 
 	/* Edit */
-	pimpl->ui.menuEdit->setEnabled(f != NULL);
-	if (f && f->revision()->prev() != NULL) {
+	pimpl->ui.menuEdit->setEnabled(editable);
+	if (editable && f->revision()->prev() != NULL) {
 		pimpl->ui.actionUndo->setText("Undo " + f->revision()->descr());
 		pimpl->ui.actionUndo->setEnabled(true);
 	} else {
 		pimpl->ui.actionUndo->setText("Undo");
 		pimpl->ui.actionUndo->setEnabled(false);
 	}
-	if (f && f->revision()->next() != NULL) {
+	if (editable && f->revision()->next() != NULL) {
 		pimpl->ui.actionRedo->setText("Redo " + f->revision()->next()->descr());
 		pimpl->ui.actionRedo->setEnabled(true);
 	} else {
@@ -244,12 +438,14 @@ WMain::current_changed()
 	}
 
 	/* Track */
-	pimpl->ui.menuTrack->setEnabled(f != NULL);
+	pimpl->ui.menuTrack->setEnabled(editable);
 
 	/* Status Bar */
 	QString file_status;
 	if (f == NULL)
 		file_status = "No file";
+	else if (f->saving())
+		file_status = "Saving...";
 	else if (vmd_file_is_compatible(f))
 		file_status = "Compatible";
 	else
@@ -257,6 +453,20 @@ WMain::current_changed()
 	pimpl->ui.file_compatible->setText(file_status);
 }
 
+void
+WMain::paintEvent(QPaintEvent *ev)
+{
+	QMainWindow::paintEvent(ev);
+	if (pimpl->first_frame_msec >= 0 || !pimpl->startup.isValid())
+		return;
+	pimpl->first_frame_msec = pimpl->startup.elapsed();
+	if (pimpl->first_frame_msec > first_frame_target_msec) {
+		qWarning("first frame after %lld ms, over the %d ms target",
+			(long long)pimpl->first_frame_msec, first_frame_target_msec);
+	}
+	emit firstFrame();
+}
+
 void
 WMain::closeEvent(QCloseEvent *ev)
 {
@@ -266,5 +476,7 @@ WMain::closeEvent(QCloseEvent *ev)
 			return;
 		}
 	}
+	/* the files' journals go with them, before the event loop ends */
+	QCoreApplication::sendPostedEvents(NULL, QEvent::DeferredDelete);
 	ev->accept();
 }
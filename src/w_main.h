@@ -6,10 +6,13 @@
 #define W_MAIN_H
 
 #include <QMainWindow>
+#include <QStringList>
 #include "util.h"
 
 class File;
+class QElapsedTimer;
 class Player;
+class ScalaLibrary;
 class WFile;
 
 class WMain : public QMainWindow
@@ -17,26 +20,51 @@ class WMain : public QMainWindow
 	Q_OBJECT
 
 public:
-	WMain(Player *);
-	void add_output_device(const char *id, const char *name);
-	void open(File *);
+	/* startups slower than this are reported */
+	static const int first_frame_target_msec = 500;
+
+	WMain(Player *, ScalaLibrary *);
+	/* the first paint is timed from since, and reported if slow */
+	void time_startup(const QElapsedTimer &since);
+	/* -1 until painted */
+	qint64 first_frame_msec() const;
+	WFile *open(File *, int index = -1);
+	void load(const QString &);
 	File *file();
 	WFile *wfile();
+	int index_of(File *);
+	/* offers to recover files left unsaved by a crashed session */
+	void recover();
 
 public slots:
 	bool close_tab(int = -1);
 	void output_device_set(QString);
+	void output_devices_changed(QStringList ids, QStringList names);
 
 	void menu_new();
 	void menu_open();
 	void menu_save();
 	void menu_saveas();
+	void menu_bounce();
+	/* only in VOMID_TRACE builds */
+	void menu_dump_trace();
 	void current_changed();
 
+	void load_replaced(File *);
+	void load_failed(QString);
+	void load_canceled();
+	void save_failed(QString);
+
+signals:
+	void firstFrame();
+
 protected:
 	void closeEvent(QCloseEvent *);
+	void paintEvent(QPaintEvent *);
 
 private:
+	void discard_tab(int);
+
 	struct Impl;
 	pimpl_ptr<Impl> pimpl;
 };
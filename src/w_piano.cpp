@@ -5,8 +5,12 @@
 #include <QScrollArea>
 #include <QScrollBar>
 #include <QToolTip>
+#include <limits>
+#include "clipboard.h"
 #include "file.h"
+#include "note_index.h"
 #include "player.h"
+#include "trace.h"
 #include "w_main.h"
 #include "w_piano.h"
 
@@ -14,16 +18,15 @@
 #include <windows.h>
 #endif
 
-static File clipboard_file;
-static vmd_track_t *clipboard = NULL;
-static bool clipboard_time_relative;
-static bool clipboard_pitch_relative;
-
 const int margin = 50;
 const int level_height = 5;
 const int scroll_margin = 5;
 const int quarter_width = 50;
 const int update_freq = 10;
+/* notes loaded ahead of playback, for files opened out of core */
+const int prefetch_quarters = 16;
+/* how long playback waits for the plan of a new revision */
+const int plan_wait_msec = 250;
 
 struct PianoPalette : public QPalette
 {
@@ -107,32 +110,19 @@ level2pitch(const vmd_track_t *track, int level, bool round_up = false)
 	return octaves * ns->size + octave_pitch;
 }
 
-struct avg_note_arg {
-	vmd_track_t *track;
-	int min;
-	int max;
-};
-
-static void *
-avg_note_clb(vmd_note_t *note, void *_arg)
-{
-	avg_note_arg *arg = (avg_note_arg *)_arg;
-	int level = pitch2level(note->track, note->pitch);
-	arg->min = std::min(arg->min, level);
-	arg->max = std::max(arg->max, level);
-	return NULL;
-}
-
 static int
-avg_level(vmd_track_t *track, vmd_time_t beg, vmd_time_t end)
-{
-	avg_note_arg arg = {
-		track,
-		levels(track),
-		0
-	};
-	vmd_track_for_range(track, beg, end, avg_note_clb, &arg);
-	return (arg.min + arg.max) / 2;
+avg_level(const NoteIndex *index, vmd_time_t beg, vmd_time_t end)
+{
+	vmd_track_t *track = index->track();
+	int min = levels(track), max = 0;
+	std::vector<NoteIndex::Run> runs;
+	index->runs(beg, end, 0, std::numeric_limits<vmd_pitch_t>::max(), runs);
+	for (size_t i = 0; i < runs.size(); i++) {
+		int level = pitch2level(track, runs[i].pitch);
+		min = std::min(min, level);
+		max = std::max(max, level);
+	}
+	return (min + max) / 2;
 }
 
 WPiano::WPiano(File *_file, vmd_track_t *_track, vmd_time_t time, Player *_player)
@@ -144,7 +134,6 @@ WPiano::WPiano(File *_file, vmd_track_t *_track, vmd_time_t time, Player *_playe
 	cursor_size_(file()->division),
 	cursor_level_(0),
 	pivot_enabled_(false),
-	selection_(NULL),
 	player_(_player)
 {
 	int w = time2x(vmd_file_length(file()));
@@ -251,7 +240,7 @@ void
 WPiano::set_pivot()
 {
 	if (!pivot_enabled_) {
-		setSelection(NULL);
+		setSelection(Selection());
 		pivot_time_ = cursor_time_;
 		pivot_level_ = cursor_level_;
 		pivot_enabled_ = true;
@@ -287,7 +276,7 @@ WPiano::noteAtCursor()
 	vmd_pitch_t p = cursorPitch();
 	if (p < 0)
 		return NULL;
-	return (vmd_note_t *)vmd_track_range(track(), cursorTime(), cursorEndTime(), p, p + 1);
+	return file()->index(track())->at(cursorTime(), p);
 }
 
 WPiano::Rect
@@ -320,27 +309,30 @@ WPiano::selectionRect(bool returnAllIfEmpty) const
 	return ret;
 }
 
-vmd_note_t *
+Selection
 WPiano::selection(bool returnAllIfEmpty) const
 {
 	if (pivot_enabled_) {
 		Rect r = selectionRect(returnAllIfEmpty);
 		vmd_pitch_t p_beg = level2pitch(track(), r.level_beg, true);
 		vmd_pitch_t p_end = level2pitch(track(), r.level_end, true);
-		return vmd_track_range(track(), r.time_beg, r.time_end, p_beg, p_end);
+		std::vector<vmd_note_t *> notes;
+		file()->require(r.time_beg, r.time_end);
+		file()->index(track())->collect(r.time_beg, r.time_end, p_beg, p_end, notes);
+
+		Selection ret(file(), track());
+		ret.set(notes);
+		return ret;
 	} else
 		return selection_;
 }
 
 void
-WPiano::setSelection(vmd_note_t *sel)
+WPiano::setSelection(const Selection &sel)
 {
-	VMD_BST_FOREACH(vmd_bst_node_t *i, &track_->notes)
-		vmd_track_note(i)->mark = 0;
 	pivot_enabled_ = false;
 	selection_ = sel;
-	for (vmd_note_t *i = selection_; i != NULL; i = i->next)
-		i->mark = 1;
+	update();
 }
 
 void
@@ -399,8 +391,17 @@ WPiano::keyPressEvent(QKeyEvent *ev)
 		drop_pivot();
 		if (playing())
 			player_->stop();
-		else
-			player_->play(file(), cursor_time_);
+		else {
+			file()->require(cursor_time_, cursor_time_ + vmd_time_t(file()->division) * prefetch_quarters);
+			QSharedPointer<const PlaybackPlan> plan =
+				file()->plan(player_->mts() ? PlaybackPlan::MTS : PlaybackPlan::BEND, plan_wait_msec);
+			/* without a plan, libvomid bends the notes */
+			if (plan.isNull() && player_->mts())
+				emit message(file()->pager() != NULL
+					? "Files opened out of core are tuned by pitch bends"
+					: "Tuned by pitch bends until the MTS plan is ready");
+			player_->play(file(), cursor_time_, plan);
+		}
 		break;
 	case Qt::Key_QuoteLeft:
 		{
@@ -454,40 +455,47 @@ WPiano::keyPressEvent(QKeyEvent *ev)
 		break;
 	case Qt::Key_C:
 		if (mod == Qt::CTRL) {
-			if (clipboard == NULL)
-				clipboard = vmd_track_create(&clipboard_file, VMD_CHANMASK_ALL);
-
 			Rect s = selectionRect();
-			vmd_time_t base_time = s.time_beg;
-			int base_pitch = level2pitch(track(), s.level_beg, true);
-
-			clipboard_time_relative = s.time_end != VMD_MAX_TIME;
-			clipboard_pitch_relative = s.level_end <= levels(track());
-			vmd_track_clear(clipboard);
-			for (vmd_note_t *i = selection(); i != NULL; i = i->next)
-				vmd_copy_note(i, clipboard, -base_time, -base_pitch);
+			Clipboard::Range r = {
+				s.time_beg,
+				s.time_end,
+				level2pitch(track(), s.level_beg, true),
+				level2pitch(track(), s.level_end, true)
+			};
+
+			if (pivot_enabled_)
+				Clipboard::instance()->copy(file(), track(), r,
+					s.time_end != VMD_MAX_TIME,
+					s.level_end <= levels(track()));
+			else
+				Clipboard::instance()->copy(selection_, r.time_beg, r.pitch_beg);
 		}
 		break;
 	case Qt::Key_V:
-		if (mod == Qt::CTRL) {
-			vmd_time_t t = clipboard_time_relative ? cursorTime() : 0;
-			vmd_pitch_t p = clipboard_pitch_relative ? cursorPitch() : 0;
-			if (clipboard == NULL || p < 0)
+		if (mod == Qt::CTRL && editable()) {
+			Clipboard *clipboard = Clipboard::instance();
+			vmd_time_t t = clipboard->timeRelative() ? cursorTime() : 0;
+			vmd_pitch_t p = clipboard->pitchRelative() ? cursorPitch() : 0;
+			if (clipboard->empty() || p < 0)
 				break;
 
-			VMD_BST_FOREACH(vmd_bst_node_t *i, &clipboard->notes)
-				vmd_copy_note(vmd_track_note(i), track(), t, p);
+			clipboard->paste(file(), track(), t, p);
 			file()->commit("Paste Notes");
 			drop_pivot();
 		}
 		break;
 	case Qt::Key_Delete:
-		for (vmd_note_t *i = selection(); i != NULL; i = i->next)
-			vmd_erase_note(i);
+		if (!editable())
+			break;
+		{
+			std::vector<vmd_note_t *> notes = selection().notes();
+			for (size_t i = 0; i < notes.size(); i++)
+				file()->erase_note(notes[i]);
+		}
 		file()->commit("Erase Notes");
 		drop_pivot();
 	case Qt::Key_T:
-		if (mod == Qt::CTRL) {
+		if (mod == Qt::CTRL && editable()) {
 			int dPitch = QInputDialog::getInt(
 				this,
 				"vomid",
@@ -495,10 +503,10 @@ WPiano::keyPressEvent(QKeyEvent *ev)
 			);
 			if (dPitch == 0)
 				break;
-			for (vmd_note_t *i = selection(), *next; i != NULL; i = next) {
-				next = i->next;
-				vmd_copy_note(i, track(), 0, dPitch);
-				vmd_erase_note(i);
+			std::vector<vmd_note_t *> notes = selection().notes();
+			for (size_t i = 0; i < notes.size(); i++) {
+				file()->copy_note(notes[i], track(), 0, dPitch);
+				file()->erase_note(notes[i]);
 			}
 			file()->commit("Transpose");
 		}
@@ -576,25 +584,27 @@ draw_measure(const vmd_measure_t *measure, void *_painter)
 	}
 }
 
-static void *
-draw_note(vmd_note_t *note, void *_painter)
+static void
+draw_notes(QPainter *painter, const NoteIndex::Run &run)
 {
-	QPainter *painter = static_cast<QPainter *>(_painter);
 	WPiano *piano = static_cast<WPiano *>(painter->device());
+	int y = piano->level2y(pitch2level(piano->track(), run.pitch));
 
 	QPen pen;
 	pen.setWidth(level_height - 1);
 	pen.setCapStyle(Qt::FlatCap);
-	if (note->mark)
-		pen.setColor(Qt::blue);
+	bool selected = false;
 	painter->setPen(pen);
-
-	int level = pitch2level(piano->track(), note->pitch);
-	int y = piano->level2y(level);
-	int x1 = piano->time2x(note->on_time);
-	int x2 = piano->time2x(note->off_time);
-	painter->drawLine(x1, y, x2 - 1, y);
-	return NULL;
+	for (size_t i = 0; i < run.size; i++) {
+		if (piano->isSelected(run.notes[i]) != selected) {
+			selected = !selected;
+			pen.setColor(selected ? Qt::blue : Qt::black);
+			painter->setPen(pen);
+		}
+		int x1 = piano->time2x(run.on_time[i]);
+		int x2 = piano->time2x(run.off_time[i]);
+		painter->drawLine(x1, y, x2 - 1, y);
+	}
 }
 
 enum {
@@ -618,10 +628,16 @@ level_style(const vmd_track_t *track, int level)
 void
 WPiano::paintEvent(QPaintEvent *ev)
 {
+	TRACE_SPAN("WPiano::paintEvent");
+	FileStats::Timer timer(file()->stats(), FileStats::PAINT);
 	QPainter painter(this);
 	QPen pen;
 	vmd_time_t beg = x2time(ev->rect().left());
 	vmd_time_t end = x2time(ev->rect().right());
+	vmd_pitch_t pitch_beg = level2pitch(track(), std::max(y2level(ev->rect().bottom()) - 1, 0), true);
+	vmd_pitch_t pitch_end = level2pitch(track(), y2level(ev->rect().top()) + 2, true);
+	if (file()->pager() != NULL)
+		schedule_prefetch();
 
 	/* background */
 	painter.setPen(Qt::NoPen);
@@ -659,7 +675,10 @@ WPiano::paintEvent(QPaintEvent *ev)
 	}
 
 	/* notes */
-	vmd_track_for_range(track(), beg, end, draw_note, &painter);
+	std::vector<NoteIndex::Run> runs;
+	file()->index(track())->runs(beg, end, pitch_beg, pitch_end, runs);
+	for (size_t i = 0; i < runs.size(); i++)
+		draw_notes(&painter, runs[i]);
 
 	/* cursor */
 	if (playing()) {
@@ -681,20 +700,62 @@ WPiano::paintEvent(QPaintEvent *ev)
 	}
 }
 
+void
+WPiano::moveEvent(QMoveEvent *)
+{
+	/* scrolled */
+	if (file()->pager() != NULL)
+		schedule_prefetch();
+}
+
+void
+WPiano::resizeEvent(QResizeEvent *)
+{
+	if (file()->pager() != NULL)
+		schedule_prefetch();
+}
+
+void
+WPiano::schedule_prefetch()
+{
+	if (!prefetch_timer_.isActive())
+		prefetch_timer_.start(0, this);
+}
+
+void
+WPiano::prefetch()
+{
+	QRect v = viewport();
+	file()->require(x2time(v.left()), x2time(v.right()) + vmd_time_t(file()->division) * prefetch_quarters);
+}
+
 void
 WPiano::timerEvent(QTimerEvent *ev)
 {
 	if (ev->timerId() == update_timer_.timerId()) {
-		if (playing() && cursor_time_ != player_->time()) {
-			vmd_time_t prev_time = cursor_time_;
-			setCursorTime(player_->time());
-			if (timeVisible(prev_time))
-				look_at_cursor();
-		} else if (mouse_captured_)
+		if (playing())
+			follow_player();
+		else if (mouse_captured_)
 			clipCursor();
+	} else if (ev->timerId() == prefetch_timer_.timerId()) {
+		prefetch_timer_.stop();
+		prefetch();
 	}
 }
 
+void
+WPiano::follow_player()
+{
+	vmd_time_t time = player_->time();
+	if (!playing() || time == cursor_time_)
+		return;
+	vmd_time_t prev_time = cursor_time_;
+	file()->require(time, time + vmd_time_t(file()->division) * prefetch_quarters);
+	setCursorTime(time);
+	if (timeVisible(prev_time))
+		look_at_cursor();
+}
+
 void
 WPiano::capture_mouse(bool capture)
 {
@@ -787,7 +848,7 @@ void
 WPiano::adjust_y()
 {
 	Rect vp = qrect2rect(viewport());
-	cursor_level_ = avg_level(track(), vp.time_beg, vp.time_end);
+	cursor_level_ = avg_level(file()->index(track()), vp.time_beg, vp.time_end);
 	look_at_cursor(CENTER);
 }
 
@@ -795,11 +856,16 @@ void
 WPiano::toggle_note()
 {
 	vmd_pitch_t p = cursorPitch();
-	if (p < 0)
+	if (p < 0 || !editable())
 		return;
-	int erased = vmd_erase_notes(vmd_track_range(track(), cursorTime(), cursorEndTime(), p, p + 1));
-	if (erased <= 0) {
-		vmd_track_insert(track(), cursorTime(), cursorEndTime(), p);
+	std::vector<vmd_note_t *> notes;
+	file()->index(track())->collect(cursorTime(), cursorEndTime(), p, p + 1, notes);
+	for (size_t i = 0; i < notes.size(); i++)
+		file()->erase_note(notes[i]);
+
+	size_t erased = notes.size();
+	if (erased == 0) {
+		file()->insert_note(track(), cursorTime(), cursorEndTime(), p);
 		file()->commit("Insert Note");
 	} else if (erased == 1) {
 		file()->commit("Erase Note");
@@ -807,6 +873,15 @@ WPiano::toggle_note()
 		file()->commit("Erase Notes");
 }
 
+bool
+WPiano::editable()
+{
+	if (!file()->loading())
+		return true;
+	emit message("The file can be edited once it is loaded");
+	return false;
+}
+
 bool
 WPiano::playing() const
 {
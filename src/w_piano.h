@@ -8,6 +8,7 @@
 #include <QWidget>
 #include <QBasicTimer>
 #include <vomid.h>
+#include "selection.h"
 
 struct vmd_track_t;
 class File;
@@ -58,8 +59,9 @@ public:
 	void setCursorLevel(int l) { setCursorPos(cursor_time_, l); }
 	vmd_note_t *noteAtCursor();
 	Rect selectionRect(bool returnAllIfEmpty = false) const;
-	vmd_note_t *selection(bool returnAllIfEmpty = false) const;
-	void setSelection(vmd_note_t *);
+	Selection selection(bool returnAllIfEmpty = false) const;
+	void setSelection(const Selection &);
+	bool isSelected(vmd_note_t *n) const { return selection_.contains(n); }
 
 	vmd_track_t *track() const { return track_; }
 	File *file() const { return file_; }
@@ -68,16 +70,24 @@ public:
 	void adjust_y();
 	void toggle_note();
 	bool playing() const;
+	/* moves the cursor to the player's time, paging the view after it;
+	 * called periodically during playback
+	 */
+	void follow_player();
 
 signals:
 	void cursorMoved();
+	/* for the status bar */
+	void message(QString);
 
 protected:
 	void focusOutEvent(QFocusEvent *);
 	void keyPressEvent(QKeyEvent *);
 	void mouseMoveEvent(QMouseEvent *);
 	void mousePressEvent(QMouseEvent *);
+	void moveEvent(QMoveEvent *);
 	void paintEvent(QPaintEvent *);
+	void resizeEvent(QResizeEvent *);
 	void timerEvent(QTimerEvent *);
 
 	enum LookMode {
@@ -97,7 +107,16 @@ protected slots:
 	void clipCursor();
 
 private:
+	/* false, with a message, while the file is loading */
+	bool editable();
+	/* loads the pages of the viewport and some ahead; painting only
+	 * schedules it, so the file doesn't change in paintEvent()
+	 */
+	void prefetch();
+	void schedule_prefetch();
+
 	QBasicTimer update_timer_;
+	QBasicTimer prefetch_timer_;
 
 	File *file_;
 	vmd_track_t *track_;
@@ -110,7 +129,7 @@ private:
 	bool pivot_enabled_;
 	vmd_time_t pivot_time_;
 	int pivot_level_;
-	vmd_note_t *selection_;
+	Selection selection_;
 
 	Player *player_;
 };
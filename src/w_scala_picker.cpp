@@ -0,0 +1,130 @@
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
+#include "ui_w_scala_picker.h"
+#include "w_scala_picker.h"
+
+WScalaPicker::WScalaPicker(ScalaLibrary *_library, QWidget *parent)
+	: QDialog(parent),
+	library_(_library)
+{
+	tuning_.mtime = 0;
+	tuning_.end_pitch = 0;
+	ui->setupUi(this);
+	ui->tunings->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
+	connect(ui->filter, SIGNAL(textChanged(QString)), this, SLOT(filter(QString)));
+	connect(ui->tunings, SIGNAL(itemDoubleClicked(QTreeWidgetItem *, int)),
+	        this, SLOT(itemDoubleClicked(QTreeWidgetItem *, int)));
+	connect(ui->library, SIGNAL(clicked()), this, SLOT(chooseLibrary()));
+	connect(ui->browse, SIGNAL(clicked()), this, SLOT(browse()));
+	connect(ui->buttons, SIGNAL(accepted()), this, SLOT(accept()));
+	connect(ui->buttons, SIGNAL(rejected()), this, SLOT(reject()));
+	connect(library_, SIGNAL(progress(int, int)), this, SLOT(scan_progress(int, int)));
+	connect(library_, SIGNAL(scanned()), this, SLOT(populate()));
+	populate();
+	ui->filter->setFocus(Qt::OtherFocusReason);
+}
+
+void
+WScalaPicker::populate()
+{
+	QString current;
+	if (ui->tunings->currentItem() != NULL)
+		current = tunings_[ui->tunings->currentItem()->data(0, Qt::UserRole).toInt()].path;
+
+	tunings_ = library_->tunings();
+	ui->tunings->clear();
+	QList<QTreeWidgetItem *> items;
+	for (int i = 0; i < tunings_.size(); i++) {
+		const ScalaTuning &t = tunings_[i];
+		if (!t.valid())
+			continue;
+		QTreeWidgetItem *item = new QTreeWidgetItem();
+		item->setText(0, QFileInfo(t.path).completeBaseName());
+		item->setText(1, QString::number(t.pitches.size()));
+		item->setText(2, t.description);
+		item->setToolTip(0, t.path);
+		item->setData(0, Qt::UserRole, i);
+		items << item;
+	}
+	ui->tunings->addTopLevelItems(items);
+	for (int i = 0; i < items.size(); i++) {
+		if (tunings_[items[i]->data(0, Qt::UserRole).toInt()].path == current)
+			ui->tunings->setCurrentItem(items[i]);
+	}
+	filter(ui->filter->text());
+
+	if (library_->dir().isEmpty())
+		ui->status->setText("No library directory");
+	else
+		ui->status->setText(QString::number(items.size()) + " tunings in " + library_->dir());
+}
+
+void
+WScalaPicker::filter(QString text)
+{
+	QStringList words = text.split(' ', Qt::SkipEmptyParts);
+	for (int i = 0; i < ui->tunings->topLevelItemCount(); i++) {
+		QTreeWidgetItem *item = ui->tunings->topLevelItem(i);
+		bool match = true;
+		for (int j = 0; match && j < words.size(); j++) {
+			match = item->text(0).contains(words[j], Qt::CaseInsensitive)
+			     || item->text(2).contains(words[j], Qt::CaseInsensitive);
+		}
+		item->setHidden(!match);
+	}
+}
+
+void
+WScalaPicker::chooseLibrary()
+{
+	QString dir = QFileDialog::getExistingDirectory(this, QString(), library_->dir());
+	if (dir.isEmpty())
+		return;
+	library_->scan(dir);
+	populate();
+	ui->status->setText("Scanning...");
+}
+
+void
+WScalaPicker::browse()
+{
+	QString fn = QFileDialog::getOpenFileName(
+		this,
+		QString(),
+		library_->dir(),
+		"Scala files (*.scl);;All files (*)"
+	);
+	if (fn.isEmpty())
+		return;
+
+	ScalaTuning t = ScalaLibrary::parse(fn);
+	if (!t.valid()) {
+		QMessageBox::warning(this, "vomid", "Failed to load " + fn);
+		return;
+	}
+	tuning_ = t;
+	QDialog::accept();
+}
+
+void
+WScalaPicker::scan_progress(int value, int maximum)
+{
+	ui->status->setText("Scanning " + QString::number(value) + "/" + QString::number(maximum) + "...");
+}
+
+void
+WScalaPicker::itemDoubleClicked(QTreeWidgetItem *, int)
+{
+	accept();
+}
+
+void
+WScalaPicker::accept()
+{
+	QTreeWidgetItem *item = ui->tunings->currentItem();
+	if (item == NULL || item->isHidden())
+		return;
+	tuning_ = tunings_[item->data(0, Qt::UserRole).toInt()];
+	QDialog::accept();
+}
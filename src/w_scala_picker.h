@@ -0,0 +1,42 @@
+/* (C)opyright 2010 Anton Novikov
+ * See LICENSE file for license details.
+ */
+
+#ifndef W_SCALA_PICKER_H
+#define W_SCALA_PICKER_H
+
+#include <QDialog>
+#include <QVector>
+#include "scala_library.h"
+#include "util.h"
+
+class QTreeWidgetItem;
+class Ui_ScalaPickerDialog;
+
+class WScalaPicker : public QDialog
+{
+	Q_OBJECT
+
+public:
+	WScalaPicker(ScalaLibrary *, QWidget *parent = NULL);
+
+	/* valid() is false unless a tuning was chosen */
+	ScalaTuning tuning() const { return tuning_; }
+
+public slots:
+	void accept();
+	void populate();
+	void filter(QString);
+	void chooseLibrary();
+	void browse();
+	void scan_progress(int, int);
+	void itemDoubleClicked(QTreeWidgetItem *, int);
+
+private:
+	ScalaLibrary *library_;
+	QVector<ScalaTuning> tunings_;
+	ScalaTuning tuning_;
+	pimpl_ptr<Ui_ScalaPickerDialog> ui;
+};
+
+#endif /* W_SCALA_PICKER_H */
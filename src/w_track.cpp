@@ -12,13 +12,10 @@ WTrack::WTrack(WFile *_wfile, int _idx)
 	:wfile(_wfile), idx(_idx)
 {
 	ui->setupUi(this);
-	if (program_menu == NULL) {
+	/* filled when first shown; any live track does it */
+	if (program_menu == NULL)
 		program_menu = new QMenu();
-		for (int i = 0; i < VMD_PROGRAMS; i++) {
-			QAction *act = program_menu->addAction(vmd_gm_program_name[i]);
-			act->setData(i);
-		}
-	}
+	connect(program_menu, SIGNAL(aboutToShow()), this, SLOT(fill_program_menu()));
 	update_track();
 	connect(ui->program, SIGNAL(triggered(QAction *)), this, SLOT(program_chosen(QAction *)));
 	connect(ui->volume, SIGNAL(valueChanged(int)), this, SLOT(volume_set(int)));
@@ -39,8 +36,9 @@ WTrack::update_track()
 	} else {
 		ui->program->setText(vmd_gm_program_name[vmd_track_get_ctrl(track, VMD_CCTRL_PROGRAM)]);
 		ui->program->setMenu(program_menu);
-		ui->program->setEnabled(true);
+		ui->program->setEnabled(!wfile->file()->loading());
 	}
+	ui->volume->setEnabled(!wfile->file()->loading());
 	ui->volume->blockSignals(true);
 	ui->volume->setValue(vmd_track_get_ctrl(track, VMD_CCTRL_VOLUME));
 	ui->volume->update();
@@ -53,16 +51,27 @@ WTrack::open(bool on)
 	wfile->open_track(on ? wfile->file()->track[idx] : NULL);
 }
 
+void
+WTrack::fill_program_menu()
+{
+	if (!program_menu->isEmpty())
+		return;
+	for (int i = 0; i < VMD_PROGRAMS; i++) {
+		QAction *act = program_menu->addAction(vmd_gm_program_name[i]);
+		act->setData(i);
+	}
+}
+
 void
 WTrack::program_chosen(QAction *act)
 {
-	vmd_track_set_ctrl(wfile->file()->track[idx], VMD_CCTRL_PROGRAM, act->data().toInt());
+	wfile->file()->set_ctrl(wfile->file()->track[idx], VMD_CCTRL_PROGRAM, act->data().toInt());
 	wfile->file()->commit("Set Program");
 }
 
 void
 WTrack::volume_set(int v)
 {
-	vmd_track_set_ctrl(wfile->file()->track[idx], VMD_CCTRL_VOLUME, v);
+	wfile->file()->set_ctrl(wfile->file()->track[idx], VMD_CCTRL_VOLUME, v);
 	wfile->file()->commit("Set Volume");
 }
@@ -23,6 +23,7 @@ public:
 
 public slots:
 	void open(bool);
+	void fill_program_menu();
 	void program_chosen(QAction *);
 	void volume_set(int);
 
@@ -0,0 +1,153 @@
+/* NoteIndex against vmd_track_for_range(): the same notes for random
+ * range and hit queries over tracks with short, long and edited notes.
+ *
+ * usage: note_index_test [notes] [queries]
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <vomid.h>
+#include "note_index.h"
+
+static unsigned rnd_state = 1;
+
+static unsigned
+rnd(unsigned n)
+{
+	rnd_state = rnd_state * 1103515245 + 12345;
+	return (rnd_state >> 8) % n;
+}
+
+static void *
+push_clb(vmd_note_t *note, void *notes)
+{
+	static_cast<std::vector<vmd_note_t *> *>(notes)->push_back(note);
+	return NULL;
+}
+
+struct Reference
+{
+	vmd_pitch_t pitch_beg, pitch_end;
+	std::vector<vmd_note_t *> notes;
+};
+
+static void *
+reference_clb(vmd_note_t *note, void *_ref)
+{
+	Reference *ref = static_cast<Reference *>(_ref);
+	if (note->pitch >= ref->pitch_beg && note->pitch < ref->pitch_end)
+		ref->notes.push_back(note);
+	return NULL;
+}
+
+static int failures = 0;
+
+static void
+fail(const char *what, vmd_time_t tb, vmd_time_t te, vmd_pitch_t pb, vmd_pitch_t pe)
+{
+	if (failures++ < 10)
+		printf("%s: [%ld, %ld) x [%d, %d)\n", what, long(tb), long(te), pb, pe);
+}
+
+static void
+check(const char *what, std::vector<vmd_note_t *> &got, std::vector<vmd_note_t *> &want,
+      vmd_time_t tb, vmd_time_t te, vmd_pitch_t pb, vmd_pitch_t pe)
+{
+	std::sort(got.begin(), got.end());
+	std::sort(want.begin(), want.end());
+	if (got != want)
+		fail(what, tb, te, pb, pe);
+}
+
+static void
+query(vmd_track_t *track, const NoteIndex &index, vmd_time_t tb, vmd_time_t te, vmd_pitch_t pb, vmd_pitch_t pe)
+{
+	Reference ref = {pb, pe, std::vector<vmd_note_t *>()};
+	vmd_track_for_range(track, tb, te, reference_clb, &ref);
+	std::vector<vmd_note_t *> &want = ref.notes, got;
+
+	index.for_range(tb, te, pb, pe, push_clb, &got);
+	check("for_range", got, want, tb, te, pb, pe);
+
+	got.clear();
+	index.collect(tb, te, pb, pe, got);
+	check("collect", got, want, tb, te, pb, pe);
+
+	got.clear();
+	std::vector<NoteIndex::Run> runs;
+	index.runs(tb, te, pb, pe, runs);
+	for (size_t i = 0; i < runs.size(); i++) {
+		const NoteIndex::Run &r = runs[i];
+		for (size_t j = 0; j < r.size; j++) {
+			vmd_note_t *n = r.notes[j];
+			if (n->pitch != r.pitch || n->on_time != r.on_time[j] || n->off_time != r.off_time[j]
+			    || n->on_vel != r.velocity[j])
+				fail("run fields", tb, te, pb, pe);
+			got.push_back(n);
+		}
+	}
+	check("runs", got, want, tb, te, pb, pe);
+
+	if (te == tb + 1 && pe == pb + 1) {
+		vmd_note_t *n = index.at(tb, pb);
+		if (want.empty() ? n != NULL : std::find(want.begin(), want.end(), n) == want.end())
+			fail("at", tb, te, pb, pe);
+	}
+}
+
+static void
+run(int notes, int queries, int long_every)
+{
+	vmd_file_t file;
+	vmd_file_init(&file);
+	vmd_track_t *track = vmd_track_create(&file, VMD_CHANMASK_ALL);
+	for (int i = 0; i < notes; i++) {
+		vmd_time_t on = vmd_time_t(i) * file.division / 8;
+		vmd_time_t len = 1 + rnd(file.division);
+		if (long_every > 0 && i % long_every == 0)
+			len = file.division * 64;
+		if (vmd_note_t *n = vmd_track_insert(track, on, on + len, 24 + rnd(72)))
+			n->on_vel = 1 + rnd(127);
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		NoteIndex index(track);
+		vmd_time_t length = vmd_track_length(track);
+		for (int i = 0; i < queries; i++) {
+			vmd_time_t tb = rnd(length + 1);
+			vmd_pitch_t pb = rnd(100);
+			if (i % 2 == 0)
+				query(track, index, tb, tb + 1, pb, pb + 1);
+			else
+				query(track, index, tb, tb + 1 + rnd(file.division * 8), pb, pb + 1 + rnd(48));
+		}
+		query(track, index, 0, VMD_MAX_TIME, 0, VMD_MAX_PITCH);
+
+		/* and after erasing and moving some */
+		std::vector<vmd_note_t *> all;
+		vmd_track_for_range(track, 0, VMD_MAX_TIME, push_clb, &all);
+		for (size_t i = 0; i < all.size(); i += 3) {
+			if (i % 2 == 0)
+				vmd_copy_note(all[i], track, rnd(file.division), 1);
+			vmd_erase_note(all[i]);
+		}
+	}
+	vmd_file_fini(&file);
+}
+
+int
+main(int argc, char **argv)
+{
+	int notes = argc > 1 ? atoi(argv[1]) : 20000;
+	int queries = argc > 2 ? atoi(argv[2]) : 5000;
+
+	run(0, 10, 0);
+	run(notes, queries, 0);
+	run(notes, queries, 16);
+	if (failures > 0) {
+		printf("%d mismatches\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,421 @@
+/* Player on a virtual clock: the note-ons of a file with tempo changes
+ * are recorded at the times its tempo map gives, when played from the
+ * start, from a seek position and through the file's playback plan,
+ * which is rendered on the pool; a plan started past retuned notes sends
+ * each channel's last setup once; an MTS plan tunes the notes of a track
+ * to its notesystem, leaving the drum channel alone; stop() ends
+ * playback at once; and a WPiano following a stepped playback keeps the
+ * cursor at the player's time and pages the view after it.
+ *
+ * usage: player_test
+ */
+#include <QApplication>
+#include <QMutex>
+#include <QScrollArea>
+#include <QScrollBar>
+#include <QThread>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <vomid.h>
+#include "clock.h"
+#include "file.h"
+#include "playback_plan.h"
+#include "player.h"
+#include "w_piano.h"
+
+/* tempo changes, in microseconds per quarter */
+struct Tempo
+{
+	int quarter;
+	int tempo;
+};
+
+static const Tempo tempos[] = {
+	{0, 500000},
+	{8, 250000},
+	{16, 1000000},
+	{20, 400000},
+};
+static const int tempo_count = sizeof(tempos) / sizeof(tempos[0]);
+static const int quarters = 32;
+
+static int failures = 0;
+
+static void
+fail(const char *what, double got, double want)
+{
+	printf("%s: %g, want %g\n", what, got, want);
+	failures++;
+}
+
+class Recorder : public PlayerSink
+{
+public:
+	void event(const unsigned char *ev, size_t size, double time)
+	{
+		/* note-ons only; a zero velocity is a note-off */
+		if (size < 3 || (ev[0] & 0xF0) != 0x90 || ev[2] == 0)
+			return;
+		QMutexLocker lock(&mutex);
+		times.push_back(time);
+	}
+
+	std::vector<double> take()
+	{
+		QMutexLocker lock(&mutex);
+		std::vector<double> ret;
+		ret.swap(times);
+		return ret;
+	}
+
+	size_t count()
+	{
+		QMutexLocker lock(&mutex);
+		return times.size();
+	}
+
+private:
+	QMutex mutex;
+	std::vector<double> times;
+};
+
+/* counts the channel messages sent at the start, and the notes */
+class SetupCounter : public PlayerSink
+{
+public:
+	SetupCounter() : start(-1), notes(0)
+	{
+		memset(counts, 0, sizeof(counts));
+	}
+
+	void event(const unsigned char *ev, size_t size, double time)
+	{
+		if (size == 0)
+			return;
+		int type = ev[0] & 0xF0, c = ev[0] & 0x0F;
+		if (type == 0x90)
+			notes++;
+		if (start < 0)
+			start = time;
+		if (time > start)
+			return;
+		/* program 0, controllers 1..128, bend 129; parameter numbers
+		 * and data entry are a sequence, sent in order
+		 */
+		bool parameter = ev[1] == 6 || ev[1] == 38 || (ev[1] >= 96 && ev[1] <= 101);
+		if (type == 0xC0)
+			counts[c][0]++;
+		else if (type == 0xB0 && size == 3 && !parameter)
+			counts[c][1 + ev[1]]++;
+		else if (type == 0xE0)
+			counts[c][129]++;
+	}
+
+	double start;
+	int notes;
+	int counts[16][130];
+};
+
+/* the tuning of each key as sent, and the pitches of the notes */
+class TuningRecorder : public PlayerSink
+{
+public:
+	TuningRecorder() : drums(0), programs(0)
+	{
+		for (int k = 0; k < 128; k++)
+			key_pitch[k] = k << 14;
+	}
+
+	void event(const unsigned char *ev, size_t size, double)
+	{
+		if (size == 0)
+			return;
+		if (ev[0] == 0xF0 && size >= 8 && ev[3] == 0x08 && ev[4] == 0x02) {
+			if (ev[5] != 1)
+				programs++;
+			for (int i = 0; i < ev[6]; i++) {
+				const unsigned char *k = ev + 7 + 4 * i;
+				key_pitch[k[0]] = (k[1] << 14) + (k[2] << 7) + k[3];
+			}
+			return;
+		}
+		if ((ev[0] & 0x0F) == 9)
+			drums++;
+		else if ((ev[0] & 0xF0) == 0x90 && size == 3 && ev[2] > 0)
+			pitches.push_back(key_pitch[ev[1]]);
+	}
+
+	int key_pitch[128];
+	std::vector<int> pitches;
+	/* messages on the drum channel, retunes of other programs */
+	int drums, programs;
+};
+
+/* seconds from tick from to tick to */
+static double
+seconds(int division, vmd_time_t from, vmd_time_t to)
+{
+	double ret = 0;
+	for (int i = 0; i < tempo_count; i++) {
+		vmd_time_t beg = vmd_time_t(tempos[i].quarter) * division;
+		vmd_time_t end = i + 1 < tempo_count ? vmd_time_t(tempos[i + 1].quarter) * division : VMD_MAX_TIME;
+		beg = std::max(beg, from);
+		end = std::min(end, to);
+		if (beg < end)
+			ret += double(end - beg) * tempos[i].tempo / 1e6 / division;
+	}
+	return ret;
+}
+
+/* a note on every quarter, with the tempo changes above */
+static vmd_track_t *
+make_file(File *file)
+{
+	for (int i = 0; i < tempo_count; i++)
+		vmd_map_set(&file->ctrl[VMD_FCTRL_TEMPO], vmd_time_t(tempos[i].quarter) * file->division, tempos[i].tempo);
+	vmd_track_t *track = file->add_track();
+	for (int q = 0; q < quarters; q++) {
+		vmd_time_t t = vmd_time_t(q) * file->division;
+		vmd_note_t *note = vmd_track_insert(track, t, t + file->division / 2, 60 + q % 12);
+		note->on_vel = 100;
+	}
+	file->reset_history();
+	return track;
+}
+
+static void
+check_play(const char *name, File *file, vmd_time_t from,
+           QSharedPointer<const PlaybackPlan> plan = QSharedPointer<const PlaybackPlan>())
+{
+	VirtualClock clock(false, 100);
+	Recorder rec;
+	Player player(&clock, &rec);
+	player.play(file, from, plan);
+	player.wait();
+	player.stop();
+
+	std::vector<double> times = rec.take();
+	int first = int((from + file->division - 1) / file->division);
+	if (times.size() != size_t(quarters - first)) {
+		fail(name, times.size(), quarters - first);
+		return;
+	}
+	for (size_t i = 0; i < times.size(); i++) {
+		vmd_time_t t = vmd_time_t(first + i) * file->division;
+		double want = 100 + seconds(file->division, from, t);
+		if (std::fabs(times[i] - want) > 1e-6) {
+			char what[64];
+			snprintf(what, sizeof(what), "%s: note-on %zu", name, i);
+			fail(what, times[i], want);
+			return;
+		}
+	}
+}
+
+/* the file's own, rendered on the pool */
+static QSharedPointer<const PlaybackPlan>
+file_plan(File *file, PlaybackPlan::Mode mode = PlaybackPlan::BEND)
+{
+	QSharedPointer<const PlaybackPlan> ret = file->plan(mode);
+	if (!ret.isNull())
+		fail("plan: ready before rendering", 1, 0);
+	for (int i = 0; i < 5000 && ret.isNull(); i++) {
+		QThread::msleep(1);
+		QApplication::processEvents();
+		ret = file->plan(mode);
+	}
+	if (ret.isNull())
+		fail("plan: never ready", 0, 1);
+	return ret;
+}
+
+/* waits until the player has sent n note-ons */
+static bool
+settle(Recorder *rec, size_t n)
+{
+	for (int i = 0; i < 5000 && rec->count() < n; i++)
+		QThread::msleep(1);
+	return rec->count() >= n;
+}
+
+static void
+check_seek_state()
+{
+	File file;
+	/* retuned by a bend before most notes */
+	vmd_track_t *track = file.add_track(VMD_CHANMASK_NODRUMS, "19");
+	for (int i = 0; i < quarters * 2; i++) {
+		vmd_time_t t = vmd_time_t(i) * file.division / 2;
+		vmd_note_t *note = vmd_track_insert(track, t, t + file.division / 2, 100 + i * 7 % 19);
+		note->on_vel = 100;
+	}
+	file.reset_history();
+	QSharedPointer<const PlaybackPlan> plan = file_plan(&file);
+	if (plan.isNull())
+		return;
+
+	VirtualClock clock;
+	SetupCounter counter;
+	Player player(&clock, &counter);
+	/* between notes, so the burst is alone at the start time */
+	player.play(&file, vmd_time_t(quarters - 4) * file.division + file.division / 4, plan);
+	player.wait();
+	player.stop();
+	if (counter.notes == 0)
+		fail("seek state: no notes", 0, 1);
+	for (int c = 0; c < 16; c++) {
+		for (int i = 0; i < 130; i++) {
+			if (counter.counts[c][i] > 1) {
+				char what[64];
+				snprintf(what, sizeof(what), "seek state: channel %d, message %d", c, i);
+				fail(what, counter.counts[c][i], 1);
+				return;
+			}
+		}
+	}
+}
+
+/* every note of a 19-tone track sounds at its notesystem's pitch */
+static void
+check_mts()
+{
+	File file;
+	vmd_track_t *track = file.add_track(VMD_CHANMASK_NODRUMS, "19");
+	std::vector<vmd_pitch_t> played;
+	for (int i = 0; i < quarters; i++) {
+		vmd_time_t t = vmd_time_t(i) * file.division;
+		vmd_pitch_t p = 95 + i * 5 % 38;
+		vmd_note_t *note = vmd_track_insert(track, t, t + file.division / 2, p);
+		note->on_vel = 100;
+		played.push_back(p);
+	}
+	file.reset_history();
+	QSharedPointer<const PlaybackPlan> plan = file_plan(&file, PlaybackPlan::MTS);
+	if (plan.isNull())
+		return;
+
+	VirtualClock clock;
+	TuningRecorder rec;
+	Player player(&clock, &rec);
+	player.play(&file, 0, plan);
+	player.wait();
+	player.stop();
+
+	if (rec.drums != 0)
+		fail("mts: messages on the drum channel", rec.drums, 0);
+	if (rec.programs != 0)
+		fail("mts: retunes of other programs", rec.programs, 0);
+	if (rec.pitches.size() != played.size()) {
+		fail("mts: notes", rec.pitches.size(), played.size());
+		return;
+	}
+	const vmd_notesystem_t &ns = track->notesystem;
+	vmd_notesystem_t tet = vmd_notesystem_tet(12);
+	double semitone = tet.pitches[1] - tet.pitches[0];
+	free(tet.pitches);
+	for (size_t i = 0; i < played.size(); i++) {
+		int octave = played[i] / ns.size, step = played[i] % ns.size;
+		double want = (octave * 12 + ns.pitches[step] / semitone) * (1 << 14);
+		if (std::fabs(rec.pitches[i] - want) > 1) {
+			fail("mts: pitch", rec.pitches[i], want);
+			return;
+		}
+	}
+}
+
+static void
+check_stop(File *file)
+{
+	VirtualClock clock(true);
+	Recorder rec;
+	Player player(&clock, &rec);
+	player.play(file, 0);
+
+	/* into the fast section: quarters 0-9 have started */
+	clock.set(seconds(file->division, 0, vmd_time_t(9) * file->division) + 0.01);
+	if (!settle(&rec, 10))
+		fail("stop: note-ons before stopping", rec.count(), 10);
+	player.stop();
+	size_t sent = rec.count();
+	clock.advance(100);
+	QThread::msleep(20);
+	if (player.isRunning())
+		fail("stop: still running", 1, 0);
+	if (rec.count() != sent || sent != 10)
+		fail("stop: note-ons after stopping", rec.count(), 10);
+	if (player.file() != NULL)
+		fail("stop: file kept", 1, 0);
+}
+
+static void
+check_follow(File *file, vmd_track_t *track)
+{
+	VirtualClock clock(true);
+	Recorder rec;
+	Player player(&clock, &rec);
+	QScrollArea area;
+	area.resize(400, 300);
+	WPiano *piano = new WPiano(file, track, 0, &player);
+	area.setWidget(piano);
+	area.show();
+	QApplication::processEvents();
+
+	QScrollBar *hs = area.horizontalScrollBar();
+	hs->setValue(0);
+	piano->setCursorTime(0);
+	player.play(file, 0);
+	int pages = 0, prev = hs->value();
+	/* in the first tempo section, where the player's time is exact */
+	for (int i = 1; i <= 64; i++) {
+		clock.set(i * 0.0625);
+		piano->follow_player();
+		vmd_time_t want = vmd_time_t(i * 0.0625 * 1e6 / tempos[0].tempo * file->division + 0.5);
+		if (std::abs(long(piano->cursorTime() - want)) > 1) {
+			fail("follow: cursor", piano->cursorTime(), want);
+			break;
+		}
+		if (!piano->timeVisible(piano->cursorTime())) {
+			fail("follow: cursor off screen at", piano->cursorTime(), 0);
+			break;
+		}
+		if (hs->value() < prev) {
+			fail("follow: scrolled back to", hs->value(), prev);
+			break;
+		}
+		pages += hs->value() != prev;
+		prev = hs->value();
+	}
+	player.stop();
+	if (piano->time2x(piano->cursorTime()) > area.viewport()->width() && pages == 0)
+		fail("follow: never paged", 0, 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	QApplication app(argc, argv);
+
+	File file;
+	vmd_track_t *track = make_file(&file);
+	check_play("play", &file, 0);
+	check_play("seek", &file, vmd_time_t(12) * file.division);
+	check_play("seek off beat", &file, vmd_time_t(17) * file.division + file.division / 3);
+	QSharedPointer<const PlaybackPlan> plan = file_plan(&file);
+	if (!plan.isNull()) {
+		check_play("plan", &file, 0, plan);
+		check_play("plan seek", &file, vmd_time_t(18) * file.division, plan);
+	}
+	check_seek_state();
+	check_mts();
+	check_stop(&file);
+	check_follow(&file, track);
+
+	printf("%s\n", failures == 0 ? "ok" : "FAILED");
+	return failures != 0;
+}
@@ -0,0 +1,94 @@
+/* smf_import() against vmd_file_import(): the same notes, channels,
+ * velocities and tempo map for every corpus file it accepts, and for
+ * the files given on the command line.
+ *
+ * usage: smf_import_test [-s scale] [file.mid...]
+ */
+#include <QDir>
+#include <QTemporaryDir>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vomid.h>
+#include "compare.h"
+#include "corpus.h"
+#include "smf.h"
+
+enum Outcome { MATCH, FALLBACK, MISMATCH };
+
+static Outcome
+check(const char *path)
+{
+	vmd_file_t want;
+	vmd_bool_t native;
+	if (vmd_file_import(&want, path, &native) != VMD_OK) {
+		fprintf(stderr, "%s: vmd_file_import failed\n", path);
+		return MISMATCH;
+	}
+
+	vmd_file_t got;
+	vmd_file_init(&got);
+	vmd_status_t status;
+	{
+		SmfMap smf(path);
+		status = smf_import(&got, smf);
+	}
+
+	Outcome ret = FALLBACK;
+	if (status == VMD_OK) {
+		fprintf(stderr, "%s: ", path);
+		ret = compare_files(&got, &want, stderr) ? MATCH : MISMATCH;
+		if (ret == MATCH)
+			fprintf(stderr, "ok\n");
+	} else if (status == VMD_ERROR) {
+		fprintf(stderr, "%s: smf_import failed on a file vmd_file_import reads\n", path);
+		ret = MISMATCH;
+	}
+	vmd_file_fini(&got);
+	vmd_file_fini(&want);
+	return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+	double scale = 0.02;
+	int i = 1;
+	if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+		scale = atof(argv[i + 1]);
+		i += 2;
+	}
+
+	QTemporaryDir dir;
+	if (!dir.isValid()) {
+		fprintf(stderr, "cannot create a temporary directory\n");
+		return 1;
+	}
+
+	int matched = 0, failed = 0;
+	for (int j = 0; j < corpus_specs_count; j++) {
+		const CorpusSpec &spec = corpus_specs[j];
+		for (unsigned seed = 1; seed <= 3; seed++) {
+			QString path = dir.filePath(QString("%1-%2.mid").arg(spec.name).arg(seed));
+			if (!corpus_write(spec, scale, seed, path.toLocal8Bit().data())) {
+				fprintf(stderr, "%s: cannot write\n", path.toLocal8Bit().data());
+				return 1;
+			}
+			switch (check(path.toLocal8Bit().data())) {
+			case MATCH: matched++; break;
+			case MISMATCH: failed++; break;
+			case FALLBACK: break;
+			}
+		}
+	}
+	for (; i < argc; i++) {
+		switch (check(argv[i])) {
+		case MATCH: matched++; break;
+		case MISMATCH: failed++; break;
+		case FALLBACK: break;
+		}
+	}
+
+	printf("%d files match, %d differ\n", matched, failed);
+	return failed > 0 || matched == 0;
+}